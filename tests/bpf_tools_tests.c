@@ -0,0 +1,1756 @@
+/* bpf_tools_tests.c
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Test code for the userspace seccomp BPF tools in ../tools.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <linux/audit.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bpf_batch.h"
+#include "bpf_cost.h"
+#include "bpf_equiv.h"
+#include "bpf_interp.h"
+#include "bpf_jit.h"
+#include "bpf_merge.h"
+#include "bpf_opt.h"
+#include "bpf_policy.h"
+#include "bpf_trace.h"
+#include "test_harness.h"
+
+#ifndef PR_SET_NO_NEW_PRIVS
+#define PR_SET_NO_NEW_PRIVS 38
+#endif
+
+#ifndef SECCOMP_MODE_FILTER
+#define SECCOMP_MODE_FILTER 2
+#endif
+
+#if defined(__i386__)
+#define ARCH_NATIVE AUDIT_ARCH_I386
+#elif defined(__x86_64__)
+#define ARCH_NATIVE AUDIT_ARCH_X86_64
+#elif defined(__aarch64__)
+#define ARCH_NATIVE AUDIT_ARCH_AARCH64
+#elif defined(__arm__)
+#define ARCH_NATIVE AUDIT_ARCH_ARM
+#endif
+
+#define syscall_arg(_n) (offsetof(struct seccomp_data, args[_n]))
+#define ARRAY_SIZE(_a) (sizeof(_a) / sizeof((_a)[0]))
+
+static struct seccomp_data make_data(int nr, __u64 arg0, __u64 arg1)
+{
+	struct seccomp_data data;
+
+	memset(&data, 0, sizeof(data));
+	data.nr = nr;
+	data.args[0] = arg0;
+	data.args[1] = arg1;
+	return data;
+}
+
+/* The TRAP fixture's filter from seccomp_bpf_tests.c. */
+TEST(interp_trap_filter) {
+	struct sock_filter filter[] = {
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			offsetof(struct seccomp_data, nr)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, __NR_getpid, 0, 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_TRAP),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+	};
+	struct seccomp_data data = make_data(__NR_getpid, 0, 0);
+	unsigned int steps;
+
+	ASSERT_EQ(0, bpf_check(filter, ARRAY_SIZE(filter), NULL));
+	EXPECT_EQ(SECCOMP_RET_TRAP, bpf_run(filter, &data, &steps));
+	EXPECT_EQ(3, steps);
+	data.nr = __NR_getppid;
+	EXPECT_EQ(SECCOMP_RET_ALLOW, bpf_run(filter, &data, &steps));
+	EXPECT_EQ(3, steps);
+}
+
+/* The TRACE_syscall fixture's filter. */
+TEST(interp_trace_filter) {
+	struct sock_filter filter[] = {
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			offsetof(struct seccomp_data, nr)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, __NR_getpid, 0, 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_TRACE | 0x1002),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, __NR_gettid, 0, 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_TRACE | 0x1003),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, __NR_getppid, 0, 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_TRACE | 0x1004),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+	};
+	struct seccomp_data data = make_data(__NR_gettid, 0, 0);
+
+	ASSERT_EQ(0, bpf_check(filter, ARRAY_SIZE(filter), NULL));
+	EXPECT_EQ(SECCOMP_RET_TRACE | 0x1003, bpf_run(filter, &data, NULL));
+	data.nr = __NR_getppid;
+	EXPECT_EQ(SECCOMP_RET_TRACE | 0x1004, bpf_run(filter, &data, NULL));
+	data.nr = __NR_read;
+	EXPECT_EQ(SECCOMP_RET_ALLOW, bpf_run(filter, &data, NULL));
+}
+
+TEST(interp_alu_and_memory) {
+	struct sock_filter filter[] = {
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS, syscall_arg(1)),
+		BPF_STMT(BPF_MISC|BPF_TAX, 0),
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS, syscall_arg(0)),
+		BPF_STMT(BPF_ALU|BPF_MUL|BPF_X, 0),	/* 6 * 7 */
+		BPF_STMT(BPF_ALU|BPF_SUB|BPF_K, 2),	/* 40 */
+		BPF_STMT(BPF_ST, 3),
+		BPF_STMT(BPF_ALU|BPF_LSH|BPF_K, 4),	/* 640 */
+		BPF_STMT(BPF_ALU|BPF_DIV|BPF_X, 0),	/* 91 */
+		BPF_STMT(BPF_ALU|BPF_XOR|BPF_K, 0xff),	/* 164 */
+		BPF_STMT(BPF_LDX|BPF_MEM, 3),
+		BPF_STMT(BPF_ALU|BPF_OR|BPF_X, 0),	/* 172 */
+		BPF_STMT(BPF_ALU|BPF_NEG, 0),
+		BPF_STMT(BPF_ALU|BPF_NEG, 0),
+		BPF_JUMP(BPF_JMP|BPF_JSET|BPF_K, 0x100, 2, 0),
+		BPF_JUMP(BPF_JMP|BPF_JGT|BPF_X, 0, 0, 1),
+		BPF_STMT(BPF_RET|BPF_A, 0),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_KILL),
+	};
+	struct seccomp_data data = make_data(__NR_read, 6, 7);
+
+	ASSERT_EQ(0, bpf_check(filter, ARRAY_SIZE(filter), NULL));
+	EXPECT_EQ(172, bpf_run(filter, &data, NULL));
+}
+
+TEST(interp_div_by_zero_kills) {
+	struct sock_filter filter[] = {
+		BPF_STMT(BPF_LDX|BPF_W|BPF_ABS, 0),
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS, syscall_arg(0)),
+		BPF_STMT(BPF_MISC|BPF_TAX, 0),
+		BPF_STMT(BPF_LD|BPF_IMM, 100),
+		BPF_STMT(BPF_ALU|BPF_DIV|BPF_X, 0),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+	};
+	struct seccomp_data data = make_data(__NR_read, 0, 0);
+
+	/* LDX ABS isn't a seccomp instruction. */
+	EXPECT_EQ(-1, bpf_check(filter, ARRAY_SIZE(filter), NULL));
+	EXPECT_EQ(EINVAL, errno);
+	ASSERT_EQ(0, bpf_check(filter + 1, ARRAY_SIZE(filter) - 1, NULL));
+	EXPECT_EQ(SECCOMP_RET_KILL, bpf_run(filter + 1, &data, NULL));
+	data.args[0] = 5;
+	EXPECT_EQ(SECCOMP_RET_ALLOW, bpf_run(filter + 1, &data, NULL));
+}
+
+TEST(check_rejects_like_the_kernel) {
+	struct {
+		struct sock_filter insn[3];
+		unsigned int len, bad;
+	} cases[] = {
+		/* Doesn't end in a return. */
+		{ { BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 0) }, 1, 1 },
+		/* Misaligned and out of range loads. */
+		{ { BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 2),
+		    BPF_STMT(BPF_RET|BPF_K, 0) }, 2, 0 },
+		{ { BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			     sizeof(struct seccomp_data)),
+		    BPF_STMT(BPF_RET|BPF_K, 0) }, 2, 0 },
+		/* Byte loads aren't allowed. */
+		{ { BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 0),
+		    BPF_STMT(BPF_RET|BPF_K, 0) }, 2, 0 },
+		/* Jumps past the end. */
+		{ { BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0, 1, 0),
+		    BPF_STMT(BPF_RET|BPF_K, 0) }, 2, 0 },
+		{ { BPF_STMT(BPF_JMP|BPF_JA, 1),
+		    BPF_STMT(BPF_RET|BPF_K, 0) }, 2, 0 },
+		/* Constant division by zero and oversized shifts. */
+		{ { BPF_STMT(BPF_ALU|BPF_DIV|BPF_K, 0),
+		    BPF_STMT(BPF_RET|BPF_K, 0) }, 2, 0 },
+		{ { BPF_STMT(BPF_ALU|BPF_RSH|BPF_K, 32),
+		    BPF_STMT(BPF_RET|BPF_K, 0) }, 2, 0 },
+		/* Scratch memory read before it is written on some path. */
+		{ { BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0, 0, 1),
+		    BPF_STMT(BPF_ST, 0),
+		    BPF_STMT(BPF_LD|BPF_MEM, 0) }, 3, 2 },
+		{ { BPF_STMT(BPF_ST, BPF_MEMWORDS),
+		    BPF_STMT(BPF_RET|BPF_K, 0) }, 2, 0 },
+		/* Returning X isn't allowed. */
+		{ { BPF_STMT(BPF_RET|BPF_X, 0) }, 1, 0 },
+		{ { }, 0, 0 },
+	};
+	unsigned int i, bad;
+	int status;
+	pid_t pid;
+
+	for (i = 0; i < ARRAY_SIZE(cases); i++) {
+		struct sock_fprog prog = {
+			.len = cases[i].len,
+			.filter = cases[i].insn,
+		};
+
+		bad = -1;
+		EXPECT_EQ(-1, bpf_check(cases[i].insn, cases[i].len, &bad)) {
+			TH_LOG("case %u was accepted", i);
+		}
+		EXPECT_EQ(cases[i].bad, bad) {
+			TH_LOG("case %u", i);
+		}
+
+		/* The kernel must agree. */
+		pid = fork();
+		ASSERT_LE(0, pid);
+		if (pid == 0) {
+			if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0))
+				_exit(0xff);
+			prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog, 0, 0);
+			_exit(errno);
+		}
+		ASSERT_EQ(pid, waitpid(pid, &status, 0));
+		EXPECT_EQ(EINVAL, WEXITSTATUS(status)) {
+			TH_LOG("kernel disagrees on case %u", i);
+		}
+	}
+}
+
+TEST(chain_precedence) {
+	struct sock_filter allow[] = {
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+	};
+	struct sock_filter trace[] = {
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_TRACE),
+	};
+	struct sock_filter error[] = {
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ERRNO | 1),
+	};
+	struct sock_filter error2[] = {
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ERRNO | 2),
+	};
+	struct sock_filter trap[] = {
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_TRAP),
+	};
+	struct sock_filter kill[] = {
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_KILL),
+	};
+	struct sock_filter kill_process[] = {
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_KILL_PROCESS),
+	};
+	struct sock_fprog chain[] = {
+		{ 1, kill_process },
+		{ 1, kill },
+		{ 1, trap },
+		{ 1, error },
+		{ 1, error2 },
+		{ 1, trace },
+		{ 1, allow },
+	};
+	struct seccomp_data data = make_data(__NR_getpid, 0, 0);
+
+	EXPECT_EQ(SECCOMP_RET_ALLOW, bpf_run_chain(chain, 0, &data));
+	EXPECT_EQ(SECCOMP_RET_TRACE, bpf_run_chain(chain + 5, 2, &data));
+	/* The newest of two equal actions wins. */
+	EXPECT_EQ(SECCOMP_RET_ERRNO | 2, bpf_run_chain(chain + 3, 4, &data));
+	EXPECT_EQ(SECCOMP_RET_TRAP, bpf_run_chain(chain + 2, 5, &data));
+	EXPECT_EQ(SECCOMP_RET_KILL, bpf_run_chain(chain + 1, 6, &data));
+	EXPECT_EQ(SECCOMP_RET_KILL_PROCESS, bpf_run_chain(chain, 7, &data));
+}
+
+/*
+ * Installs a filter which computes an errno from getpid's arguments and
+ * compares what the kernel returns with the interpreter.
+ */
+static void check_against_kernel(struct __test_metadata *_metadata,
+				 struct sock_filter *filter, unsigned int len,
+				 __u64 arg0, __u64 arg1)
+{
+	struct sock_fprog prog = { .len = len, .filter = filter };
+	struct seccomp_data data = make_data(__NR_getpid, arg0, arg1);
+	__u32 expected;
+	int status;
+	pid_t pid;
+
+	ASSERT_EQ(0, bpf_check(filter, len, NULL));
+	expected = bpf_run(filter, &data, NULL);
+	ASSERT_EQ(SECCOMP_RET_ERRNO, SECCOMP_ACTION(expected));
+
+	pid = fork();
+	ASSERT_LE(0, pid);
+	if (pid == 0) {
+		long ret;
+
+		if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) ||
+		    prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog, 0, 0))
+			_exit(0xff);
+		errno = 0;
+		ret = syscall(__NR_getpid, arg0, arg1);
+		/* An errno of 0 makes the call "succeed" with 0. */
+		_exit(ret == -1 ? errno : 0);
+	}
+	ASSERT_EQ(pid, waitpid(pid, &status, 0));
+	ASSERT_TRUE(WIFEXITED(status));
+	EXPECT_EQ(expected & 0xff, WEXITSTATUS(status)) {
+		TH_LOG("args 0x%llx, 0x%llx", (unsigned long long)arg0,
+		       (unsigned long long)arg1);
+	}
+}
+
+TEST(interp_matches_kernel) {
+	struct sock_filter filter[] = {
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			 offsetof(struct seccomp_data, nr)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, __NR_getpid, 1, 0),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS, syscall_arg(1)),
+		BPF_STMT(BPF_MISC|BPF_TAX, 0),
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS, syscall_arg(0)),
+		BPF_STMT(BPF_ALU|BPF_LSH|BPF_X, 0),
+		BPF_STMT(BPF_ALU|BPF_SUB|BPF_X, 0),
+		BPF_STMT(BPF_ALU|BPF_MUL|BPF_K, 0x9e3779b9),
+		BPF_STMT(BPF_ALU|BPF_RSH|BPF_K, 24),
+		BPF_JUMP(BPF_JMP|BPF_JGE|BPF_X, 0, 0, 1),
+		BPF_STMT(BPF_ALU|BPF_XOR|BPF_K, 0x5a),
+		BPF_STMT(BPF_ALU|BPF_AND|BPF_K, 0xff),
+		BPF_STMT(BPF_ALU|BPF_OR|BPF_K, SECCOMP_RET_ERRNO),
+		BPF_STMT(BPF_RET|BPF_A, 0),
+	};
+	static const __u64 args[][2] = {
+		{ 0, 0 }, { 1, 1 }, { 0xffffffff, 31 }, { 0x12345678, 33 },
+		{ 0x80000000, 1 }, { 7, 0xffffffff00000003ULL },
+	};
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(args); i++)
+		check_against_kernel(_metadata, filter, ARRAY_SIZE(filter),
+				     args[i][0], args[i][1]);
+}
+
+TEST(trace_and_filter_files) {
+	struct sock_filter filter[] = {
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			offsetof(struct seccomp_data, nr)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, __NR_getpid, 0, 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ERRNO | EPERM),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+	};
+	struct sock_fprog prog = { ARRAY_SIZE(filter), filter }, loaded;
+	int nrs[] = { __NR_getpid, __NR_read, __NR_getpid, 5000 };
+	char path[] = "/tmp/bpf_tools_tests.XXXXXX";
+	struct bpf_replay_stats *stats;
+	struct bpf_trace trace;
+	unsigned int i;
+	int fd;
+
+	ASSERT_LE(0, fd = mkstemp(path));
+	close(fd);
+
+	ASSERT_EQ(0, bpf_filter_write(path, &prog));
+	ASSERT_EQ(0, bpf_filter_read(path, &loaded));
+	ASSERT_EQ(prog.len, loaded.len);
+	EXPECT_EQ(0, memcmp(filter, loaded.filter, sizeof(filter)));
+	free(loaded.filter);
+	/* A filter file is not a trace. */
+	EXPECT_EQ(-1, bpf_trace_open(path, &trace));
+	EXPECT_EQ(EINVAL, errno);
+
+	ASSERT_LE(0, fd = bpf_trace_create(path));
+	for (i = 0; i < ARRAY_SIZE(nrs); i++) {
+		struct seccomp_data data = make_data(nrs[i], i, 0);
+
+		ASSERT_EQ(0, bpf_trace_append(fd, &data));
+	}
+	/* A torn record is dropped. */
+	ASSERT_EQ(3, write(fd, "abc", 3));
+	close(fd);
+	/* A trace is not a filter. */
+	EXPECT_EQ(-1, bpf_filter_read(path, &loaded));
+	EXPECT_EQ(EINVAL, errno);
+
+	ASSERT_EQ(0, bpf_trace_open(path, &trace));
+	unlink(path);
+	ASSERT_EQ(ARRAY_SIZE(nrs), trace.count);
+	EXPECT_EQ(3, trace.records[3].args[0]);
+
+	stats = malloc(sizeof(*stats));
+	ASSERT_NE(NULL, stats);
+	ASSERT_EQ(0, bpf_replay(&prog, &trace, NULL, 2, stats));
+	EXPECT_EQ(4, stats->evals);
+	EXPECT_EQ(2, stats->actions[BPF_ACTION_ERRNO]);
+	EXPECT_EQ(2, stats->actions[BPF_ACTION_ALLOW]);
+	EXPECT_EQ(2, stats->syscalls[__NR_getpid].evals);
+	EXPECT_EQ(3, stats->syscalls[__NR_getpid].max_steps);
+	EXPECT_EQ(3, stats->syscalls[__NR_read].min_steps);
+	/* Out of range syscall numbers share the last slot. */
+	EXPECT_EQ(1, stats->syscalls[BPF_REPLAY_MAX_NR].evals);
+	EXPECT_EQ(12, stats->steps);
+	free(stats);
+	bpf_trace_close(&trace);
+}
+
+/* A few thousand records with syscall numbers and arguments all over. */
+static struct seccomp_data *random_records(size_t count)
+{
+	struct seccomp_data *data = calloc(count, sizeof(*data));
+	__u64 seed = 0x853c49e6748fea9bULL;
+	size_t i, j;
+
+	for (i = 0; data && i < count; i++) {
+		for (j = 0; j < 6; j++) {
+			seed = seed * 6364136223846793005ULL +
+			       1442695040888963407ULL;
+			data[i].args[j] = seed ^ (seed >> 29);
+		}
+		data[i].nr = (seed >> 40) % 48;
+		data[i].arch = (seed >> 20) & 1 ? 0xc000003e : 0x40000003;
+		data[i].instruction_pointer = seed;
+	}
+	return data;
+}
+
+/* Divergent branches of every kind, with ALU work and scratch memory. */
+static struct sock_filter branchy[] = {
+	BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+		 offsetof(struct seccomp_data, arch)),
+	BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0xc000003e, 1, 0),
+	BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_KILL),
+	BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+		 offsetof(struct seccomp_data, nr)),
+	BPF_STMT(BPF_ST, 3),
+	BPF_JUMP(BPF_JMP|BPF_JGE|BPF_K, 24, 0, 6),
+	BPF_JUMP(BPF_JMP|BPF_JGT|BPF_K, 36, 0, 2),
+	BPF_STMT(BPF_LD|BPF_W|BPF_ABS, syscall_arg(2)),
+	BPF_JUMP(BPF_JMP|BPF_JSET|BPF_K, 0x10, 7, 8),
+	BPF_STMT(BPF_ALU|BPF_AND|BPF_K, 3),
+	BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 1, 5, 0),
+	BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ERRNO | 1),
+	BPF_STMT(BPF_LD|BPF_W|BPF_ABS, syscall_arg(0)),
+	BPF_STMT(BPF_MISC|BPF_TAX, 0),
+	BPF_STMT(BPF_LD|BPF_MEM, 3),
+	BPF_JUMP(BPF_JMP|BPF_JSET|BPF_X, 0, 2, 0),
+	BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_TRACE | 7),
+	BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_TRAP),
+	BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+};
+
+/* Shifts and division by X, which kills when X is 0. */
+static struct sock_filter arith[] = {
+	BPF_STMT(BPF_LD|BPF_W|BPF_ABS, syscall_arg(1)),
+	BPF_STMT(BPF_ALU|BPF_AND|BPF_K, 0x3f),
+	BPF_STMT(BPF_MISC|BPF_TAX, 0),
+	BPF_STMT(BPF_LD|BPF_W|BPF_ABS, syscall_arg(0)),
+	BPF_STMT(BPF_ALU|BPF_LSH|BPF_X, 0),
+	BPF_STMT(BPF_ALU|BPF_RSH|BPF_K, 3),
+	BPF_STMT(BPF_ALU|BPF_MUL|BPF_K, 0x9e3779b9),
+	BPF_STMT(BPF_ALU|BPF_NEG, 0),
+	BPF_STMT(BPF_ALU|BPF_DIV|BPF_K, 7),
+	BPF_STMT(BPF_STX, 0),
+	BPF_STMT(BPF_LDX|BPF_MEM, 0),
+	BPF_STMT(BPF_ALU|BPF_AND|BPF_K, 0xf),
+	BPF_STMT(BPF_MISC|BPF_TAX, 0),
+	BPF_STMT(BPF_LD|BPF_W|BPF_ABS, syscall_arg(3)),
+	BPF_STMT(BPF_ALU|BPF_DIV|BPF_X, 0),
+	BPF_JUMP(BPF_JMP|BPF_JGT|BPF_X, 0, 0, 1),
+	BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+	BPF_STMT(BPF_ALU|BPF_AND|BPF_K, 0xfff),
+	BPF_STMT(BPF_ALU|BPF_OR|BPF_K, SECCOMP_RET_ERRNO),
+	BPF_STMT(BPF_RET|BPF_A, 0),
+};
+
+TEST(batch_matches_interp) {
+	struct sock_fprog progs[] = {
+		{ ARRAY_SIZE(branchy), branchy },
+		{ ARRAY_SIZE(arith), arith },
+	};
+	/* Not a multiple of any lane count, to cover the scalar tail. */
+	const size_t count = 4099;
+	struct seccomp_data *data = random_records(count);
+	enum bpf_batch_isa isa;
+	unsigned int i;
+
+	ASSERT_NE(NULL, data);
+	for (i = 0; i < ARRAY_SIZE(progs); i++) {
+		ASSERT_EQ(0, bpf_check(progs[i].filter, progs[i].len, NULL));
+		for (isa = 0; isa < BPF_BATCH_ISAS; isa++) {
+			size_t bad;
+
+			if (!bpf_batch_isa_supported(isa)) {
+				TH_LOG("%s not supported here",
+				       bpf_batch_isa_name(isa));
+				continue;
+			}
+			bad = bpf_batch_verify(progs[i].filter, data, count,
+					       isa);
+			EXPECT_EQ(count, bad) {
+				TH_LOG("filter %u, %s: record %zu differs", i,
+				       bpf_batch_isa_name(isa), bad);
+			}
+		}
+	}
+	free(data);
+}
+
+TEST(jit_matches_interp) {
+	/* The encodings the other two filters leave out. */
+	struct sock_filter misc[] = {
+		BPF_STMT(BPF_LD|BPF_W|BPF_LEN, 0),
+		BPF_STMT(BPF_LDX|BPF_IMM, 5),
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			 offsetof(struct seccomp_data, nr)),
+		BPF_JUMP(BPF_JMP|BPF_JGE|BPF_X, 0, 0, 2),
+		BPF_STMT(BPF_ALU|BPF_SUB|BPF_X, 0),
+		BPF_JUMP(BPF_JMP|BPF_JA, 3, 0, 0),
+		BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+		BPF_STMT(BPF_ALU|BPF_XOR|BPF_X, 0),
+		BPF_STMT(BPF_ALU|BPF_OR|BPF_X, 0),
+		BPF_STMT(BPF_ST, 15),
+		BPF_STMT(BPF_LDX|BPF_W|BPF_LEN, 0),
+		BPF_STMT(BPF_ALU|BPF_MUL|BPF_X, 0),
+		BPF_STMT(BPF_ALU|BPF_AND|BPF_X, 0),
+		BPF_STMT(BPF_ALU|BPF_RSH|BPF_X, 0),
+		BPF_STMT(BPF_MISC|BPF_TXA, 0),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_X, 0, 0, 1),
+		BPF_STMT(BPF_LD|BPF_MEM, 15),
+		BPF_JUMP(BPF_JMP|BPF_JGT|BPF_K, 40, 1, 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_KILL),
+		BPF_STMT(BPF_ALU|BPF_OR|BPF_K, SECCOMP_RET_ERRNO),
+		BPF_STMT(BPF_RET|BPF_A, 0),
+	};
+	struct sock_fprog progs[] = {
+		{ ARRAY_SIZE(branchy), branchy },
+		{ ARRAY_SIZE(arith), arith },
+		{ ARRAY_SIZE(misc), misc },
+	};
+	const size_t count = 4096;
+	struct seccomp_data *data = random_records(count);
+	struct bpf_jit jit;
+	unsigned int i;
+
+	ASSERT_NE(NULL, data);
+	for (i = 0; i < ARRAY_SIZE(progs); i++) {
+		size_t bad;
+
+		ASSERT_EQ(0, bpf_jit_compile(progs[i].filter, progs[i].len,
+					     &jit)) {
+			TH_LOG("filter %u: %s", i, strerror(errno));
+		}
+		bad = bpf_jit_verify(&jit, progs[i].filter, data, count);
+		EXPECT_EQ(count, bad) {
+			TH_LOG("filter %u: record %zu differs", i, bad);
+		}
+		bpf_jit_free(&jit);
+	}
+	free(data);
+
+	/* Only programs the kernel would take are compiled. */
+	misc[1].code = BPF_LDX|BPF_MEM;
+	EXPECT_EQ(-1, bpf_jit_compile(misc, ARRAY_SIZE(misc), &jit));
+	EXPECT_EQ(EINVAL, errno);
+	EXPECT_EQ(NULL, jit.func);
+}
+
+/*
+ * Rules for |count| distinct syscall numbers below 1024, each with one of a
+ * handful of actions, so that runs of the same action are short.
+ */
+static struct bpf_policy_rule *random_rules(unsigned int count)
+{
+	static const __u32 actions[] = {
+		SECCOMP_RET_ALLOW, SECCOMP_RET_TRAP, SECCOMP_RET_ERRNO | 1,
+		SECCOMP_RET_ERRNO | 13, SECCOMP_RET_TRACE | 7,
+	};
+	struct bpf_policy_rule *rules = calloc(count, sizeof(*rules));
+	unsigned char used[1024] = { 0 };
+	__u64 seed = 0xda3e39cb94b95bdbULL;
+	unsigned int i;
+
+	for (i = 0; rules && i < count; i++) {
+		__u32 nr;
+
+		do {
+			seed = seed * 6364136223846793005ULL +
+			       1442695040888963407ULL;
+			nr = (seed >> 33) % 1024;
+		} while (used[nr]);
+		used[nr] = 1;
+		rules[i].nr = nr;
+		rules[i].action = actions[(seed >> 20) % ARRAY_SIZE(actions)];
+	}
+	return rules;
+}
+
+/* Every syscall number gets its rule's action, or the default. */
+static void check_policy(struct __test_metadata *_metadata,
+			 const struct bpf_policy *policy,
+			 const struct sock_fprog *prog, unsigned int *max_steps)
+{
+	static const __u32 extra[] = { 1024, 4096, 0x7fffffff, 0xfffffffe,
+				       0xffffffff };
+	struct seccomp_data data = make_data(0, 0, 0);
+	unsigned int i, steps;
+	__u32 nr;
+
+	ASSERT_EQ(0, bpf_check(prog->filter, prog->len, NULL));
+	*max_steps = 0;
+	data.arch = policy->arch;
+	for (nr = 0; nr < 1024 + ARRAY_SIZE(extra); nr++) {
+		__u32 expected = policy->default_action;
+
+		data.nr = nr < 1024 ? nr : extra[nr - 1024];
+		for (i = 0; i < policy->count; i++)
+			if (policy->rules[i].nr == data.nr)
+				expected = policy->rules[i].action;
+		EXPECT_EQ(expected, bpf_run(prog->filter, &data, &steps)) {
+			TH_LOG("syscall %u", data.nr);
+		}
+		if (steps > *max_steps)
+			*max_steps = steps;
+	}
+	data.nr = policy->rules[0].nr;
+	data.arch = ~policy->arch;
+	EXPECT_EQ(SECCOMP_RET_KILL, bpf_run(prog->filter, &data, NULL));
+}
+
+TEST(policy_compile) {
+	struct bpf_policy policy = {
+		.arch = 0xc000003e,
+		.default_action = SECCOMP_RET_ERRNO | 38,
+		.count = 300,
+	};
+	struct sock_fprog prog;
+	unsigned int len, steps, bitmap_steps;
+
+	policy.rules = random_rules(policy.count);
+	ASSERT_NE(NULL, policy.rules);
+
+	ASSERT_EQ(0, bpf_policy_compile(&policy, BPF_POLICY_LINEAR, &prog));
+	check_policy(_metadata, &policy, &prog, &steps);
+	EXPECT_EQ(3 + policy.count + 1, steps);
+	free(prog.filter);
+
+	/*
+	 * Up to 601 intervals take ten levels of the tree, and each level
+	 * may add a trampoline, with this many rules.
+	 */
+	ASSERT_EQ(0, bpf_policy_compile(&policy, BPF_POLICY_BSEARCH, &prog));
+	check_policy(_metadata, &policy, &prog, &steps);
+	EXPECT_GE(3 + 2 * 10 + 1, steps);
+	len = prog.len;
+	free(prog.filter);
+
+	/* Bitmaps never make it bigger, nor the paths much longer. */
+	ASSERT_EQ(0, bpf_policy_compile(&policy, BPF_POLICY_BITMAP, &prog));
+	check_policy(_metadata, &policy, &prog, &bitmap_steps);
+	EXPECT_GE(len, prog.len);
+	EXPECT_GE(steps + 2, bitmap_steps);
+
+	/* Leaves share returns, and jumps skip the trampolines. */
+	ASSERT_EQ(0, bpf_optimize(&prog, NULL));
+	check_policy(_metadata, &policy, &prog, &steps);
+	EXPECT_GE(bitmap_steps, steps);
+	free(prog.filter);
+
+	/* Rules at either end of the range. */
+	policy.rules[0].nr = 0;
+	policy.rules[1].nr = 0xffffffff;
+	ASSERT_EQ(0, bpf_policy_compile(&policy, BPF_POLICY_BSEARCH, &prog));
+	check_policy(_metadata, &policy, &prog, &steps);
+	free(prog.filter);
+	ASSERT_EQ(0, bpf_policy_compile(&policy, BPF_POLICY_BITMAP, &prog));
+	check_policy(_metadata, &policy, &prog, &steps);
+	free(prog.filter);
+
+	policy.rules[1].nr = policy.rules[2].nr;
+	EXPECT_EQ(-1, bpf_policy_compile(&policy, BPF_POLICY_BSEARCH, &prog));
+	EXPECT_EQ(EINVAL, errno);
+	free(policy.rules);
+}
+
+TEST(policy_ranges_and_bitmaps) {
+	struct bpf_policy_rule rules[200];
+	struct bpf_policy policy = {
+		.arch = 0xc000003e,
+		.default_action = SECCOMP_RET_KILL,
+		.rules = rules,
+	};
+	struct sock_fprog prog;
+	unsigned int i, steps;
+
+	/* A dense run is one range, whatever the layout. */
+	for (i = 0; i < 100; i++)
+		rules[i] = (struct bpf_policy_rule){ 100 + i,
+						     SECCOMP_RET_ALLOW };
+	policy.count = 100;
+	ASSERT_EQ(0, bpf_policy_compile(&policy, BPF_POLICY_BSEARCH, &prog));
+	check_policy(_metadata, &policy, &prog, &steps);
+	/* The arch check and nr load, then two JGE and a RET. */
+	EXPECT_EQ(4 + 2 + 3, prog.len);
+	EXPECT_EQ(3 + 2 + 1, steps);
+	free(prog.filter);
+
+	/*
+	 * Every third number in 0..191: 64 one-number intervals, the 63 gaps
+	 * between them and the tail, 128 in all.  Each 32-number window is
+	 * one leaf.
+	 */
+	for (i = 0; i < 64; i++)
+		rules[i] = (struct bpf_policy_rule){ 3 * i,
+						     SECCOMP_RET_ERRNO | 1 };
+	policy.count = 64;
+	ASSERT_EQ(0, bpf_policy_compile(&policy, BPF_POLICY_BSEARCH, &prog));
+	check_policy(_metadata, &policy, &prog, &steps);
+	EXPECT_EQ(4 + 2 * 128 - 1, prog.len);
+	free(prog.filter);
+	ASSERT_EQ(0, bpf_policy_compile(&policy, BPF_POLICY_BITMAP, &prog));
+	check_policy(_metadata, &policy, &prog, &steps);
+	EXPECT_GT(4 + 7 * 7 + 6, prog.len);
+	free(prog.filter);
+}
+
+TEST(policy_parse) {
+	static const char text[] =
+		"# comment\n"
+		"arch 0xc000003e\n"
+		"default errno 1\n"
+		"\n"
+		"0 allow\n"
+		"39 trap   # getpid\n"
+		"60 kill_process\n"
+		"231 trace 0x7\n";
+	static const char *const bad[] = {
+		"arch 0xc000003e\n0 errno\n",
+		"arch 0xc000003e\n0 allow 1\n",
+		"arch 0xc000003e\n0 errno 65536\n",
+		"arch 0xc000003e\n0x100000000 allow\n",
+		"arch 0xc000003e\nread allow\n",
+		"arch 0xc000003e\n0 permit\n",
+		"0 allow\n",
+	};
+	struct bpf_policy policy;
+	unsigned int i, line;
+	FILE *f;
+
+	f = fmemopen((void *)text, sizeof(text) - 1, "r");
+	ASSERT_NE(NULL, f);
+	ASSERT_EQ(0, bpf_policy_parse(f, &policy, &line));
+	fclose(f);
+	EXPECT_EQ(0xc000003e, policy.arch);
+	EXPECT_EQ(SECCOMP_RET_ERRNO | 1, policy.default_action);
+	ASSERT_EQ(4, policy.count);
+	EXPECT_EQ(39, policy.rules[1].nr);
+	EXPECT_EQ(SECCOMP_RET_TRAP, policy.rules[1].action);
+	EXPECT_EQ(SECCOMP_RET_KILL_PROCESS, policy.rules[2].action);
+	EXPECT_EQ(SECCOMP_RET_TRACE | 7, policy.rules[3].action);
+	free(policy.rules);
+
+	for (i = 0; i < ARRAY_SIZE(bad); i++) {
+		f = fmemopen((void *)bad[i], strlen(bad[i]), "r");
+		ASSERT_NE(NULL, f);
+		line = ~0U;
+		EXPECT_EQ(-1, bpf_policy_parse(f, &policy, &line)) {
+			TH_LOG("case %u was accepted", i);
+		}
+		EXPECT_EQ(EINVAL, errno);
+		EXPECT_EQ(i + 1 < ARRAY_SIZE(bad) ? 2 : 0, line) {
+			TH_LOG("case %u", i);
+		}
+		fclose(f);
+	}
+}
+
+/* Optimizes a copy of |filter| into |prog|, which must be freed. */
+static int optimize_copy(const struct sock_filter *filter, unsigned int len,
+			 struct sock_fprog *prog, struct bpf_opt_stats *stats)
+{
+	prog->len = len;
+	prog->filter = malloc(len * sizeof(*filter));
+	if (!prog->filter)
+		return -1;
+	memcpy(prog->filter, filter, len * sizeof(*filter));
+	return bpf_optimize(prog, stats);
+}
+
+TEST(opt_shortens) {
+	/* A stack of two filters, each checking arch, as a merge would be. */
+	struct sock_filter stacked[] = {
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			 offsetof(struct seccomp_data, arch)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0xc000003e, 1, 0),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_KILL),
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			 offsetof(struct seccomp_data, arch)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0xc000003e, 1, 0),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_KILL),
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS, syscall_arg(0)),
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			 offsetof(struct seccomp_data, nr)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, __NR_getpid, 0, 1),
+		BPF_JUMP(BPF_JMP|BPF_JA, 4, 0, 0),
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			 offsetof(struct seccomp_data, nr)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, __NR_gettid, 0, 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ERRNO | 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+	};
+	struct sock_filter expected[] = {
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			 offsetof(struct seccomp_data, arch)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0xc000003e, 1, 0),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_KILL),
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			 offsetof(struct seccomp_data, nr)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, __NR_getpid, 2, 0),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, __NR_gettid, 0, 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ERRNO | 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+	};
+	/*
+	 * The BPF_JA at 5 lands on a return, but as that return, the word
+	 * stored at 2 would flow into the load at 6 unchecked: it stays.
+	 */
+	struct sock_filter stored[] = {
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			 offsetof(struct seccomp_data, nr)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 1, 0, 2),
+		BPF_STMT(BPF_ST, 0),
+		BPF_JUMP(BPF_JMP|BPF_JA, 2, 0, 0),
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS, syscall_arg(0)),
+		BPF_JUMP(BPF_JMP|BPF_JA, 3, 0, 0),
+		BPF_STMT(BPF_LD|BPF_MEM, 0),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 5, 0, 1),
+		BPF_STMT(BPF_RET|BPF_K, 0),
+		BPF_STMT(BPF_RET|BPF_A, 0),
+	};
+	struct bpf_opt_stats stats;
+	struct seccomp_data data;
+	struct sock_fprog prog;
+	unsigned int i;
+
+	ASSERT_EQ(0, optimize_copy(stacked, ARRAY_SIZE(stacked), &prog,
+				   &stats));
+	ASSERT_EQ(ARRAY_SIZE(expected), prog.len);
+	for (i = 0; i < prog.len; i++) {
+		EXPECT_EQ(expected[i].code, prog.filter[i].code) {
+			TH_LOG("instruction %u", i);
+		}
+		EXPECT_EQ(expected[i].k, prog.filter[i].k);
+		EXPECT_EQ(expected[i].jt, prog.filter[i].jt);
+		EXPECT_EQ(expected[i].jf, prog.filter[i].jf);
+	}
+	EXPECT_EQ(2, stats.loads);
+	EXPECT_LT(0, stats.threaded);
+	EXPECT_LT(0, stats.merged);
+	EXPECT_LT(0, stats.dead);
+	free(prog.filter);
+
+	ASSERT_EQ(0, bpf_check(stored, ARRAY_SIZE(stored), NULL));
+	ASSERT_EQ(0, optimize_copy(stored, ARRAY_SIZE(stored), &prog, NULL));
+	EXPECT_EQ(0, bpf_check(prog.filter, prog.len, NULL));
+	for (i = 0; i < 3; i++) {
+		data = make_data(i, 5 * i, 0);
+		EXPECT_EQ(bpf_run(stored, &data, NULL),
+			  bpf_run(prog.filter, &data, NULL));
+	}
+	free(prog.filter);
+
+	/* Programs which fail bpf_check() are left alone. */
+	prog.filter = stacked;
+	prog.len = ARRAY_SIZE(stacked) - 1;
+	stacked[prog.len - 1].code = BPF_LD|BPF_MEM;
+	EXPECT_EQ(-1, bpf_optimize(&prog, NULL));
+	EXPECT_EQ(EINVAL, errno);
+	EXPECT_EQ(ARRAY_SIZE(stacked) - 1, prog.len);
+}
+
+TEST(opt_matches_interp) {
+	/* resumption.c's filter, with some thunk address. */
+	struct sock_filter thunk[] = {
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			 offsetof(struct seccomp_data, nr)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 15, 3, 0),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 60, 2, 0),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 15, 1, 0),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 1, 0, 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			 offsetof(struct seccomp_data, instruction_pointer)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0x1000, 0, 3),
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			 offsetof(struct seccomp_data, instruction_pointer) +
+			 sizeof(int)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0, 0, 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_TRAP),
+	};
+	struct bpf_policy policy = {
+		.arch = 0xc000003e,
+		.default_action = SECCOMP_RET_ERRNO | 38,
+		.count = 40,
+	};
+	struct sock_fprog progs[5] = {
+		{ ARRAY_SIZE(branchy), branchy },
+		{ ARRAY_SIZE(arith), arith },
+		{ ARRAY_SIZE(thunk), thunk },
+	};
+	const size_t count = 4096;
+	struct seccomp_data *data = random_records(count);
+	unsigned int i;
+	size_t j;
+
+	ASSERT_NE(NULL, data);
+	for (j = 0; j < count; j += 3)
+		data[j].instruction_pointer = 0x1000;
+	policy.rules = random_rules(policy.count);
+	ASSERT_NE(NULL, policy.rules);
+	for (i = 0; i < policy.count; i++)
+		policy.rules[i].nr = i * 47 % 64;
+	ASSERT_EQ(0, bpf_policy_compile(&policy, BPF_POLICY_LINEAR,
+					&progs[3]));
+	ASSERT_EQ(0, bpf_policy_compile(&policy, BPF_POLICY_BSEARCH,
+					&progs[4]));
+
+	for (i = 0; i < ARRAY_SIZE(progs); i++) {
+		struct sock_fprog prog;
+
+		ASSERT_EQ(0, optimize_copy(progs[i].filter, progs[i].len,
+					   &prog, NULL));
+		EXPECT_EQ(0, bpf_check(prog.filter, prog.len, NULL)) {
+			TH_LOG("filter %u no longer checks", i);
+		}
+		EXPECT_GE(progs[i].len, prog.len);
+		for (j = 0; j < count; j++) {
+			__u32 ret = bpf_run(progs[i].filter, &data[j], NULL);
+
+			ASSERT_EQ(ret, bpf_run(prog.filter, &data[j], NULL)) {
+				TH_LOG("filter %u: record %zu differs", i, j);
+			}
+		}
+		TH_LOG("filter %u: %u -> %u instructions", i, progs[i].len,
+		       prog.len);
+		free(prog.filter);
+	}
+	free(progs[3].filter);
+	free(progs[4].filter);
+	free(policy.rules);
+	free(data);
+}
+
+/*
+ * Returns the errno the kernel gives getpid under the |count| filters of
+ * |chain|, installed in order.
+ */
+static int getpid_errno(struct __test_metadata *_metadata,
+			const struct sock_fprog *chain, unsigned int count)
+{
+	unsigned int i;
+	int status;
+	pid_t pid;
+
+	pid = fork();
+	if (pid == 0) {
+		if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0))
+			_exit(0xff);
+		for (i = 0; i < count; i++)
+			if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER,
+				  &chain[i], 0, 0))
+				_exit(0xff);
+		errno = 0;
+		_exit(syscall(__NR_getpid) == -1 ? errno : 0);
+	}
+	EXPECT_LE(0, pid);
+	EXPECT_EQ(pid, waitpid(pid, &status, 0));
+	EXPECT_TRUE(WIFEXITED(status));
+	return WEXITSTATUS(status);
+}
+
+/*
+ * The kernel takes the tree, trampolines and bitmaps and all, and agrees
+ * with it.
+ */
+TEST(policy_matches_kernel) {
+	struct bpf_policy policy = {
+		.arch = ARCH_NATIVE,
+		.default_action = SECCOMP_RET_ALLOW,
+		.count = 300,
+	};
+	struct sock_fprog prog;
+	unsigned int i;
+
+	policy.rules = random_rules(policy.count);
+	ASSERT_NE(NULL, policy.rules);
+	/* The child must still be able to exit whatever the rules drew. */
+	for (i = 0; i < policy.count; i++) {
+		if (policy.rules[i].nr == __NR_getpid)
+			break;
+		if (policy.rules[i].nr == __NR_exit_group)
+			policy.rules[i].action = SECCOMP_RET_ALLOW;
+	}
+	if (i == policy.count)
+		policy.rules[--i].nr = __NR_getpid;
+	policy.rules[i].action = SECCOMP_RET_ERRNO | 42;
+	for (; i < policy.count; i++)
+		if (policy.rules[i].nr == __NR_exit_group)
+			policy.rules[i].action = SECCOMP_RET_ALLOW;
+	ASSERT_EQ(0, bpf_policy_compile(&policy, BPF_POLICY_BSEARCH, &prog));
+	/* Long enough that the top of the tree needs a trampoline. */
+	ASSERT_LT(2 * 255, prog.len);
+	EXPECT_EQ(42, getpid_errno(_metadata, &prog, 1));
+	free(prog.filter);
+
+	/* Every third number from getpid on, well short of exit_group. */
+	for (i = 0; i < 20; i++)
+		policy.rules[i] = (struct bpf_policy_rule){
+			__NR_getpid + 3 * i, SECCOMP_RET_ERRNO | 42 };
+	policy.count = 20;
+	ASSERT_EQ(0, bpf_policy_compile(&policy, BPF_POLICY_BITMAP, &prog));
+	ASSERT_GT(40, prog.len);
+	EXPECT_EQ(42, getpid_errno(_metadata, &prog, 1));
+	free(prog.filter);
+	free(policy.rules);
+}
+
+/* Returns A, whatever the action in its top half: args[1], for nr >= 24. */
+static struct sock_filter ret_a[] = {
+	BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+		 offsetof(struct seccomp_data, nr)),
+	BPF_JUMP(BPF_JMP|BPF_JGE|BPF_K, 24, 0, 2),
+	BPF_STMT(BPF_LD|BPF_W|BPF_ABS, syscall_arg(1)),
+	BPF_STMT(BPF_RET|BPF_A, 0),
+	BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 7, 0, 1),
+	BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_KILL_PROCESS),
+	BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ERRNO | 3),
+};
+
+TEST(merge_matches_chain) {
+	struct sock_filter rets[] = {
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_KILL_PROCESS),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_KILL),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_TRAP),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ERRNO | 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ERRNO | 2),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_TRACE),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW | 1),
+	};
+	struct sock_filter getpid_trap[] = {
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			 offsetof(struct seccomp_data, nr)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 20, 0, 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_TRAP),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+	};
+	/* Kills when nr % 8 is 0, without ever returning A. */
+	struct sock_filter div_nr[] = {
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			 offsetof(struct seccomp_data, nr)),
+		BPF_STMT(BPF_ALU|BPF_AND|BPF_K, 7),
+		BPF_STMT(BPF_MISC|BPF_TAX, 0),
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS, syscall_arg(0)),
+		BPF_STMT(BPF_ALU|BPF_DIV|BPF_X, 0),
+		BPF_JUMP(BPF_JMP|BPF_JGT|BPF_K, 0x10000000, 0, 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW | 2),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ERRNO | 3),
+	};
+	struct sock_fprog pool[ARRAY_SIZE(rets) + 5];
+	const size_t count = 2048;
+	struct seccomp_data *data = random_records(count);
+	unsigned int i, n, trial;
+	__u64 seed = 1;
+
+	ASSERT_NE(NULL, data);
+	for (i = 0; i < ARRAY_SIZE(rets); i++)
+		pool[i] = (struct sock_fprog){ 1, &rets[i] };
+	pool[i++] = (struct sock_fprog){ ARRAY_SIZE(branchy), branchy };
+	pool[i++] = (struct sock_fprog){ ARRAY_SIZE(arith), arith };
+	pool[i++] = (struct sock_fprog){ ARRAY_SIZE(ret_a), ret_a };
+	pool[i++] = (struct sock_fprog){ ARRAY_SIZE(getpid_trap),
+					 getpid_trap };
+	pool[i++] = (struct sock_fprog){ ARRAY_SIZE(div_nr), div_nr };
+
+	/* Chains of up to four filters drawn from the pool. */
+	for (trial = 0; trial < 400; trial++) {
+		struct sock_fprog chain[4], merged;
+		size_t j;
+
+		n = 1 + trial % ARRAY_SIZE(chain);
+		for (i = 0; i < n; i++) {
+			seed = seed * 6364136223846793005ULL +
+			       1442695040888963407ULL;
+			chain[i] = pool[(seed >> 33) % ARRAY_SIZE(pool)];
+		}
+		ASSERT_EQ(0, bpf_chain_merge(chain, n, &merged, NULL)) {
+			TH_LOG("trial %u: %s", trial, strerror(errno));
+		}
+		EXPECT_EQ(0, bpf_check(merged.filter, merged.len, NULL));
+		for (j = 0; j < count; j++) {
+			__u32 ret = bpf_run_chain(chain, n, &data[j]);
+
+			ASSERT_EQ(ret, bpf_run(merged.filter, &data[j], NULL)) {
+				TH_LOG("trial %u: record %zu differs", trial,
+				       j);
+			}
+		}
+		free(merged.filter);
+	}
+	free(data);
+}
+
+/*
+ * Merges of filters using scratch memory still pass bpf_check(): these
+ * two once merged into a program whose BPF_JA to a return had become that
+ * return, leaving the load of the older filter's word unprovable.
+ */
+TEST(merge_stays_checkable) {
+	struct sock_filter stores[] = {
+		BPF_STMT(BPF_ST, 0),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 2, 1, 2),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ERRNO | 1),
+		BPF_STMT(BPF_LD|BPF_MEM, 0),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 3, 1, 0),
+		BPF_STMT(BPF_ST, 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+	};
+	struct sock_filter tests_a[] = {
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 3, 1, 0),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW | 3),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ERRNO | 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+	};
+	struct sock_fprog pool[] = {
+		{ ARRAY_SIZE(stores), stores },
+		{ ARRAY_SIZE(tests_a), tests_a },
+		{ ARRAY_SIZE(branchy), branchy },
+		{ ARRAY_SIZE(ret_a), ret_a },
+	};
+	const size_t count = 256;
+	struct seccomp_data *data = random_records(count);
+	struct sock_fprog chain[3], merged;
+	unsigned int i, n, pick;
+	size_t j;
+
+	ASSERT_NE(NULL, data);
+	/* Every ordering of up to three filters from the pool. */
+	for (n = 1; n <= ARRAY_SIZE(chain); n++) {
+		unsigned int total = 1;
+
+		for (i = 0; i < n; i++)
+			total *= ARRAY_SIZE(pool);
+		for (pick = 0; pick < total; pick++) {
+			unsigned int p = pick;
+
+			for (i = 0; i < n; i++, p /= ARRAY_SIZE(pool))
+				chain[i] = pool[p % ARRAY_SIZE(pool)];
+			ASSERT_EQ(0, bpf_chain_merge(chain, n, &merged, NULL));
+			EXPECT_EQ(0, bpf_check(merged.filter, merged.len,
+					       NULL)) {
+				TH_LOG("chain of %u, pick %u", n, pick);
+			}
+			for (j = 0; j < count; j++)
+				EXPECT_EQ(bpf_run_chain(chain, n, &data[j]),
+					  bpf_run(merged.filter, &data[j],
+						  NULL));
+			free(merged.filter);
+		}
+	}
+	free(data);
+}
+
+TEST(merge_shortcuts) {
+	struct sock_filter kill_process[] = {
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_KILL_PROCESS),
+	};
+	struct sock_filter all_words[2 + BPF_MEMWORDS + 1];
+	struct sock_fprog chain[] = {
+		{ ARRAY_SIZE(branchy), branchy },
+		{ ARRAY_SIZE(arith), arith },
+		{ ARRAY_SIZE(kill_process), kill_process },
+	};
+	const size_t count = 2048;
+	struct seccomp_data *data = random_records(count);
+	unsigned int i, steps, longest = 0;
+	struct bpf_opt_stats stats;
+	struct sock_fprog merged;
+
+	ASSERT_NE(NULL, data);
+
+	/* Nothing beats the newest filter's verdict. */
+	ASSERT_EQ(0, bpf_chain_merge(chain, 3, &merged, &stats));
+	EXPECT_EQ(1, merged.len);
+	EXPECT_EQ(SECCOMP_RET_KILL_PROCESS, merged.filter[0].k);
+	free(merged.filter);
+
+	/* An empty chain allows everything. */
+	ASSERT_EQ(0, bpf_chain_merge(chain, 0, &merged, NULL));
+	EXPECT_EQ(1, merged.len);
+	EXPECT_EQ(SECCOMP_RET_ALLOW, merged.filter[0].k);
+	free(merged.filter);
+
+	/*
+	 * No path is as long as what the kernel counts for the chain, four
+	 * instructions a filter on top of their lengths.
+	 */
+	ASSERT_EQ(0, bpf_chain_merge(chain, 2, &merged, &stats));
+	EXPECT_LT(merged.len, stats.before);
+	for (i = 0; i < count; i++) {
+		bpf_run(merged.filter, &data[i], &steps);
+		if (steps > longest)
+			longest = steps;
+	}
+	EXPECT_GT(ARRAY_SIZE(branchy) + ARRAY_SIZE(arith) + 2 * 4, longest);
+	free(merged.filter);
+	free(data);
+
+	/* A verdict from A needs a scratch word nobody else uses. */
+	all_words[0] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+		offsetof(struct seccomp_data, nr));
+	for (i = 0; i < BPF_MEMWORDS; i++)
+		all_words[1 + i] = (struct sock_filter)BPF_STMT(BPF_ST, i);
+	all_words[1 + i++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_MEM, 7);
+	all_words[1 + i] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_A, 0);
+	chain[1] = (struct sock_fprog){ ARRAY_SIZE(all_words), all_words };
+	EXPECT_EQ(0, bpf_chain_merge(chain + 1, 1, &merged, NULL));
+	free(merged.filter);
+	EXPECT_EQ(-1, bpf_chain_merge(chain, 2, &merged, NULL));
+	EXPECT_EQ(ENOSPC, errno);
+}
+
+/* Stacked or merged, the kernel picks the same errno. */
+TEST(merge_matches_kernel) {
+	struct sock_filter errno7[] = {
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			 offsetof(struct seccomp_data, nr)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, __NR_getpid, 0, 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ERRNO | 7),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+	};
+	struct sock_filter trace[] = {
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			 offsetof(struct seccomp_data, nr)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, __NR_getpid, 0, 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_TRACE),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+	};
+	struct sock_filter errno9[] = {
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			 offsetof(struct seccomp_data, arch)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ARCH_NATIVE, 1, 0),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_KILL),
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			 offsetof(struct seccomp_data, nr)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, __NR_getpid, 0, 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ERRNO | 9),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+	};
+	struct sock_fprog chain[] = {
+		{ ARRAY_SIZE(errno7), errno7 },
+		{ ARRAY_SIZE(trace), trace },
+		{ ARRAY_SIZE(errno9), errno9 },
+	};
+	struct sock_fprog merged;
+
+	ASSERT_EQ(0, bpf_chain_merge(chain, ARRAY_SIZE(chain), &merged,
+				     NULL));
+	/* The newest of the two ERRNOs wins. */
+	EXPECT_EQ(9, getpid_errno(_metadata, chain, ARRAY_SIZE(chain)));
+	EXPECT_EQ(9, getpid_errno(_metadata, &merged, 1));
+	free(merged.filter);
+
+	/* ERRNO beats the newer TRACE. */
+	ASSERT_EQ(0, bpf_chain_merge(chain, 2, &merged, NULL));
+	EXPECT_EQ(7, getpid_errno(_metadata, chain, 2));
+	EXPECT_EQ(7, getpid_errno(_metadata, &merged, 1));
+	free(merged.filter);
+}
+
+/*
+ * Filters are proved equal to what bpf_optimize() and bpf_chain_merge()
+ * make of them, and the policy layouts to each other.
+ */
+TEST(equiv_proves_rewrites) {
+	struct bpf_policy policy = {
+		.arch = 0xc000003e,
+		.default_action = SECCOMP_RET_ERRNO | 38,
+		.count = 120,
+	};
+	struct sock_fprog progs[5] = {
+		{ ARRAY_SIZE(branchy), branchy },
+		{ ARRAY_SIZE(ret_a), ret_a },
+	};
+	struct sock_fprog chain[] = {
+		{ ARRAY_SIZE(branchy), branchy },
+		{ ARRAY_SIZE(ret_a), ret_a },
+		{ ARRAY_SIZE(branchy), branchy },
+	};
+	/* X is 0 wherever the division is reached. */
+	struct sock_filter zero_div[] = {
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS, syscall_arg(0)),
+		BPF_JUMP(BPF_JMP|BPF_JSET|BPF_K, 1, 3, 0),
+		BPF_STMT(BPF_ALU|BPF_AND|BPF_K, 1),
+		BPF_STMT(BPF_MISC|BPF_TAX, 0),
+		BPF_STMT(BPF_ALU|BPF_DIV|BPF_X, 0),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+	};
+	struct sock_fprog zero = { ARRAY_SIZE(zero_div), zero_div };
+	struct bpf_equiv_stats stats;
+	struct seccomp_data counter;
+	struct sock_fprog prog;
+	unsigned int i;
+
+	policy.rules = random_rules(policy.count);
+	ASSERT_NE(NULL, policy.rules);
+	ASSERT_EQ(0, bpf_policy_compile(&policy, BPF_POLICY_LINEAR,
+					&progs[2]));
+	ASSERT_EQ(0, bpf_policy_compile(&policy, BPF_POLICY_BSEARCH,
+					&progs[3]));
+	ASSERT_EQ(0, bpf_policy_compile(&policy, BPF_POLICY_BITMAP,
+					&progs[4]));
+
+	for (i = 0; i < ARRAY_SIZE(progs); i++) {
+		ASSERT_EQ(0, optimize_copy(progs[i].filter, progs[i].len,
+					   &prog, NULL));
+		EXPECT_EQ(BPF_EQUIV_SAME, bpf_equiv(&progs[i], 1, &prog, 1,
+						    &counter, &stats)) {
+			TH_LOG("filter %u", i);
+		}
+		EXPECT_EQ(0, stats.undecided);
+		free(prog.filter);
+	}
+	for (i = 3; i < ARRAY_SIZE(progs); i++) {
+		EXPECT_EQ(BPF_EQUIV_SAME, bpf_equiv(&progs[2], 1, &progs[i], 1,
+						    &counter, &stats)) {
+			TH_LOG("layout %u", i);
+		}
+		EXPECT_EQ(0, stats.undecided);
+	}
+
+	for (i = 1; i <= ARRAY_SIZE(chain); i++) {
+		ASSERT_EQ(0, bpf_chain_merge(chain, i, &prog, NULL));
+		EXPECT_EQ(BPF_EQUIV_SAME, bpf_equiv(chain, i, &prog, 1,
+						    &counter, &stats)) {
+			TH_LOG("chain of %u", i);
+		}
+		EXPECT_EQ(0, stats.undecided);
+		free(prog.filter);
+	}
+
+	EXPECT_EQ(BPF_EQUIV_SAME, bpf_equiv(&zero, 1, &zero, 1, &counter,
+					    &stats));
+
+	for (i = 2; i < ARRAY_SIZE(progs); i++)
+		free(progs[i].filter);
+	free(policy.rules);
+}
+
+/* A difference, however narrow, comes with data showing it. */
+TEST(equiv_finds_differences) {
+	struct sock_filter masked[] = {
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			 offsetof(struct seccomp_data, nr)),
+		BPF_JUMP(BPF_JMP|BPF_JGE|BPF_K, 24, 0, 4),
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS, syscall_arg(2)),
+		BPF_STMT(BPF_ALU|BPF_AND|BPF_K, 0xff),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 3, 0, 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ERRNO | 3),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+	};
+	struct sock_filter changed[ARRAY_SIZE(masked)];
+	struct sock_fprog a = { ARRAY_SIZE(masked), masked };
+	struct sock_fprog b = { ARRAY_SIZE(changed), changed };
+	struct bpf_policy policy = {
+		.arch = 0xc000003e,
+		.default_action = SECCOMP_RET_ERRNO | 38,
+		.count = 120,
+	};
+	struct sock_filter wide[3 * 24 + 1];
+	struct sock_fprog c = { ARRAY_SIZE(wide), wide };
+	struct sock_fprog linear, bitmap;
+	struct seccomp_data counter;
+	unsigned int i;
+
+	/* Off by one on nr. */
+	memcpy(changed, masked, sizeof(masked));
+	changed[1].code = BPF_JMP|BPF_JGT|BPF_K;
+	ASSERT_EQ(BPF_EQUIV_DIFFERENT, bpf_equiv(&a, 1, &b, 1, &counter,
+						 NULL));
+	EXPECT_EQ(24, counter.nr);
+	EXPECT_NE(bpf_run(masked, &counter, NULL),
+		  bpf_run(changed, &counter, NULL));
+
+	/* The whole word for its low byte. */
+	memcpy(changed, masked, sizeof(masked));
+	changed[3].k = 0xffffffff;
+	ASSERT_EQ(BPF_EQUIV_DIFFERENT, bpf_equiv(&a, 1, &b, 1, &counter,
+						 NULL));
+	EXPECT_EQ(3, counter.args[2] & 0xff);
+	EXPECT_NE(3, counter.args[2] & 0xffffffff);
+
+	/* One action changed among a hundred rules, found in the bitmaps. */
+	policy.rules = random_rules(policy.count);
+	ASSERT_NE(NULL, policy.rules);
+	ASSERT_EQ(0, bpf_policy_compile(&policy, BPF_POLICY_LINEAR, &linear));
+	policy.rules[77].action ^= 1;
+	ASSERT_EQ(0, bpf_policy_compile(&policy, BPF_POLICY_BITMAP, &bitmap));
+	ASSERT_EQ(BPF_EQUIV_DIFFERENT, bpf_equiv(&linear, 1, &bitmap, 1,
+						 &counter, NULL));
+	EXPECT_EQ(policy.rules[77].nr, counter.nr);
+	EXPECT_EQ(policy.arch, counter.arch);
+	free(bitmap.filter);
+	free(linear.filter);
+	free(policy.rules);
+
+	/* Too many paths to follow: given up on, not run out of memory. */
+	for (i = 0; i + 1 < ARRAY_SIZE(wide); i += 3) {
+		struct sock_filter test[] = {
+			BPF_STMT(BPF_LD|BPF_W|BPF_ABS, syscall_arg(i % 6)),
+			BPF_JUMP(BPF_JMP|BPF_JSET|BPF_K, 1 << i / 3, 1, 0),
+			BPF_STMT(BPF_ALU|BPF_ADD|BPF_K, 0),
+		};
+
+		memcpy(&wide[i], test, sizeof(test));
+	}
+	wide[i].code = BPF_RET|BPF_K;
+	wide[i].k = SECCOMP_RET_ALLOW;
+	EXPECT_EQ(BPF_EQUIV_UNKNOWN, bpf_equiv(&c, 1, &c, 1, &counter,
+					       NULL));
+
+	/* Filters which fail bpf_check() are refused. */
+	changed[0].code = BPF_LD|BPF_MEM;
+	EXPECT_EQ(-1, bpf_equiv(&a, 1, &b, 1, &counter, NULL));
+	EXPECT_EQ(EINVAL, errno);
+}
+
+/* The range of |cost| holding |nr|, checking they cover every number. */
+static const struct bpf_cost_range *cost_of(struct __test_metadata *_metadata,
+					    const struct bpf_cost *cost,
+					    __u32 nr)
+{
+	unsigned int i;
+
+	EXPECT_EQ(0, cost->ranges[0].lo);
+	EXPECT_EQ(0xffffffff, cost->ranges[cost->count - 1].hi);
+	for (i = 0; i < cost->count; i++) {
+		if (i)
+			EXPECT_EQ(cost->ranges[i - 1].hi + 1,
+				  cost->ranges[i].lo);
+		if (cost->ranges[i].lo <= nr && nr <= cost->ranges[i].hi)
+			return &cost->ranges[i];
+	}
+	return NULL;
+}
+
+/*
+ * Policies only test nr and arch, so with arch given, every number runs
+ * exactly the instructions its range says, bitmap leaves included.
+ */
+TEST(cost_of_policies) {
+	static const enum bpf_policy_layout layouts[] = {
+		BPF_POLICY_LINEAR, BPF_POLICY_BSEARCH, BPF_POLICY_BITMAP,
+	};
+	struct bpf_policy policy = {
+		.arch = 0xc000003e,
+		.default_action = SECCOMP_RET_ERRNO | 38,
+		.count = 300,
+	};
+	struct seccomp_data data = make_data(0, 0, 0);
+	const struct bpf_cost_range *r;
+	struct bpf_cost cost;
+	struct sock_fprog prog;
+	unsigned int i, steps, worst;
+	__u32 nr;
+
+	policy.rules = random_rules(policy.count);
+	ASSERT_NE(NULL, policy.rules);
+	data.arch = policy.arch;
+
+	for (i = 0; i < ARRAY_SIZE(layouts); i++) {
+		ASSERT_EQ(0, bpf_policy_compile(&policy, layouts[i], &prog));
+		ASSERT_EQ(0, bpf_cost_chain(&prog, 1, &policy.arch, &cost));
+		EXPECT_EQ(prog.len, cost.classic);
+		EXPECT_EQ(bpf_converted_len(prog.filter, prog.len),
+			  cost.insns);
+		EXPECT_LT(prog.len, cost.insns);
+		worst = 0;
+		for (nr = 0; nr < 1100; nr++) {
+			data.nr = nr;
+			bpf_run(prog.filter, &data, &steps);
+			r = cost_of(_metadata, &cost, nr);
+			ASSERT_NE(NULL, r);
+			EXPECT_EQ(steps, r->min) {
+				TH_LOG("layout %u, syscall %u", i, nr);
+			}
+			EXPECT_EQ(steps, r->max);
+			if (steps > worst)
+				worst = steps;
+		}
+		EXPECT_EQ(worst, cost.worst);
+		free(cost.ranges);
+
+		/* Any other arch is killed straight away. */
+		ASSERT_EQ(0, bpf_cost_chain(&prog, 1, NULL, &cost));
+		for (nr = 0; nr < cost.count; nr++)
+			EXPECT_EQ(3, cost.ranges[nr].min);
+		EXPECT_EQ(worst, cost.worst);
+		free(cost.ranges);
+		free(prog.filter);
+	}
+	free(policy.rules);
+}
+
+/*
+ * Filters which test their arguments run somewhere between min and max,
+ * and chains the sum of their filters.
+ */
+TEST(cost_bounds_runs) {
+	struct sock_fprog chain[] = {
+		{ ARRAY_SIZE(branchy), branchy },
+		{ ARRAY_SIZE(arith), arith },
+		{ ARRAY_SIZE(ret_a), ret_a },
+	};
+	/* An argument divided by nr - 3, for nr up to 7. */
+	struct sock_filter div_nr[] = {
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			 offsetof(struct seccomp_data, nr)),
+		BPF_JUMP(BPF_JMP|BPF_JGT|BPF_K, 7, 5, 0),
+		BPF_STMT(BPF_ALU|BPF_SUB|BPF_K, 3),
+		BPF_STMT(BPF_MISC|BPF_TAX, 0),
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS, syscall_arg(0)),
+		BPF_STMT(BPF_ALU|BPF_DIV|BPF_X, 0),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ERRNO | 1),
+	};
+	struct sock_fprog div = { ARRAY_SIZE(div_nr), div_nr };
+	const size_t count = 2048;
+	struct seccomp_data *data = random_records(count);
+	const struct bpf_cost_range *r;
+	struct bpf_cost cost;
+	unsigned int i, steps, total, worst = 0, insns = 0;
+	size_t j;
+
+	ASSERT_NE(NULL, data);
+	for (i = 0; i <= ARRAY_SIZE(chain); i++) {
+		ASSERT_EQ(0, bpf_cost_chain(chain, i, NULL, &cost));
+		for (j = 0; j < count; j++) {
+			unsigned int f;
+
+			total = 0;
+			for (f = 0; f < i; f++) {
+				bpf_run(chain[f].filter, &data[j], &steps);
+				total += steps;
+			}
+			r = cost_of(_metadata, &cost, data[j].nr);
+			ASSERT_NE(NULL, r);
+			EXPECT_LE(r->min, total) {
+				TH_LOG("chain of %u, record %zu", i, j);
+			}
+			EXPECT_GE(r->max, total);
+			if (total > worst)
+				worst = total;
+		}
+		EXPECT_GE(cost.worst, worst);
+		EXPECT_EQ(insns, cost.insns);
+		free(cost.ranges);
+		if (i < ARRAY_SIZE(chain))
+			insns += bpf_converted_len(chain[i].filter,
+						   chain[i].len) +
+				 (i ? BPF_FILTER_PENALTY : 0);
+	}
+
+	/*
+	 * branchy kills other arches in 3; nr 24 to 36 then return after 9
+	 * without looking at an argument, and those below 24 after 10.
+	 */
+	ASSERT_EQ(0, bpf_cost_chain(chain, 1, NULL, &cost));
+	EXPECT_EQ(3, cost_of(_metadata, &cost, 30)->min);
+	EXPECT_EQ(9, cost_of(_metadata, &cost, 30)->max);
+	EXPECT_EQ(10, cost_of(_metadata, &cost, 5)->max);
+	EXPECT_EQ(10, cost.worst);
+	free(cost.ranges);
+
+	/* Dividing by a zero X stops short, for the one nr it is zero for. */
+	ASSERT_EQ(0, bpf_cost_chain(&div, 1, NULL, &cost));
+	for (i = 0; i < 10; i++) {
+		data[0].nr = i;
+		bpf_run(div_nr, &data[0], &steps);
+		r = cost_of(_metadata, &cost, i);
+		ASSERT_NE(NULL, r);
+		EXPECT_EQ(steps, r->min) {
+			TH_LOG("syscall %u", i);
+		}
+		EXPECT_EQ(steps, r->max);
+	}
+	EXPECT_EQ(6, cost_of(_metadata, &cost, 3)->max);
+	free(cost.ranges);
+
+	/* Filters which fail bpf_check() are refused. */
+	chain[1].len--;
+	EXPECT_EQ(-1, bpf_cost_chain(chain, 2, NULL, &cost));
+	EXPECT_EQ(EINVAL, errno);
+	free(data);
+}
+
+/*
+ * The kernel counts filters converted to eBPF against MAX_INSNS_PER_PATH,
+ * so a stack of them is refused exactly where bpf_cost_chain() says.
+ */
+TEST(cost_matches_kernel_limit) {
+	struct sock_filter plain[] = {
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			 offsetof(struct seccomp_data, nr)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, __NR_getpid, 0, 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ERRNO | 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+	};
+	/* Negative immediates, and tests which can't fall through. */
+	struct sock_filter wide[] = {
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS, syscall_arg(0)),
+		BPF_JUMP(BPF_JMP|BPF_JGE|BPF_K, 0xfffffff0, 1, 2),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ERRNO | 3),
+		BPF_JUMP(BPF_JMP|BPF_JSET|BPF_K, 0x80000000, 0, 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+	};
+	const unsigned int max = 4096;
+	struct sock_fprog *chain = calloc(max, sizeof(*chain));
+	struct bpf_cost cost;
+	unsigned int n, insns = 0, installed = 0;
+	int fds[2], status;
+	pid_t pid;
+
+	ASSERT_NE(NULL, chain);
+	EXPECT_EQ(9, bpf_converted_len(plain, ARRAY_SIZE(plain)));
+	EXPECT_EQ(18, bpf_converted_len(wide, ARRAY_SIZE(wide)));
+	for (n = 0; n < max; n++) {
+		if (n % 2) {
+			chain[n].len = ARRAY_SIZE(wide);
+			chain[n].filter = wide;
+		} else {
+			chain[n].len = ARRAY_SIZE(plain);
+			chain[n].filter = plain;
+		}
+	}
+	/* The most which fit: the newest is not charged the penalty. */
+	for (n = 0; n < max; n++) {
+		unsigned int len = bpf_converted_len(chain[n].filter,
+						     chain[n].len);
+
+		if (insns + len > BPF_MAX_INSNS_PER_PATH)
+			break;
+		insns += len + BPF_FILTER_PENALTY;
+	}
+	ASSERT_GT(max, n);
+	ASSERT_EQ(0, bpf_cost_chain(chain, n, NULL, &cost));
+	EXPECT_GE(BPF_MAX_INSNS_PER_PATH, cost.insns);
+	free(cost.ranges);
+	ASSERT_EQ(0, bpf_cost_chain(chain, n + 1, NULL, &cost));
+	EXPECT_LT(BPF_MAX_INSNS_PER_PATH, cost.insns);
+	EXPECT_GT(BPF_MAX_INSNS_PER_PATH, cost.classic);
+	free(cost.ranges);
+
+	ASSERT_EQ(0, pipe(fds));
+	pid = fork();
+	if (pid == 0) {
+		close(fds[0]);
+		if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0))
+			_exit(1);
+		while (installed < max &&
+		       !prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER,
+			      &chain[installed], 0, 0))
+			installed++;
+		_exit(write(fds[1], &installed, sizeof(installed)) !=
+		      sizeof(installed));
+	}
+	ASSERT_LE(0, pid);
+	close(fds[1]);
+	EXPECT_EQ(sizeof(installed), read(fds[0], &installed,
+					  sizeof(installed)));
+	close(fds[0]);
+	EXPECT_EQ(pid, waitpid(pid, &status, 0));
+	EXPECT_EQ(n, installed);
+	free(chain);
+}
+
+BENCHMARK(interp_eval) {
+	struct sock_filter filter[] = {
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			offsetof(struct seccomp_data, nr)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, __NR_getpid, 0, 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_TRAP),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+	};
+	struct seccomp_data data = make_data(__NR_getpid, 0, 0);
+	volatile __u32 ret;
+
+	BENCHMARK_LOOP("interp trap filter") {
+		ret = bpf_run(filter, &data, NULL);
+	}
+	(void)ret;
+	BENCHMARK_REPORT(1e9 / BENCHMARK_LAST()->median, "evals/s",
+			 "interp trap filter rate");
+}
+
+BENCHMARK(jit_eval) {
+	const size_t count = 4096;
+	struct seccomp_data *data = random_records(count);
+	struct bpf_jit jit;
+	volatile __u32 ret;
+	size_t i;
+
+	ASSERT_NE(NULL, data);
+	ASSERT_EQ(0, bpf_jit_compile(branchy, ARRAY_SIZE(branchy), &jit));
+	BENCHMARK_LOOP("interp branchy filter, %zu records", count) {
+		for (i = 0; i < count; i++)
+			ret = bpf_run(branchy, &data[i], NULL);
+	}
+	BENCHMARK_REPORT(count * 1e9 / BENCHMARK_LAST()->median, "evals/s",
+			 "interp branchy filter rate");
+	BENCHMARK_LOOP("jit branchy filter, %zu records", count) {
+		for (i = 0; i < count; i++)
+			ret = jit.func(&data[i]);
+	}
+	BENCHMARK_REPORT(count * 1e9 / BENCHMARK_LAST()->median, "evals/s",
+			 "jit branchy filter rate");
+	(void)ret;
+	bpf_jit_free(&jit);
+	free(data);
+}
+
+BENCHMARK(batch_eval) {
+	struct sock_filter filter[] = {
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			offsetof(struct seccomp_data, nr)),
+		BPF_JUMP(BPF_JMP|BPF_JGE|BPF_K, 24, 0, 4),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 30, 0, 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_TRAP),
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS, syscall_arg(0)),
+		BPF_JUMP(BPF_JMP|BPF_JSET|BPF_K, 1, 1, 0),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ERRNO | 1),
+	};
+	const size_t count = 4096;
+	struct seccomp_data *data = random_records(count);
+	__u32 *ret = calloc(count, sizeof(*ret));
+	enum bpf_batch_isa isa;
+
+	ASSERT_NE(NULL, data);
+	ASSERT_NE(NULL, ret);
+	for (isa = 0; isa < BPF_BATCH_ISAS; isa++) {
+		if (!bpf_batch_isa_supported(isa))
+			continue;
+		BENCHMARK_LOOP("batch %s, %zu records",
+			       bpf_batch_isa_name(isa), count) {
+			bpf_run_batch(filter, data, count, ret, NULL, isa);
+		}
+		BENCHMARK_REPORT(count * 1e9 / BENCHMARK_LAST()->median,
+				 "evals/s", "batch %s rate",
+				 bpf_batch_isa_name(isa));
+	}
+	free(ret);
+	free(data);
+}
+
+TEST_HARNESS_MAIN
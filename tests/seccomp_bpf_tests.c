@@ -6,6 +6,7 @@
  * Test code for seccomp bpf.
  */
 
+#define _GNU_SOURCE
 #include <asm/siginfo.h>
 #define __have_siginfo_t 1
 #define __have_sigval_t 1
@@ -21,6 +22,7 @@
 #include <linux/seccomp.h>
 #include <poll.h>
 #include <pthread.h>
+#include <sched.h>
 #include <semaphore.h>
 #include <signal.h>
 #include <stddef.h>
@@ -28,12 +30,13 @@
 #include <string.h>
 #include <syscall.h>
 #include <linux/elf.h>
+#include <sys/mman.h>
 #include <sys/uio.h>
 
-#define _GNU_SOURCE
 #include <unistd.h>
 #include <sys/syscall.h>
 
+#include "bpf_trace.h"
 #include "test_harness.h"
 
 #ifndef PR_SET_PTRACER
@@ -1246,6 +1249,96 @@ TEST_F(TRACE_syscall, syscall_dropped) {
 	EXPECT_NE(self->mytid, syscall(__NR_gettid));
 }
 
+/* "record" tracer arguments and function. */
+struct tracer_args_record_t {
+	int fd;
+};
+
+void tracer_record(struct __test_metadata *_metadata, pid_t tracee,
+		   int status, void *args) {
+	struct tracer_args_record_t *info = (struct tracer_args_record_t *)args;
+	struct ptrace_syscall_info sys;
+	struct seccomp_data data;
+	long ret;
+
+	/* The seccomp stop carries what the filter saw. */
+	ret = ptrace(PTRACE_GET_SYSCALL_INFO, tracee, sizeof(sys), &sys);
+	ASSERT_LT(0, ret) {
+		TH_LOG("PTRACE_GET_SYSCALL_INFO failed");
+		kill(tracee, SIGKILL);
+	}
+	ASSERT_EQ(PTRACE_SYSCALL_INFO_SECCOMP, sys.op) {
+		kill(tracee, SIGKILL);
+	}
+
+	memset(&data, 0, sizeof(data));
+	data.nr = sys.seccomp.nr;
+	data.arch = sys.arch;
+	data.instruction_pointer = sys.instruction_pointer;
+	memcpy(data.args, sys.seccomp.args, sizeof(data.args));
+	EXPECT_EQ(0, bpf_trace_append(info->fd, &data));
+}
+
+TEST(TRACE_record) {
+	struct sock_filter filter[] = {
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			offsetof(struct seccomp_data, nr)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, __NR_getppid, 0, 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_TRACE),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+	};
+	struct sock_fprog prog = {
+		.len = (unsigned short)(sizeof(filter)/sizeof(filter[0])),
+		.filter = filter,
+	};
+	struct tracer_args_record_t args;
+	struct bpf_replay_stats *stats;
+	struct bpf_trace trace;
+	char path[] = "/tmp/seccomp_trace.XXXXXX";
+	pid_t tracer, parent = getppid();
+	long ret;
+	int i;
+
+	ASSERT_LE(0, ret = mkstemp(path));
+	close(ret);
+	args.fd = bpf_trace_create(path);
+	ASSERT_LE(0, args.fd);
+	tracer = setup_trace_fixture(_metadata, tracer_record, &args);
+	close(args.fd);
+
+	ret = prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0);
+	ASSERT_EQ(0, ret);
+
+	ret = prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog, 0, 0);
+	ASSERT_EQ(0, ret);
+
+	for (i = 0; i < 3; i++)
+		EXPECT_EQ(parent, syscall(__NR_getppid, i, 0x1234, 0, 0, 0,
+					  0x5678));
+	teardown_trace_fixture(_metadata, tracer);
+
+	ASSERT_EQ(0, bpf_trace_open(path, &trace));
+	unlink(path);
+	ASSERT_EQ(3, trace.count);
+	for (i = 0; i < 3; i++) {
+		EXPECT_EQ(__NR_getppid, trace.records[i].nr);
+		EXPECT_NE(0, trace.records[i].arch);
+		EXPECT_EQ(i, trace.records[i].args[0]);
+		EXPECT_EQ(0x1234, trace.records[i].args[1]);
+		EXPECT_EQ(0x5678, trace.records[i].args[5]);
+	}
+
+	/* Replaying through the same filter traces every record again. */
+	stats = malloc(sizeof(*stats));
+	ASSERT_NE(NULL, stats);
+	ASSERT_EQ(0, bpf_replay(&prog, &trace, NULL, 1, stats));
+	EXPECT_EQ(3, stats->actions[BPF_ACTION_TRACE]);
+	EXPECT_EQ(3, stats->syscalls[__NR_getppid].min_steps);
+	EXPECT_EQ(9, stats->steps);
+	free(stats);
+	bpf_trace_close(&trace);
+}
+
 #ifndef __NR_seccomp
 # if defined(__i386__)
 #  define __NR_seccomp 354
@@ -1377,6 +1470,7 @@ TEST(TSYNC_first) {
 	}
 }
 
+/* Default number of siblings; see tsync_init_siblings(). */
 #define TSYNC_SIBLINGS 2
 struct tsync_sibling {
 	pthread_t tid;
@@ -1392,13 +1486,36 @@ struct tsync_sibling {
 
 FIXTURE_DATA(TSYNC) {
 	struct sock_fprog root_prog, apply_prog;
-	struct tsync_sibling sibling[TSYNC_SIBLINGS];
+	struct tsync_sibling *sibling;
+	int sibling_max;
 	sem_t started;
 	pthread_cond_t cond;
 	pthread_mutex_t mutex;
 	int sibling_count;
 };
 
+/* Sets up |count| not yet started siblings sharing the fixture's locks. */
+void tsync_init_siblings(struct __test_metadata *_metadata,
+			 FIXTURE_DATA(TSYNC) *self, int count)
+{
+	int sib;
+
+	free(self->sibling);
+	self->sibling = calloc(count, sizeof(*self->sibling));
+	ASSERT_NE(NULL, self->sibling);
+	self->sibling_max = count;
+	for (sib = 0; sib < count; ++sib) {
+		self->sibling[sib].tid = 0;
+		self->sibling[sib].cond = &self->cond;
+		self->sibling[sib].started = &self->started;
+		self->sibling[sib].mutex = &self->mutex;
+		self->sibling[sib].diverge = 0;
+		self->sibling[sib].num_waits = 1;
+		self->sibling[sib].prog = &self->root_prog;
+		self->sibling[sib].metadata = _metadata;
+	}
+}
+
 FIXTURE_SETUP(TSYNC) {
 	struct sock_filter root_filter[] = {
 		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
@@ -1412,7 +1529,6 @@ FIXTURE_SETUP(TSYNC) {
 	};
 	memset(&self->root_prog, 0, sizeof(self->root_prog));
 	memset(&self->apply_prog, 0, sizeof(self->apply_prog));
-	memset(&self->sibling, 0, sizeof(self->sibling));
 	self->root_prog.filter = malloc(sizeof(root_filter));
 	ASSERT_NE(NULL, self->root_prog.filter);
 	memcpy(self->root_prog.filter, &root_filter, sizeof(root_filter));
@@ -1423,26 +1539,13 @@ FIXTURE_SETUP(TSYNC) {
 	memcpy(self->apply_prog.filter, &apply_filter, sizeof(apply_filter));
 	self->apply_prog.len = (unsigned short)(sizeof(apply_filter)/sizeof(apply_filter[0]));
 
+	self->sibling = NULL;
+	self->sibling_max = 0;
 	self->sibling_count = 0;
 	pthread_mutex_init(&self->mutex, NULL);
 	pthread_cond_init(&self->cond, NULL);
 	sem_init(&self->started, 0, 0);
-	self->sibling[0].tid = 0;
-	self->sibling[0].cond = &self->cond;
-	self->sibling[0].started = &self->started;
-	self->sibling[0].mutex = &self->mutex;
-	self->sibling[0].diverge = 0;
-	self->sibling[0].num_waits = 1;
-	self->sibling[0].prog = &self->root_prog;
-	self->sibling[0].metadata = _metadata;
-	self->sibling[1].tid = 0;
-	self->sibling[1].cond = &self->cond;
-	self->sibling[1].started = &self->started;
-	self->sibling[1].mutex = &self->mutex;
-	self->sibling[1].diverge = 0;
-	self->sibling[1].prog = &self->root_prog;
-	self->sibling[1].num_waits = 1;
-	self->sibling[1].metadata = _metadata;
+	tsync_init_siblings(_metadata, self, TSYNC_SIBLINGS);
 }
 
 FIXTURE_TEARDOWN(TSYNC) {
@@ -1462,6 +1565,7 @@ FIXTURE_TEARDOWN(TSYNC) {
 			pthread_join(s->tid, &status);
 		}
 	}
+	free(self->sibling);
 	pthread_mutex_destroy(&self->mutex);
 	pthread_cond_destroy(&self->cond);
 	sem_destroy(&self->started);
@@ -1930,9 +2034,1291 @@ TEST(syscall_restart) {
 		_metadata->passed = 0;
 }
 
+/*
+ * Benchmarks.  These only run with --bench.
+ */
+
+/*
+ * Times getpid() and gettid() under a growing stack of copies of |prog|.
+ * The depth doubles each round until the kernel refuses another filter
+ * (MAX_INSNS_PER_PATH, as probed by filter_chain_limits), and the deepest
+ * chain is measured too.
+ */
+static void filter_depth_series(struct __test_metadata *_metadata,
+				struct sock_fprog *prog)
+{
+	unsigned int depth = 0, measured, next = 1;
+	double base = 0;
+	int full = 0;
+	long ret;
+
+	ret = prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0);
+	ASSERT_EQ(0, ret);
+
+	for (;;) {
+		/* A zero arg keeps arg-inspecting filters deterministic. */
+		BENCHMARK_LOOP("getpid depth=%u", depth) {
+			syscall(__NR_getpid, 0);
+		}
+		if (depth == 0)
+			base = BENCHMARK_LAST()->median;
+		else
+			BENCHMARK_REPORT((BENCHMARK_LAST()->median - base) / depth,
+					 "ns/filter", "getpid cost/filter depth=%u",
+					 depth);
+		BENCHMARK_LOOP("gettid depth=%u", depth) {
+			syscall(__NR_gettid, 0);
+		}
+		measured = depth;
+		if (full)
+			break;
+		while (depth < next) {
+			ret = prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER,
+				    prog, 0, 0);
+			if (ret) {
+				EXPECT_EQ(ENOMEM, errno);
+				full = 1;
+				break;
+			}
+			depth++;
+		}
+		if (full && depth == measured)
+			break;
+		next *= 2;
+	}
+	TH_LOG("Stopped at %u %u-insn filters (%u insns with penalties)",
+	       depth, prog->len, depth * (prog->len + 4));
+}
+
+/*
+ * Pure per-filter dispatch overhead.  Note that kernels with the seccomp
+ * action cache skip filters whose verdict depends only on nr and arch, so
+ * this and filter_depth_one_check may show no per-filter cost at all there.
+ */
+BENCHMARK(filter_depth_allow) {
+	struct sock_filter filter[] = {
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+	};
+	struct sock_fprog prog = {
+		.len = (unsigned short)(sizeof(filter)/sizeof(filter[0])),
+		.filter = filter,
+	};
+
+	filter_depth_series(_metadata, &prog);
+}
+
+/* A typical single-syscall denial per layer. */
+BENCHMARK(filter_depth_one_check) {
+	struct sock_filter filter[] = {
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			offsetof(struct seccomp_data, nr)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, __NR_ptrace, 0, 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_KILL),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+	};
+	struct sock_fprog prog = {
+		.len = (unsigned short)(sizeof(filter)/sizeof(filter[0])),
+		.filter = filter,
+	};
+
+	filter_depth_series(_metadata, &prog);
+}
+
+/* Inspects an argument, so every layer really runs on every syscall. */
+BENCHMARK(filter_depth_arg_check) {
+	struct sock_filter filter[] = {
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS, syscall_arg(0)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0x0C0FFEE, 0, 1),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ERRNO | EPERM),
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW),
+	};
+	struct sock_fprog prog = {
+		.len = (unsigned short)(sizeof(filter)/sizeof(filter[0])),
+		.filter = filter,
+	};
+
+	filter_depth_series(_metadata, &prog);
+}
+
+/* Runs |fn| in a child so it may install filters without affecting us. */
+static void bench_in_child(struct __test_metadata *_metadata,
+			   void (*fn)(struct __test_metadata *, void *),
+			   void *arg)
+{
+	pid_t child_pid;
+	int status;
+
+	child_pid = fork();
+	ASSERT_LE(0, child_pid);
+	if (child_pid == 0) {
+		fn(_metadata, arg);
+		/* Report our results, taking any helper threads with us. */
+		_exit(_metadata->passed ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	ASSERT_EQ(child_pid, waitpid(child_pid, &status, 0));
+	if (WIFSIGNALED(status) || WEXITSTATUS(status))
+		_metadata->passed = 0;
+}
+
+/* Minimal program builder for generated benchmark filters. */
+struct bench_filter {
+	struct sock_filter insns[BPF_MAXINSNS];
+	unsigned int len;	/* may exceed BPF_MAXINSNS if it didn't fit */
+};
+
+static void bench_emit(struct bench_filter *f, __u16 code, __u32 k,
+		       __u8 jt, __u8 jf)
+{
+	if (f->len < BPF_MAXINSNS) {
+		struct sock_filter insn = BPF_JUMP(code, k, jt, jf);
+		f->insns[f->len] = insn;
+	}
+	f->len++;
+}
+
+struct bench_range {
+	__u32 lo, hi;
+};
+
+/*
+ * Emits a test of A against |n| (<= 254) sorted ranges, ending in a "miss"
+ * return and a "hit" return.  Singleton ranges take one JEQ each.  If
+ * |chain| is set, a miss falls through to whatever is emitted next instead.
+ */
+static void bench_emit_leaf(struct bench_filter *f,
+			    const struct bench_range *r, unsigned int n,
+			    int chain)
+{
+	unsigned int i;
+
+	if (n == 1 && r->lo != r->hi) {
+		bench_emit(f, BPF_JMP|BPF_JGE|BPF_K, r->lo, 0, 1);
+		bench_emit(f, BPF_JMP|BPF_JGT|BPF_K, r->hi, 0, 1);
+	} else {
+		for (i = 0; i < n; i++)
+			bench_emit(f, BPF_JMP|BPF_JEQ|BPF_K, r[i].lo,
+				   n - i, 0);
+	}
+	if (chain)
+		bench_emit(f, BPF_JMP|BPF_JA, 1, 0, 0);
+	else
+		bench_emit(f, BPF_RET|BPF_K, SECCOMP_RET_ALLOW, 0, 0);
+	bench_emit(f, BPF_RET|BPF_K, SECCOMP_RET_ALLOW, 0, 0);
+}
+
+/* Emits a balanced JGE decision tree with up to |leaf| ranges per leaf. */
+static void bench_emit_tree(struct bench_filter *f,
+			    const struct bench_range *r, unsigned int n,
+			    unsigned int leaf)
+{
+	unsigned int mid = n / 2, ja;
+
+	if (n <= leaf) {
+		bench_emit_leaf(f, r, n, 0);
+		return;
+	}
+	bench_emit(f, BPF_JMP|BPF_JGE|BPF_K, r[mid].lo, 0, 1);
+	/* The right subtree is usually out of reach of an 8-bit offset. */
+	ja = f->len;
+	bench_emit(f, BPF_JMP|BPF_JA, 0, 0, 0);
+	bench_emit_tree(f, r, mid, leaf);
+	if (ja < BPF_MAXINSNS)
+		f->insns[ja].k = f->len - ja - 1;
+	bench_emit_tree(f, r + mid, n - mid, leaf);
+}
+
+enum bench_layout {
+	LAYOUT_LINEAR,
+	LAYOUT_BSEARCH,
+	LAYOUT_RANGES,
+};
+
+static const char * const bench_layout_names[] = {
+	[LAYOUT_LINEAR] = "linear",
+	[LAYOUT_BSEARCH] = "bsearch",
+	[LAYOUT_RANGES] = "ranges",
+};
+
+/* Where the measured syscall sits in the set, if anywhere. */
+enum bench_hit {
+	HIT_HEAD,
+	HIT_MIDDLE,
+	HIT_TAIL,
+	HIT_MISS,
+};
+
+static const char * const bench_hit_names[] = {
+	[HIT_HEAD] = "head",
+	[HIT_MIDDLE] = "middle",
+	[HIT_TAIL] = "tail",
+	[HIT_MISS] = "miss",
+};
+
+struct bench_layout_args {
+	enum bench_layout layout;
+	enum bench_hit hit;
+	unsigned int entries;
+	struct bench_filter filter;
+};
+
+/*
+ * Builds a filter matching |entries| syscall numbers laid out in runs of
+ * eight, like the clusters of related calls in real policies, with getpid
+ * placed at the requested position.  Since getpid's real number can't have
+ * thousands of numbers below it, nr is biased by an ALU add first.  Both
+ * hits and misses allow, so only the path length differs and the harness
+ * keeps working.  The filter also loads an argument, which keeps the
+ * kernel's action cache from skipping it.
+ */
+static void bench_build_layout(struct bench_layout_args *args)
+{
+	struct bench_filter *f = &args->filter;
+	struct bench_range *r;
+	unsigned int i, n = args->entries, nranges = 0, target;
+
+	r = calloc(n, sizeof(*r));
+	if (!r) {
+		f->len = BPF_MAXINSNS + 1;
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		__u32 nr = (i / 8) * 16 + i % 8;
+		if (args->layout == LAYOUT_RANGES && nranges &&
+		    r[nranges - 1].hi + 1 == nr) {
+			r[nranges - 1].hi = nr;
+		} else {
+			r[nranges].lo = r[nranges].hi = nr;
+			nranges++;
+		}
+	}
+	switch (args->hit) {
+	case HIT_HEAD:
+		target = 0;
+		break;
+	case HIT_MIDDLE:
+		target = (n / 2 / 8) * 16 + (n / 2) % 8;
+		break;
+	case HIT_TAIL:
+		target = ((n - 1) / 8) * 16 + (n - 1) % 8;
+		break;
+	default:
+		target = (n / 8) * 16 + 8 + 4;
+		break;
+	}
+
+	f->len = 0;
+	bench_emit(f, BPF_LD|BPF_W|BPF_ABS, syscall_arg(0), 0, 0);
+	bench_emit(f, BPF_LD|BPF_W|BPF_ABS,
+		   offsetof(struct seccomp_data, nr), 0, 0);
+	bench_emit(f, BPF_ALU|BPF_ADD|BPF_K, target - __NR_getpid, 0, 0);
+	switch (args->layout) {
+	case LAYOUT_LINEAR:
+		for (i = 0; i < nranges; i += 254)
+			bench_emit_leaf(f, r + i,
+					nranges - i < 254 ? nranges - i : 254,
+					nranges - i > 254);
+		break;
+	case LAYOUT_BSEARCH:
+		bench_emit_tree(f, r, nranges, 4);
+		break;
+	case LAYOUT_RANGES:
+		bench_emit_tree(f, r, nranges, 1);
+		break;
+	}
+	free(r);
+}
+
+static void bench_layout_child(struct __test_metadata *_metadata, void *data)
+{
+	struct bench_layout_args *args = data;
+	struct sock_fprog prog = {
+		.len = (unsigned short)args->filter.len,
+		.filter = args->filter.insns,
+	};
+	long ret;
+
+	ret = prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0);
+	ASSERT_EQ(0, ret);
+	ret = prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog, 0, 0);
+	ASSERT_EQ(0, ret) {
+		TH_LOG("Failed to install %u-insn %s filter", prog.len,
+		       bench_layout_names[args->layout]);
+	}
+	BENCHMARK_LOOP("%s n=%u %s (%u insns)",
+		       bench_layout_names[args->layout], args->entries,
+		       bench_hit_names[args->hit], prog.len) {
+		syscall(__NR_getpid, 0);
+	}
+}
+
+BENCHMARK(filter_layouts) {
+	static const unsigned int sizes[] = {
+		/* 300 is about the size of a real allowlist policy. */
+		10, 30, 100, 300, 1000, 2000, BPF_MAXINSNS,
+	};
+	struct bench_layout_args *args;
+	unsigned int s;
+
+	args = malloc(sizeof(*args));
+	ASSERT_NE(NULL, args);
+
+	BENCHMARK_LOOP("unfiltered") {
+		syscall(__NR_getpid, 0);
+	}
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		for (args->layout = LAYOUT_LINEAR;
+		     args->layout <= LAYOUT_RANGES; args->layout++) {
+			for (args->hit = HIT_HEAD; args->hit <= HIT_MISS;
+			     args->hit++) {
+				args->entries = sizes[s];
+				bench_build_layout(args);
+				if (args->filter.len > BPF_MAXINSNS) {
+					TH_LOG("%s n=%u needs %u insns; skipped",
+					       bench_layout_names[args->layout],
+					       args->entries,
+					       args->filter.len);
+					break;
+				}
+				bench_in_child(_metadata, bench_layout_child,
+					       args);
+			}
+		}
+	}
+	free(args);
+}
+
+/* Steps 1, 2, 4, ... up to and including |max|; returns 0 when done. */
+static int bench_next_count(int n, int max)
+{
+	if (n >= max)
+		return 0;
+	return n * 2 < max ? n * 2 : max;
+}
+
+static double bench_elapsed_ns(const struct timespec *start,
+			       const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e9 +
+	       (end->tv_nsec - start->tv_nsec);
+}
+
+static __thread unsigned long TRAP_count;
+static void TRAP_count_action(int nr, siginfo_t *info, void *void_context)
+{
+	TRAP_count++;
+}
+
+struct trap_worker {
+	pthread_t tid;
+	volatile int *go;
+	volatile int *stop;
+	unsigned long traps;
+};
+
+static void *trap_worker(void *data)
+{
+	struct trap_worker *w = data;
+
+	while (!*w->go)
+		;
+	while (!*w->stop)
+		syscall(__NR_getpid);
+	w->traps = TRAP_count;
+	return NULL;
+}
+
+/*
+ * Full SECCOMP_RET_TRAP cycle: kernel entry, filter, SIGSYS delivery, the
+ * handler, and rt_sigreturn back to the caller.
+ */
+BENCHMARK_F(TRAP, round_trip) {
+	struct trap_worker *workers;
+	struct sigaction act;
+	struct timespec start, end;
+	volatile int go, stop;
+	int ncpus, n, i;
+	long ret;
+
+	memset(&act, 0, sizeof(act));
+	act.sa_sigaction = &TRAP_count_action;
+	act.sa_flags = SA_SIGINFO;
+	ret = sigaction(SIGSYS, &act, NULL);
+	ASSERT_EQ(0, ret);
+
+	ret = prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0);
+	ASSERT_EQ(0, ret);
+	ret = prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &self->prog);
+	ASSERT_EQ(0, ret);
+
+	/* getppid passes through the same filter but is allowed. */
+	BENCHMARK_LATENCY_LOOP("allowed syscall") {
+		syscall(__NR_getppid);
+	}
+	BENCHMARK_LATENCY_LOOP("trap round trip") {
+		syscall(__NR_getpid);
+	}
+	ASSERT_LT(0, TRAP_count);
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	ASSERT_LT(0, ncpus);
+	workers = calloc(ncpus, sizeof(*workers));
+	ASSERT_NE(NULL, workers);
+	for (n = 1; n; n = bench_next_count(n, ncpus)) {
+		unsigned long traps = 0;
+
+		go = stop = 0;
+		for (i = 0; i < n; i++) {
+			workers[i].go = &go;
+			workers[i].stop = &stop;
+			ASSERT_EQ(0, pthread_create(&workers[i].tid, NULL,
+						    trap_worker, &workers[i]));
+		}
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		go = 1;
+		usleep(200000);
+		stop = 1;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		for (i = 0; i < n; i++) {
+			ASSERT_EQ(0, pthread_join(workers[i].tid, NULL));
+			traps += workers[i].traps;
+		}
+		ASSERT_LT(0, traps);
+		BENCHMARK_REPORT(traps * 1e9 / bench_elapsed_ns(&start, &end),
+				 "traps/s", "trap throughput threads=%d", n);
+	}
+	free(workers);
+}
+
+/* Reports the stop rate implied by the last latency loop. */
+#define TRACE_REPORT_RATE(_label) \
+	BENCHMARK_REPORT(1e9 / BENCHMARK_LAST()->median, "stops/s", \
+			 "%s rate", _label)
+
+/*
+ * SECCOMP_RET_TRACE round trips through tracer(): seccomp stop, the
+ * tracer's wait() and handler, and PTRACE_CONT back to the tracee.
+ */
+BENCHMARK_F(TRACE_syscall, round_trip) {
+	long ret;
+
+	ret = prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0);
+	ASSERT_EQ(0, ret);
+	ret = prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &self->prog, 0, 0);
+	ASSERT_EQ(0, ret);
+
+	BENCHMARK_LATENCY_LOOP("untraced") {
+		syscall(__NR_getuid);
+	}
+	/* 0x1004: the tracer only reads the event message. */
+	BENCHMARK_LATENCY_LOOP("trace no-op") {
+		syscall(__NR_getppid);
+	}
+	TRACE_REPORT_RATE("trace no-op");
+	/* 0x1002: change_syscall() rewrites getpid into getppid. */
+	BENCHMARK_LATENCY_LOOP("trace register rewrite") {
+		syscall(__NR_getpid);
+	}
+	TRACE_REPORT_RATE("trace register rewrite");
+	/* 0x1003: change_syscall() skips gettid and sets the return. */
+	BENCHMARK_LATENCY_LOOP("trace skip") {
+		syscall(__NR_gettid);
+	}
+	TRACE_REPORT_RATE("trace skip");
+	EXPECT_EQ(self->parent, syscall(__NR_getpid));
+}
+
+BENCHMARK_F(TRACE_poke, round_trip) {
+	ssize_t ret = prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0);
+	ASSERT_EQ(0, ret);
+
+	ret = prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &self->prog, 0, 0);
+	ASSERT_EQ(0, ret);
+
+	/* tracer_poke() writes into our memory with PTRACE_POKEDATA. */
+	BENCHMARK_LATENCY_LOOP("trace memory poke") {
+		read(-1, NULL, 0);
+	}
+	TRACE_REPORT_RATE("trace memory poke");
+	EXPECT_EQ(0x1001, self->poked);
+}
+
+struct tsync_bench_args {
+	FIXTURE_DATA(TSYNC) *self;
+	int diverge;
+};
+
+static void tsync_install_child(struct __test_metadata *_metadata,
+				void *data)
+{
+	struct tsync_bench_args *args = data;
+	FIXTURE_DATA(TSYNC) *self = args->self;
+	int n = self->sibling_max, sib;
+	long ret;
+
+	ASSERT_EQ(0, prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0));
+	ret = seccomp(SECCOMP_SET_MODE_FILTER, 0, &self->root_prog);
+	ASSERT_EQ(0, ret);
+
+	/* The last sibling is the last thread TSYNC will look at. */
+	self->sibling[n - 1].diverge = args->diverge;
+	for (sib = 0; sib < n; ++sib) {
+		ASSERT_EQ(0, pthread_create(&self->sibling[sib].tid, NULL,
+					    tsync_sibling,
+					    &self->sibling[sib])) {
+			TH_LOG("Could only start %d of %d siblings", sib, n);
+		}
+	}
+	while (self->sibling_count < n) {
+		sem_wait(&self->started);
+		self->sibling_count++;
+	}
+
+	if (!args->diverge) {
+		BENCHMARK_COUNTED_LOOP(64, "install siblings=%d", n) {
+			ret = seccomp(SECCOMP_SET_MODE_FILTER, 0,
+				      &self->apply_prog);
+		}
+		EXPECT_EQ(0, ret);
+	}
+	BENCHMARK_COUNTED_LOOP(64, "tsync %s siblings=%d",
+			       args->diverge ? "diverged" : "shared", n) {
+		ret = seccomp(SECCOMP_SET_MODE_FILTER,
+			      SECCOMP_FLAG_FILTER_TSYNC, &self->apply_prog);
+	}
+	if (args->diverge) {
+		EXPECT_EQ(self->sibling[n - 1].system_tid, ret);
+	} else {
+		EXPECT_EQ(0, ret);
+	}
+	BENCHMARK_REPORT(BENCHMARK_LAST()->median / n, "ns/thread",
+			 "tsync %s siblings=%d per thread",
+			 args->diverge ? "diverged" : "shared", n);
+	/* Siblings are still waiting; leaving takes them down. */
+}
+
+/*
+ * SECCOMP_FLAG_FILTER_TSYNC install latency.  With a shared tree every
+ * sibling is moved to the new filter; with a diverged one the install fails
+ * after checking every sibling, so both cover the whole thread list.
+ */
+BENCHMARK_F(TSYNC, install_latency) {
+	static const int counts[] = { 2, 16, 128, 1024 };
+	struct tsync_bench_args args = { .self = self };
+	unsigned int i;
+
+	for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		tsync_init_siblings(_metadata, self, counts[i]);
+		for (args.diverge = 0; args.diverge <= 1; args.diverge++)
+			bench_in_child(_metadata, tsync_install_child, &args);
+	}
+}
+
+/* Log-linear latency histogram: 8 buckets per power of two nanoseconds. */
+#define LATENCY_BUCKETS (64 * 8)
+
+static unsigned int latency_bucket(unsigned long ns)
+{
+	unsigned int log = 0;
+
+	if (ns < 8)
+		return ns;
+	while (ns >> (log + 1))
+		log++;
+	return ((log - 2) << 3) | ((ns >> (log - 3)) & 7);
+}
+
+/* Smallest latency that falls in the bucket after |bucket|. */
+static unsigned long latency_bucket_limit(unsigned int bucket)
+{
+	unsigned int log;
+
+	bucket++;
+	if (bucket < 8)
+		return bucket;
+	log = (bucket >> 3) + 2;
+	return (8UL | (bucket & 7)) << (log - 3);
+}
+
+struct latency_hist {
+	unsigned long count[LATENCY_BUCKETS];
+	unsigned long total, max;
+};
+
+static unsigned long latency_percentile(const struct latency_hist *h,
+					double pct)
+{
+	unsigned long seen = 0, want = (unsigned long)(h->total * pct / 100);
+	unsigned int i;
+
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		seen += h->count[i];
+		if (seen > want)
+			return latency_bucket_limit(i);
+	}
+	return h->max;
+}
+
+enum disruption_phase {
+	PHASE_IDLE,
+	PHASE_INSTALL,
+	PHASE_DONE,
+};
+
+struct tsync_worker {
+	struct tsync_sibling *sibling;
+	volatile int *phase;
+	struct latency_hist hist[PHASE_DONE];
+};
+
+/* Like tsync_sibling(), but hammers getppid until told to stop. */
+void *tsync_worker(void *data)
+{
+	struct tsync_worker *me = data;
+	struct timespec start, end;
+	int phase;
+
+	me->sibling->system_tid = syscall(__NR_gettid);
+	sem_post(me->sibling->started);
+	while ((phase = *me->phase) != PHASE_DONE) {
+		struct latency_hist *h = &me->hist[phase];
+		unsigned long ns;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		syscall(__NR_getppid);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		ns = bench_elapsed_ns(&start, &end);
+		h->count[latency_bucket(ns)]++;
+		h->total++;
+		if (ns > h->max)
+			h->max = ns;
+	}
+	return NULL;
+}
+
+struct disruption_args {
+	FIXTURE_DATA(TSYNC) *self;
+	unsigned int flags;
+};
+
+#define DISRUPTION_PHASE_NS	200000000
+#define DISRUPTION_INSTALL_GAP_US	1000
+
+static void tsync_disruption_child(struct __test_metadata *_metadata,
+				   void *data)
+{
+	struct disruption_args *args = data;
+	FIXTURE_DATA(TSYNC) *self = args->self;
+	const char *mode = args->flags ? "tsync" : "plain";
+	struct tsync_worker *workers;
+	struct latency_hist *sum;
+	struct timespec start[PHASE_DONE], end[PHASE_DONE];
+	volatile int phase = PHASE_IDLE;
+	int n = self->sibling_max, sib, p, installs = 0;
+	unsigned int i;
+
+	ASSERT_EQ(0, prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0));
+	ASSERT_EQ(0, seccomp(SECCOMP_SET_MODE_FILTER, 0, &self->root_prog));
+
+	workers = calloc(n, sizeof(*workers));
+	sum = calloc(PHASE_DONE, sizeof(*sum));
+	ASSERT_NE(NULL, workers);
+	ASSERT_NE(NULL, sum);
+	for (sib = 0; sib < n; ++sib) {
+		workers[sib].sibling = &self->sibling[sib];
+		workers[sib].phase = &phase;
+		ASSERT_EQ(0, pthread_create(&self->sibling[sib].tid, NULL,
+					    tsync_worker, &workers[sib]));
+	}
+	while (self->sibling_count < n) {
+		sem_wait(&self->started);
+		self->sibling_count++;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start[PHASE_IDLE]);
+	usleep(DISRUPTION_PHASE_NS / 1000);
+	clock_gettime(CLOCK_MONOTONIC, &end[PHASE_IDLE]);
+	phase = PHASE_INSTALL;
+	start[PHASE_INSTALL] = end[PHASE_IDLE];
+	do {
+		ASSERT_EQ(0, seccomp(SECCOMP_SET_MODE_FILTER, args->flags,
+				     &self->apply_prog)) {
+			TH_LOG("Install %d failed: %s", installs,
+			       strerror(errno));
+		}
+		installs++;
+		usleep(DISRUPTION_INSTALL_GAP_US);
+		clock_gettime(CLOCK_MONOTONIC, &end[PHASE_INSTALL]);
+	} while (bench_elapsed_ns(&start[PHASE_INSTALL], &end[PHASE_INSTALL]) <
+		 DISRUPTION_PHASE_NS);
+	phase = PHASE_DONE;
+
+	for (sib = 0; sib < n; ++sib) {
+		ASSERT_EQ(0, pthread_join(self->sibling[sib].tid, NULL));
+		for (p = PHASE_IDLE; p < PHASE_DONE; p++) {
+			struct latency_hist *h = &workers[sib].hist[p];
+			for (i = 0; i < LATENCY_BUCKETS; i++)
+				sum[p].count[i] += h->count[i];
+			sum[p].total += h->total;
+			if (h->max > sum[p].max)
+				sum[p].max = h->max;
+		}
+	}
+	for (p = PHASE_IDLE; p < PHASE_DONE; p++) {
+		const char *name = p == PHASE_IDLE ? "idle" : "installing";
+
+		ASSERT_LT(0, sum[p].total);
+		BENCHMARK_REPORT(sum[p].total * 1e9 /
+				 bench_elapsed_ns(&start[p], &end[p]),
+				 "calls/s", "%s workers=%d %s throughput",
+				 mode, n, name);
+		BENCHMARK_REPORT(latency_percentile(&sum[p], 99), "ns",
+				 "%s workers=%d %s p99", mode, n, name);
+		BENCHMARK_REPORT(latency_percentile(&sum[p], 99.9), "ns",
+				 "%s workers=%d %s p99.9", mode, n, name);
+		BENCHMARK_REPORT(sum[p].max, "ns", "%s workers=%d %s max",
+				 mode, n, name);
+	}
+	TH_LOG("%s workers=%d: %d installs", mode, n, installs);
+	free(sum);
+	free(workers);
+}
+
+/*
+ * How much filter installs, with and without TSYNC, disturb threads busy
+ * making syscalls: worker throughput and latency tails while idle versus
+ * while the main thread installs a filter every millisecond.
+ */
+BENCHMARK_F(TSYNC, worker_disruption) {
+	struct disruption_args args = { .self = self };
+	int ncpus, n;
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	ASSERT_LT(0, ncpus);
+	for (n = 1; n; n = bench_next_count(n, ncpus)) {
+		tsync_init_siblings(_metadata, self, n);
+		args.flags = 0;
+		bench_in_child(_metadata, tsync_disruption_child, &args);
+		args.flags = SECCOMP_FLAG_FILTER_TSYNC;
+		bench_in_child(_metadata, tsync_disruption_child, &args);
+	}
+}
+
+enum action_cost {
+	ACTION_ALLOW,
+	ACTION_ERRNO,
+	ACTION_TRAP,
+	ACTION_TRACE,
+	ACTION_TRACE_UNTRACED,
+	ACTION_FORK_EXIT,
+	ACTION_KILL,
+	ACTION_MAX,
+};
+
+static const char * const action_cost_names[] = {
+	[ACTION_ALLOW] = "allow",
+	[ACTION_ERRNO] = "errno",
+	[ACTION_TRAP] = "trap",
+	[ACTION_TRACE] = "trace (tracer attached)",
+	[ACTION_TRACE_UNTRACED] = "trace (no tracer, ENOSYS)",
+	[ACTION_FORK_EXIT] = "fork + exit",
+	[ACTION_KILL] = "fork + kill",
+};
+
+struct action_cost_args {
+	FIXTURE_DATA(precedence) *self;
+	enum action_cost action;
+	struct __bench_result *results;	/* shared with the children */
+};
+
+void tracer_noop(struct __test_metadata *_metadata, pid_t tracee,
+		 int status, void *args)
+{
+}
+
+static void action_cost_child(struct __test_metadata *_metadata, void *data)
+{
+	struct action_cost_args *args = data;
+	FIXTURE_DATA(precedence) *self = args->self;
+	const char *name = action_cost_names[args->action];
+	struct sock_fprog *prog = &self->allow;
+	struct rlimit no_core = { 0, 0 };
+	struct sigaction act;
+	pid_t tracer = 0, pid;
+	int status;
+
+	switch (args->action) {
+	case ACTION_ALLOW:
+		break;
+	case ACTION_ERRNO:
+		prog = &self->error;
+		break;
+	case ACTION_TRAP:
+		memset(&act, 0, sizeof(act));
+		act.sa_sigaction = &TRAP_count_action;
+		act.sa_flags = SA_SIGINFO;
+		ASSERT_EQ(0, sigaction(SIGSYS, &act, NULL));
+		prog = &self->trap;
+		break;
+	case ACTION_TRACE:
+		tracer = setup_trace_fixture(_metadata, tracer_noop, NULL);
+		/* fall through */
+	case ACTION_TRACE_UNTRACED:
+		prog = &self->trace;
+		break;
+	case ACTION_FORK_EXIT:
+	case ACTION_KILL:
+		/* Don't leave a core file behind for every kill. */
+		ASSERT_EQ(0, setrlimit(RLIMIT_CORE, &no_core));
+		prog = &self->kill;
+		break;
+	default:
+		ASSERT_EQ(0, args->action);
+	}
+
+	ASSERT_EQ(0, prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0));
+	ASSERT_EQ(0, prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, prog, 0, 0));
+
+	if (args->action == ACTION_FORK_EXIT || args->action == ACTION_KILL) {
+		/* Every kill takes a process with it, so time whole lives. */
+		BENCHMARK_COUNTED_LOOP(200, "%s", name) {
+			pid = fork();
+			if (pid == 0) {
+				if (args->action == ACTION_KILL)
+					syscall(__NR_getpid);
+				_exit(0);
+			}
+			waitpid(pid, &status, 0);
+		}
+		if (args->action == ACTION_KILL) {
+			EXPECT_TRUE(WIFSIGNALED(status) &&
+				    WTERMSIG(status) == SIGSYS);
+		} else {
+			EXPECT_TRUE(WIFEXITED(status));
+		}
+	} else {
+		BENCHMARK_LATENCY_LOOP("%s", name) {
+			syscall(__NR_getpid);
+		}
+	}
+	args->results[args->action] = *BENCHMARK_LAST();
+	if (tracer)
+		teardown_trace_fixture(_metadata, tracer);
+}
+
+/*
+ * Per-call cost of each return action on a denied getpid, using the
+ * precedence fixture's programs.  KILL is measured as the extra cost of a
+ * child being killed by its first getpid over one that just exits.
+ */
+BENCHMARK_F(precedence, action_cost) {
+	struct action_cost_args args = { .self = self };
+	const struct __bench_result *r;
+	double base, kill_cost;
+
+	args.results = mmap(NULL, ACTION_MAX * sizeof(*args.results),
+			    PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	ASSERT_NE(MAP_FAILED, args.results);
+
+	for (args.action = 0; args.action < ACTION_MAX; args.action++)
+		bench_in_child(_metadata, action_cost_child, &args);
+
+	base = args.results[ACTION_ALLOW].median;
+	kill_cost = args.results[ACTION_KILL].median -
+		    args.results[ACTION_FORK_EXIT].median;
+	BENCHMARK_REPORT(kill_cost, "ns", "kill");
+
+	printf("%-28s %12s %12s %10s\n", "action", "median ns", "p99 ns",
+	       "vs allow");
+	for (args.action = 0; args.action < ACTION_MAX; args.action++) {
+		r = &args.results[args.action];
+		printf("%-28s %12.1f %12.1f %9.1fx\n",
+		       action_cost_names[args.action], r->median, r->p99,
+		       base > 0 ? r->median / base : 0);
+	}
+	printf("%-28s %12.1f %12s %9.1fx\n", "kill (difference)", kill_cost,
+	       "", base > 0 ? kill_cost / base : 0);
+	fflush(stdout);
+	munmap(args.results, ACTION_MAX * sizeof(*args.results));
+}
+
+/*
+ * Builds a |len| instruction filter which runs every instruction for every
+ * syscall and allows it.  Loading an argument keeps the kernel's action
+ * cache from skipping it.
+ */
+static void bench_build_noop_filter(struct bench_filter *f, unsigned int len)
+{
+	f->len = 0;
+	if (len > 1)
+		bench_emit(f, BPF_LD|BPF_W|BPF_ABS, syscall_arg(0), 0, 0);
+	while (f->len < len - 1)
+		bench_emit(f, BPF_JMP|BPF_JEQ|BPF_K, 0x0C0FFEE, 0, 0);
+	bench_emit(f, BPF_RET|BPF_K, SECCOMP_RET_ALLOW, 0, 0);
+}
+
+struct lifecycle_args {
+	unsigned int depth;
+	struct bench_filter filter;
+	int ncpus;
+};
+
+/* Shared between bench_parallel() workers and their parent. */
+struct bench_parallel_shared {
+	volatile int go, stop;
+	unsigned long count[];
+};
+
+#define BENCH_PARALLEL_US 200000
+
+/*
+ * Runs |fn| in a loop in |n| processes at once, each pinned to its own
+ * allowed CPU if |pin| is set, and returns the combined calls per second.
+ */
+static double bench_parallel(struct __test_metadata *_metadata, int n,
+			     int pin, void (*fn)(void))
+{
+	struct bench_parallel_shared *shared;
+	struct timespec start, end;
+	unsigned long total = 0;
+	size_t size = sizeof(*shared) + n * sizeof(shared->count[0]);
+	cpu_set_t allowed;
+	int p, cpu = -1, status;
+	pid_t pid;
+
+	shared = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	ASSERT_NE(MAP_FAILED, shared);
+	ASSERT_EQ(0, sched_getaffinity(0, sizeof(allowed), &allowed));
+	for (p = 0; p < n; p++) {
+		do {
+			cpu = (cpu + 1) % CPU_SETSIZE;
+		} while (pin && !CPU_ISSET(cpu, &allowed));
+		pid = fork();
+		ASSERT_LE(0, pid);
+		if (pid == 0) {
+			unsigned long count = 0;
+
+			if (pin) {
+				cpu_set_t set;
+
+				CPU_ZERO(&set);
+				CPU_SET(cpu, &set);
+				if (sched_setaffinity(0, sizeof(set), &set))
+					_exit(1);
+			}
+			while (!shared->go)
+				;
+			while (!shared->stop) {
+				fn();
+				count++;
+			}
+			/* Only written once, so workers don't share lines. */
+			shared->count[p] = count;
+			_exit(0);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	shared->go = 1;
+	usleep(BENCH_PARALLEL_US);
+	shared->stop = 1;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	for (p = 0; p < n; p++) {
+		ASSERT_LT(0, wait(&status));
+		EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+	for (p = 0; p < n; p++)
+		total += shared->count[p];
+	munmap(shared, size);
+	return total * 1e9 / bench_elapsed_ns(&start, &end);
+}
+
+static void bench_fork_exit(void)
+{
+	pid_t pid = fork();
+
+	if (pid == 0)
+		_exit(0);
+	waitpid(pid, NULL, 0);
+}
+
+static int lifecycle_clone_child(void *arg)
+{
+	return 0;
+}
+
+#define LIFECYCLE_EXEC "/bin/true"
+#define LIFECYCLE_STACK (64 * 1024)
+
+static void lifecycle_child(struct __test_metadata *_metadata, void *data)
+{
+	struct lifecycle_args *args = data;
+	struct sock_fprog prog = {
+		.len = (unsigned short)args->filter.len,
+		.filter = args->filter.insns,
+	};
+	unsigned int i, insns = args->depth ? prog.len : 0;
+	char *stack;
+	int status = 0, n;
+	pid_t pid;
+
+	ASSERT_EQ(0, prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0));
+	for (i = 0; i < args->depth; i++) {
+		ASSERT_EQ(0, prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER,
+				   &prog, 0, 0)) {
+			TH_LOG("Only installed %u of %u filters", i,
+			       args->depth);
+		}
+	}
+
+	BENCHMARK_COUNTED_LOOP(200, "fork+exit depth=%u insns=%u",
+			       args->depth, insns) {
+		pid = fork();
+		if (pid == 0)
+			_exit(0);
+		waitpid(pid, &status, 0);
+	}
+	EXPECT_TRUE(WIFEXITED(status));
+
+	if (access(LIFECYCLE_EXEC, X_OK) == 0) {
+		BENCHMARK_COUNTED_LOOP(100, "fork+execve depth=%u insns=%u",
+				       args->depth, insns) {
+			pid = fork();
+			if (pid == 0) {
+				execl(LIFECYCLE_EXEC, LIFECYCLE_EXEC,
+				      (char *)NULL);
+				_exit(127);
+			}
+			waitpid(pid, &status, 0);
+		}
+		EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	} else {
+		TH_LOG("No %s; skipping execve", LIFECYCLE_EXEC);
+	}
+
+	stack = malloc(LIFECYCLE_STACK);
+	ASSERT_NE(NULL, stack);
+	BENCHMARK_COUNTED_LOOP(200, "clone(CLONE_VM) depth=%u insns=%u",
+			       args->depth, insns) {
+		pid = clone(lifecycle_clone_child, stack + LIFECYCLE_STACK,
+			    CLONE_VM | SIGCHLD, NULL);
+		waitpid(pid, &status, 0);
+	}
+	EXPECT_TRUE(WIFEXITED(status));
+	free(stack);
+
+	/* Every fork and exit takes and drops a reference on the chain. */
+	for (n = 1; n; n = bench_next_count(n, args->ncpus)) {
+		BENCHMARK_REPORT(bench_parallel(_metadata, n, 0,
+						bench_fork_exit),
+				 "forks/s", "fork+exit depth=%u insns=%u procs=%d",
+				 args->depth, insns, n);
+	}
+}
+
+/*
+ * fork+exit, fork+execve and clone(CLONE_VM) latency against the depth of
+ * the inherited filter chain and the size of its filters.  The times
+ * include running the chain for the syscalls involved.
+ */
+BENCHMARK(process_lifecycle) {
+	static const unsigned int depths[] = { 0, 1, 16, 256, 1024 };
+	static const unsigned int sizes[] = { 64, 512, BPF_MAXINSNS };
+	struct lifecycle_args *args;
+	unsigned int i;
+
+	args = malloc(sizeof(*args));
+	ASSERT_NE(NULL, args);
+	args->ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	ASSERT_LT(0, args->ncpus);
+
+	bench_build_noop_filter(&args->filter, 4);
+	for (i = 0; i < sizeof(depths) / sizeof(depths[0]); i++) {
+		args->depth = depths[i];
+		bench_in_child(_metadata, lifecycle_child, args);
+	}
+	args->depth = 1;
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		bench_build_noop_filter(&args->filter, sizes[i]);
+		bench_in_child(_metadata, lifecycle_child, args);
+	}
+	free(args);
+}
+
+/* The call bench_build_layout() places in the filter. */
+static void bench_getpid(void)
+{
+	syscall(__NR_getpid, 0);
+}
+
+struct scaling_args {
+	const char *name;
+	struct bench_filter *filter;
+	int ncpus;
+};
+
+static void scaling_child(struct __test_metadata *_metadata, void *data)
+{
+	struct scaling_args *args = data;
+	double rate;
+	int n;
+
+	if (args->filter) {
+		struct sock_fprog prog = {
+			.len = (unsigned short)args->filter->len,
+			.filter = args->filter->insns,
+		};
+
+		ASSERT_EQ(0, prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0));
+		ASSERT_EQ(0, prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER,
+				   &prog, 0, 0));
+	}
+	for (n = 1; n; n = bench_next_count(n, args->ncpus)) {
+		rate = bench_parallel(_metadata, n, 1, bench_getpid);
+		BENCHMARK_REPORT(rate, "calls/s", "%s cores=%d",
+				 args->name, n);
+		BENCHMARK_REPORT(rate / n, "calls/s", "%s cores=%d per core",
+				 args->name, n);
+	}
+}
+
+/*
+ * Aggregate syscall throughput of one pinned process per core, all sharing
+ * the filter inherited from one parent, against an unfiltered baseline.
+ * The filter is the 300-entry search tree from filter_layouts, with the
+ * timed getpid hitting its middle.
+ */
+BENCHMARK(multicore_scaling) {
+	struct bench_layout_args *layout;
+	struct scaling_args args;
+	cpu_set_t allowed;
+
+	ASSERT_EQ(0, sched_getaffinity(0, sizeof(allowed), &allowed));
+	args.ncpus = CPU_COUNT(&allowed);
+
+	args.name = "unfiltered";
+	args.filter = NULL;
+	bench_in_child(_metadata, scaling_child, &args);
+
+	layout = malloc(sizeof(*layout));
+	ASSERT_NE(NULL, layout);
+	layout->layout = LAYOUT_BSEARCH;
+	layout->hit = HIT_MIDDLE;
+	layout->entries = 300;
+	bench_build_layout(layout);
+	args.name = "filtered";
+	args.filter = &layout->filter;
+	bench_in_child(_metadata, scaling_child, &args);
+	free(layout);
+}
+
+enum install_entry {
+	INSTALL_PRCTL,
+	INSTALL_SECCOMP,
+};
+
+static const char * const install_entry_names[] = {
+	[INSTALL_PRCTL] = "prctl",
+	[INSTALL_SECCOMP] = "seccomp",
+};
+
+/*
+ * Times one install in each of BENCHMARK_SAMPLES fresh children, the way a
+ * sandboxed worker would do it.  If |valid| isn't set, the program's last
+ * instruction isn't a return, so the kernel copies and checks the whole
+ * program and then rejects it before converting and JITing it.
+ */
+static void install_series(struct __test_metadata *_metadata,
+			   struct bench_filter *filter,
+			   enum install_entry entry, int valid)
+{
+	struct sock_fprog prog = {
+		.len = (unsigned short)filter->len,
+		.filter = filter->insns,
+	};
+	struct timespec start, end;
+	double *samples;
+	int i, status;
+	pid_t pid;
+
+	samples = mmap(NULL, BENCHMARK_SAMPLES * sizeof(*samples),
+		       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+		       -1, 0);
+	ASSERT_NE(MAP_FAILED, samples);
+	for (i = 0; i < BENCHMARK_SAMPLES; i++) {
+		pid = fork();
+		ASSERT_LE(0, pid);
+		if (pid == 0) {
+			long ret;
+
+			if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0))
+				_exit(1);
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			if (entry == INSTALL_PRCTL)
+				ret = prctl(PR_SET_SECCOMP,
+					    SECCOMP_MODE_FILTER, &prog, 0, 0);
+			else
+				ret = seccomp(SECCOMP_SET_MODE_FILTER, 0,
+					      &prog);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			samples[i] = bench_elapsed_ns(&start, &end);
+			_exit(valid ? ret != 0 : !(ret == -1 && errno == EINVAL));
+		}
+		ASSERT_EQ(pid, waitpid(pid, &status, 0));
+		ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+			TH_LOG("%s of %u insns did not %s",
+			       install_entry_names[entry], prog.len,
+			       valid ? "install" : "fail");
+		}
+	}
+	BENCHMARK_RECORD(samples, BENCHMARK_SAMPLES, "%s%s insns=%u",
+			 install_entry_names[entry],
+			 valid ? "" : " rejected", prog.len);
+	munmap(samples, BENCHMARK_SAMPLES * sizeof(*samples));
+}
+
+/*
+ * Filter install latency through prctl() and seccomp() across program
+ * sizes, including validation and, where enabled, the JIT.  Rejected
+ * programs give the copy and validation cost on its own.
+ */
+BENCHMARK(filter_install_latency) {
+	static const unsigned int sizes[] = {
+		1, 4, 16, 64, 256, 1024, BPF_MAXINSNS,
+	};
+	struct bench_filter *filter;
+	enum install_entry entry;
+	unsigned int i;
+	FILE *jit;
+	int valid;
+
+	jit = fopen("/proc/sys/net/core/bpf_jit_enable", "r");
+	if (jit) {
+		TH_LOG("bpf_jit_enable: %d", fgetc(jit) - '0');
+		fclose(jit);
+	}
+
+	filter = malloc(sizeof(*filter));
+	ASSERT_NE(NULL, filter);
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		for (valid = 1; valid >= 0; valid--) {
+			bench_build_noop_filter(filter, sizes[i]);
+			if (!valid) {
+				struct sock_filter load = BPF_STMT(
+					BPF_LD|BPF_W|BPF_ABS, syscall_arg(0));
+				filter->insns[filter->len - 1] = load;
+			}
+			for (entry = INSTALL_PRCTL; entry <= INSTALL_SECCOMP;
+			     entry++)
+				install_series(_metadata, filter, entry,
+					       valid);
+		}
+	}
+	free(filter);
+}
+
 /*
  * TODO:
- * - add microbenchmarks
  * - expand NNP testing
  * - better arch-specific TRACE and TRAP handlers.
  * - endianness checking when appropriate
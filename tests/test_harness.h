@@ -34,19 +34,64 @@
  *     EXPECT_EQ(1, is_my_data_good(self->data));
  *   }
  *
+ *   BENCHMARK_F(my_fixture, data_check) {
+ *     BENCHMARK_LOOP("is_my_data_good") {
+ *       is_my_data_good(self->data);
+ *     }
+ *   }
+ *
  *   TEST_HARNESS_MAIN
  *
+ * Running:
+ *   ./my_tests [-j N] [--timeout=SECS] [--global-timeout=SECS]
+ *              [--format=human|json|tap] [--filter=PATTERNS] [--list]
+ *              [--shard-index=I --shard-count=N] [--bench]
+ *   -j N, --jobs=N   Keep up to N test children running at once (0 means one
+ *                    per online CPU).  Output from each test is buffered and
+ *                    printed in declaration order once the test completes.
+ *   --timeout=SECS   Default per-test timeout for tests which do not set their
+ *                    own (0 disables it).  Defaults to TEST_TIMEOUT_DEFAULT.
+ *   --global-timeout=SECS
+ *                    Limit for the whole run.  Tests still running when it
+ *                    expires are killed; later tests are not started.
+ *   --format=FORMAT  Report results as "human" text (the default), "json" or
+ *                    "tap".  The latter two include each test's wall time,
+ *                    user/sys CPU time, max RSS and context switch counts,
+ *                    and carry its captured output.
+ *   --filter=PATTERNS
+ *                    Only run tests whose "fixture.name" matches one of the
+ *                    ':'-separated glob patterns.  Patterns after a '-' are
+ *                    exclusions, as in gtest: --filter='TRACE_*-*.dropped'.
+ *   --list           Print the selected test names and exit.
+ *   --shard-index=I, --shard-count=N
+ *                    Only run the tests in shard I of N.  Tests are assigned
+ *                    by hashing their names, so the split is stable across
+ *                    hosts and builds without any coordination.
+ *   --bench          Run the BENCHMARK()s instead of the tests.  Benchmarks
+ *                    are skipped otherwise.
+ *
+ * A test which exceeds its timeout is killed along with its whole process
+ * group (e.g., any tracer it forked) and reported as TIMEOUT.
+ *
  * API inspired by code.google.com/p/googletest
  */
 #ifndef TEST_HARNESS_H_
 #define TEST_HARNESS_H_
 
 #define _GNU_SOURCE
+#include <errno.h>
+#include <fnmatch.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 /* All exported functionality should be declared through this macro. */
@@ -58,9 +103,10 @@
 
 /* TEST(name) { implementation }
  * Defines a test by name.
- * Names must be unique and tests must not be run in parallel.  The
- * implementation containing block is a function and scoping should be treated
- * as such.  Returning early may be performed with a bare "return;" statement.
+ * Names must be unique.  Each test runs in its own child process, so tests
+ * may be run in parallel with -j.  The implementation containing block is a
+ * function and scoping should be treated as such.  Returning early may be
+ * performed with a bare "return;" statement.
  *
  * EXPECT_* and ASSERT_* are valid in a TEST() { } context.
  */
@@ -68,7 +114,7 @@
 
 /* TEST_SIGNAL(name, signal) { implementation }
  * Defines a test by name and the expected term signal.
- * Names must be unique and tests must not be run in parallel.  The
+ * Names must be unique.  The
  * implementation containing block is a function and scoping should be treated
  * as such.  Returning early may be performed with a bare "return;" statement.
  *
@@ -122,6 +168,74 @@
 
 #define TEST_F_SIGNAL TEST_API(TEST_F_SIGNAL)
 
+/* TEST_TIMEOUT(name, seconds) { implementation }
+ * TEST_F_TIMEOUT(fixture, name, seconds) { implementation }
+ * Like TEST() and TEST_F() but override the default per-test timeout.
+ * The default is TEST_TIMEOUT_DEFAULT seconds, which may itself be overridden
+ * by defining it before including this file.
+ */
+#define TEST_TIMEOUT TEST_API(TEST_TIMEOUT)
+#define TEST_F_TIMEOUT TEST_API(TEST_F_TIMEOUT)
+
+/* BENCHMARK(name) { implementation }
+ * BENCHMARK_F(fixture, name) { implementation }
+ * Define microbenchmarks.  They are registered, selected and run (in their
+ * own child process) exactly like TEST() and TEST_F(), but only when the
+ * harness is run with --bench.  The implementation does any one-off setup
+ * and then measures with one or more BENCHMARK_LOOP()s.  The default timeout
+ * is BENCHMARK_TIMEOUT_DEFAULT seconds.
+ */
+#define BENCHMARK TEST_API(BENCHMARK)
+#define BENCHMARK_F TEST_API(BENCHMARK_F)
+
+/* BENCHMARK_LOOP(label_format, ...) { one iteration }
+ * Runs the body repeatedly and records per-iteration timings under the
+ * printf-style label.  After BENCHMARK_WARMUP_NS of warmup, during which the
+ * batch size is doubled until a batch takes at least BENCHMARK_MIN_SAMPLE_NS,
+ * BENCHMARK_SAMPLES batches are timed.  The min, median, p99, max, mean and
+ * stddev of the per-iteration time of each batch are printed and included
+ * in --format=json and --format=tap results.
+ *
+ * Batches are timed with CLOCK_MONOTONIC, which is a vDSO call on the
+ * architectures we care about and is amortized over the batch.  Code outside
+ * the loop is not timed.
+ */
+#define BENCHMARK_LOOP TEST_API(BENCHMARK_LOOP)
+
+/* BENCHMARK_LATENCY_LOOP(label_format, ...) { one iteration }
+ * Like BENCHMARK_LOOP() but times every iteration on its own, taking
+ * BENCHMARK_LATENCY_SAMPLES samples, so the reported percentiles describe
+ * individual operations.  Each sample includes the cost of reading the clock,
+ * so this is only meaningful for operations well above ~50ns.
+ */
+#define BENCHMARK_LATENCY_LOOP TEST_API(BENCHMARK_LATENCY_LOOP)
+
+/* BENCHMARK_COUNTED_LOOP(samples, label_format, ...) { one iteration }
+ * Like BENCHMARK_LATENCY_LOOP() but runs the body exactly samples + 1 times,
+ * the first as the only warmup.  For operations with lasting side effects,
+ * such as installing a filter, which can't be repeated indefinitely.
+ */
+#define BENCHMARK_COUNTED_LOOP TEST_API(BENCHMARK_COUNTED_LOOP)
+
+/* BENCHMARK_RECORD(samples, count, label_format, ...)
+ * Records |count| per-operation times in nanoseconds which the benchmark
+ * measured itself, e.g. one per child process, and reports them like a
+ * BENCHMARK_LATENCY_LOOP().
+ */
+#define BENCHMARK_RECORD TEST_API(BENCHMARK_RECORD)
+
+/* BENCHMARK_LAST()
+ * Points to the struct __bench_result of the most recently completed loop,
+ * e.g. BENCHMARK_LAST()->median, for deriving further figures.
+ */
+#define BENCHMARK_LAST TEST_API(BENCHMARK_LAST)
+
+/* BENCHMARK_REPORT(value, unit, label_format, ...)
+ * Records a derived figure, such as a throughput or a per-filter cost, which
+ * is printed and reported alongside the timing results.
+ */
+#define BENCHMARK_REPORT TEST_API(BENCHMARK_REPORT)
+
 /* Use once to append a main() to the test file. E.g.,
  *   TEST_HARNESS_MAIN
  */
@@ -200,6 +314,30 @@
 #  define TH_LOG_ENABLED 1
 #endif
 
+#ifndef TEST_TIMEOUT_DEFAULT
+#  define TEST_TIMEOUT_DEFAULT 30
+#endif
+
+#ifndef BENCHMARK_TIMEOUT_DEFAULT
+#  define BENCHMARK_TIMEOUT_DEFAULT 300
+#endif
+
+#ifndef BENCHMARK_WARMUP_NS
+#  define BENCHMARK_WARMUP_NS 50000000LL
+#endif
+
+#ifndef BENCHMARK_MIN_SAMPLE_NS
+#  define BENCHMARK_MIN_SAMPLE_NS 1000000LL
+#endif
+
+#ifndef BENCHMARK_SAMPLES
+#  define BENCHMARK_SAMPLES 100
+#endif
+
+#ifndef BENCHMARK_LATENCY_SAMPLES
+#  define BENCHMARK_LATENCY_SAMPLES 10000
+#endif
+
 #define _TH_LOG(fmt, ...) do { \
   if (TH_LOG_ENABLED) \
     __TH_LOG(fmt, ##__VA_ARGS__); \
@@ -211,14 +349,21 @@
             __FILE__, __LINE__, _metadata->name, ##__VA_ARGS__)
 
 /* Defines the test function and creates the registration stub. */
-#define _TEST(test_name) __TEST_IMPL(test_name, -1)
+#define _TEST(test_name) __TEST_IMPL(test_name, -1, 0, 0)
+
+#define _TEST_SIGNAL(test_name, signal) __TEST_IMPL(test_name, signal, 0, 0)
+
+#define _TEST_TIMEOUT(test_name, seconds) \
+  __TEST_IMPL(test_name, -1, seconds, 0)
 
-#define _TEST_SIGNAL(test_name, signal) __TEST_IMPL(test_name, signal)
+#define _BENCHMARK(test_name) \
+  __TEST_IMPL(test_name, -1, BENCHMARK_TIMEOUT_DEFAULT, 1)
 
-#define __TEST_IMPL(test_name, _signal) \
+#define __TEST_IMPL(test_name, _signal, _timeout, _benchmark) \
   static void test_name(struct __test_metadata *_metadata); \
   static struct __test_metadata _##test_name##_object = \
-    { name: "global." #test_name, fn: &test_name, termsig: _signal }; \
+    { name: "global." #test_name, fn: &test_name, termsig: _signal, \
+      timeout: _timeout, benchmark: _benchmark }; \
   static void __attribute__((constructor)) _register_##test_name(void) { \
     __register_test(&_##test_name##_object); \
   } \
@@ -253,12 +398,18 @@
  * TODO(wad) register fixtures on dedicated test lists.
  */
 #define _TEST_F(fixture_name, test_name) \
-  __TEST_F_IMPL(fixture_name, test_name, -1)
+  __TEST_F_IMPL(fixture_name, test_name, -1, 0, 0)
 
 #define _TEST_F_SIGNAL(fixture_name, test_name, signal) \
-  __TEST_F_IMPL(fixture_name, test_name, signal)
+  __TEST_F_IMPL(fixture_name, test_name, signal, 0, 0)
 
-#define __TEST_F_IMPL(fixture_name, test_name, signal) \
+#define _TEST_F_TIMEOUT(fixture_name, test_name, seconds) \
+  __TEST_F_IMPL(fixture_name, test_name, -1, seconds, 0)
+
+#define _BENCHMARK_F(fixture_name, test_name) \
+  __TEST_F_IMPL(fixture_name, test_name, -1, BENCHMARK_TIMEOUT_DEFAULT, 1)
+
+#define __TEST_F_IMPL(fixture_name, test_name, signal, seconds, bench) \
   static void fixture_name##_##test_name( \
     struct __test_metadata *_metadata, \
     _FIXTURE_DATA(fixture_name) *self); \
@@ -277,6 +428,8 @@
     name: #fixture_name "." #test_name, \
     fn: &wrapper_##fixture_name##_##test_name, \
     termsig: signal, \
+    timeout: seconds, \
+    benchmark: bench, \
    }; \
   static void __attribute__((constructor)) \
       _register_##fixture_name##_##test_name(void) { \
@@ -386,8 +539,18 @@ struct __test_metadata {
   const char *name;
   void (*fn)(struct __test_metadata *);
   int termsig;
+  unsigned int timeout; /* seconds, or 0 for the harness default */
   int passed;
   int trigger; /* extra handler after the evaluation */
+  int benchmark; /* only run with --bench */
+  int selected; /* chosen by --filter and --shard-* to run */
+  pid_t pid; /* running test child, or -1 if it could not be spawned */
+  int status; /* wait status of the test child */
+  FILE *output; /* captured child output, if any */
+  FILE *results; /* struct __bench_result records written by the child */
+  struct timespec start, end; /* wall clock bounds of the test child */
+  struct rusage usage; /* resources used by the test child */
+  unsigned int timed_out; /* the limit which expired, in seconds */
   struct __test_metadata *prev, *next;
 };
 
@@ -437,71 +600,928 @@ static inline int __bail(int for_realz) {
   return 0;
 }
 
-static int test_harness_run(int __attribute__((unused)) argc,
-                            char __attribute__((unused)) **argv) {
+#define _BENCHMARK_LOOP(...) \
+  for (struct __bench_state __bench = \
+         __bench_begin(_metadata, BENCH_BATCHED, BENCHMARK_SAMPLES, \
+                       __VA_ARGS__); \
+       __bench_next(_metadata, &__bench); )
+
+#define _BENCHMARK_LATENCY_LOOP(...) \
+  for (struct __bench_state __bench = \
+         __bench_begin(_metadata, BENCH_LATENCY, BENCHMARK_LATENCY_SAMPLES, \
+                       __VA_ARGS__); \
+       __bench_next(_metadata, &__bench); )
+
+#define _BENCHMARK_COUNTED_LOOP(samples, ...) \
+  for (struct __bench_state __bench = \
+         __bench_begin(_metadata, BENCH_COUNTED, samples, __VA_ARGS__); \
+       __bench_next(_metadata, &__bench); )
+
+#define _BENCHMARK_RECORD(samples, count, ...) \
+  __bench_record(_metadata, samples, count, __VA_ARGS__)
+
+#define _BENCHMARK_LAST() ((const struct __bench_result *)&__bench_last)
+
+#define _BENCHMARK_REPORT(value, unit, ...) \
+  __bench_report(_metadata, value, unit, __VA_ARGS__)
+
+/* Summary of one BENCHMARK_LOOP(), in nanoseconds per iteration, or a
+ * single BENCHMARK_REPORT() figure (in |mean|) if |unit| is set.
+ */
+struct __bench_result {
+  char name[64];
+  char unit[16];
+  unsigned long long batch; /* iterations per sample */
+  unsigned int samples;
+  double min, median, p99, max, mean, stddev;
+};
+
+static struct __bench_result __bench_last;
+
+enum __bench_mode {
+  BENCH_BATCHED,
+  BENCH_LATENCY, /* time every iteration on its own */
+  BENCH_COUNTED, /* ... and only warm up once */
+};
+
+/* Per-loop measurement state; see __bench_next(). */
+struct __bench_state {
+  struct __bench_result result;
+  enum { BENCH_START, BENCH_WARMUP, BENCH_MEASURE } phase;
+  enum __bench_mode mode;
+  unsigned long long remaining; /* iterations left in this batch */
+  long long batch_start, warmup_start;
+  double *samples;
+  unsigned int count;
+};
+
+static inline long long __bench_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline struct __bench_state __attribute__((format(printf, 4, 5)))
+    __bench_begin(struct __test_metadata *_metadata, enum __bench_mode mode,
+                  unsigned int samples, const char *fmt, ...) {
+  struct __bench_state b;
+  va_list ap;
+
+  memset(&b, 0, sizeof(b));
+  va_start(ap, fmt);
+  vsnprintf(b.result.name, sizeof(b.result.name), fmt, ap);
+  va_end(ap);
+  b.mode = mode;
+  b.result.batch = 1;
+  b.result.samples = samples;
+  b.samples = calloc(samples, sizeof(*b.samples));
+  ASSERT_NE(NULL, b.samples);
+  return b;
+}
+
+/* Newton's method, so users of this header need not link libm. */
+static inline double __bench_sqrt(double x) {
+  double r = x;
+  int i;
+
+  if (x <= 0)
+    return 0;
+  for (i = 0; i < 64; i++)
+    r = (r + x / r) / 2;
+  return r;
+}
+
+static inline int __bench_compare(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* Reduces the samples to a result, prints it and hands it to the runner. */
+static inline void __bench_finish(struct __test_metadata *_metadata,
+                           struct __bench_state *b) {
+  struct __bench_result *r = &b->result;
+  unsigned int n = b->count;
+  unsigned int i;
+  double sum = 0, sq = 0;
+
+  qsort(b->samples, n, sizeof(*b->samples), __bench_compare);
+  for (i = 0; i < n; i++)
+    sum += b->samples[i];
+  r->mean = sum / n;
+  for (i = 0; i < n; i++)
+    sq += (b->samples[i] - r->mean) * (b->samples[i] - r->mean);
+  r->stddev = n > 1 ? __bench_sqrt(sq / (n - 1)) : 0;
+  r->min = b->samples[0];
+  r->max = b->samples[n - 1];
+  r->median = n % 2 ? b->samples[n / 2]
+                    : (b->samples[n / 2 - 1] + b->samples[n / 2]) / 2;
+  /* Nearest-rank percentile. */
+  r->p99 = b->samples[(99 * n + 99) / 100 - 1];
+  free(b->samples);
+  b->samples = NULL;
+
+  printf("[ BENCH    ] %s: median %.1f ns, min %.1f, p99 %.1f, stddev %.1f "
+         "(%u x %llu)\n", r->name, r->median, r->min, r->p99, r->stddev,
+         r->samples, r->batch);
+  /* The test may well _exit() before stdio gets around to it. */
+  fflush(stdout);
+  __bench_last = *r;
+  if (_metadata->results)
+    write(fileno(_metadata->results), r, sizeof(*r));
+}
+
+static inline void __attribute__((format(printf, 4, 5)))
+    __bench_report(struct __test_metadata *_metadata, double value,
+                   const char *unit, const char *fmt, ...) {
+  struct __bench_result r;
+  va_list ap;
+
+  memset(&r, 0, sizeof(r));
+  va_start(ap, fmt);
+  vsnprintf(r.name, sizeof(r.name), fmt, ap);
+  va_end(ap);
+  snprintf(r.unit, sizeof(r.unit), "%s", unit);
+  r.samples = 1;
+  r.min = r.median = r.p99 = r.max = r.mean = value;
+  printf("[ BENCH    ] %s: %.1f %s\n", r.name, value, r.unit);
+  fflush(stdout);
+  if (_metadata->results)
+    write(fileno(_metadata->results), &r, sizeof(r));
+}
+
+static inline void __attribute__((format(printf, 4, 5)))
+    __bench_record(struct __test_metadata *_metadata, const double *samples,
+                   unsigned int count, const char *fmt, ...) {
+  struct __bench_state b;
+  va_list ap;
+
+  ASSERT_NE(0, count);
+  memset(&b, 0, sizeof(b));
+  va_start(ap, fmt);
+  vsnprintf(b.result.name, sizeof(b.result.name), fmt, ap);
+  va_end(ap);
+  b.result.batch = 1;
+  b.result.samples = b.count = count;
+  b.samples = calloc(count, sizeof(*b.samples));
+  ASSERT_NE(NULL, b.samples);
+  memcpy(b.samples, samples, count * sizeof(*b.samples));
+  __bench_finish(_metadata, &b);
+}
+
+/* Called at the end of each batch.  Grows the batch until it is long enough
+ * to time accurately, then collects the samples.  Returns 0 once done.
+ */
+static int __attribute__((noinline, unused)) __bench_batch(
+    struct __test_metadata *_metadata, struct __bench_state *b) {
+  long long now = __bench_now();
+  long long elapsed = now - b->batch_start;
+
+  switch (b->phase) {
+  case BENCH_START:
+    b->phase = BENCH_WARMUP;
+    b->warmup_start = now;
+    break;
+  case BENCH_WARMUP:
+    if (b->mode == BENCH_BATCHED && elapsed < BENCHMARK_MIN_SAMPLE_NS &&
+        b->result.batch < (1ULL << 40))
+      b->result.batch *= 2;
+    else if (b->mode == BENCH_COUNTED ||
+             now - b->warmup_start >= BENCHMARK_WARMUP_NS)
+      b->phase = BENCH_MEASURE;
+    break;
+  case BENCH_MEASURE:
+    b->samples[b->count++] = (double)elapsed / b->result.batch;
+    if (b->count == b->result.samples) {
+      __bench_finish(_metadata, b);
+      return 0;
+    }
+    break;
+  }
+  b->remaining = b->result.batch - 1;
+  b->batch_start = __bench_now();
+  return 1;
+}
+
+static inline int __bench_next(struct __test_metadata *_metadata,
+                               struct __bench_state *b) {
+  if (b->remaining) {
+    b->remaining--;
+    return 1;
+  }
+  return __bench_batch(_metadata, b);
+}
+
+/* Number of test children which may be in flight at once. */
+static unsigned int __test_jobs = 1;
+/* Default per-test and whole-run timeouts in seconds (0 for none). */
+static unsigned int __test_timeout = TEST_TIMEOUT_DEFAULT;
+static unsigned int __test_global_timeout = 0;
+/* Output format selected with --format. */
+enum {
+  TEST_FORMAT_HUMAN,
+  TEST_FORMAT_JSON,
+  TEST_FORMAT_TAP,
+};
+static int __test_format = TEST_FORMAT_HUMAN;
+/* Test selection from --filter, --list and --shard-*. */
+static const char *__test_filter = NULL;
+static int __test_list_only = 0;
+static long __test_shard_index = -1;
+static long __test_shard_count = -1;
+static int __test_bench = 0;
+/* Set once the global timeout has expired. */
+static int __test_expired = 0;
+static struct timespec __test_run_start;
+
+static void __test_usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [-j N] [--timeout=SECS] [--global-timeout=SECS]\n"
+          "          [--format=human|json|tap] [--filter=PATTERNS] [--list]\n"
+          "          [--shard-index=I --shard-count=N] [--bench]\n"
+          "  -j N, --jobs=N         run up to N tests at once "
+          "(0: one per CPU)\n"
+          "  --timeout=SECS         default per-test timeout "
+          "(0: none, default: %u)\n"
+          "  --global-timeout=SECS  timeout for the whole run (0: none)\n"
+          "  --format=FORMAT        report results as human-readable text,\n"
+          "                         JSON or TAP, with per-test timing and\n"
+          "                         resource usage for the latter two\n"
+          "  --filter=PATTERNS      run tests matching ':'-separated globs,\n"
+          "                         except those matching globs after '-'\n"
+          "  --list                 list the selected tests and exit\n"
+          "  --shard-index=I        run only shard I (from 0) ...\n"
+          "  --shard-count=N        ... of N, split by test name hash\n"
+          "  --bench                run the benchmarks instead of the tests\n",
+          argv0, TEST_TIMEOUT_DEFAULT);
+}
+
+/* Parses a non-negative decimal option argument into |val|. */
+static int __test_parse_uint(const char *argv0, const char *what,
+                             const char *arg, unsigned int *val) {
+  char *end;
+  long parsed;
+
+  errno = 0;
+  parsed = strtol(arg, &end, 10);
+  if (*arg == '\0' || *end != '\0' || parsed < 0 || errno) {
+    fprintf(stderr, "%s: invalid %s '%s'\n", argv0, what, arg);
+    return -1;
+  }
+  *val = parsed;
+  return 0;
+}
+
+static int __test_parse_args(int argc, char **argv) {
+  enum {
+    OPT_TIMEOUT = 0x100,
+    OPT_GLOBAL_TIMEOUT,
+    OPT_FORMAT,
+    OPT_FILTER,
+    OPT_LIST,
+    OPT_SHARD_INDEX,
+    OPT_SHARD_COUNT,
+    OPT_BENCH,
+  };
+  static const struct option opts[] = {
+    { "jobs", required_argument, NULL, 'j' },
+    { "timeout", required_argument, NULL, OPT_TIMEOUT },
+    { "global-timeout", required_argument, NULL, OPT_GLOBAL_TIMEOUT },
+    { "format", required_argument, NULL, OPT_FORMAT },
+    { "filter", required_argument, NULL, OPT_FILTER },
+    { "list", no_argument, NULL, OPT_LIST },
+    { "shard-index", required_argument, NULL, OPT_SHARD_INDEX },
+    { "shard-count", required_argument, NULL, OPT_SHARD_COUNT },
+    { "bench", no_argument, NULL, OPT_BENCH },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+  };
+  unsigned int shard;
+  int opt;
+
+  while ((opt = getopt_long(argc, argv, "j:h", opts, NULL)) != -1) {
+    switch (opt) {
+    case 'j':
+      if (__test_parse_uint(argv[0], "job count", optarg, &__test_jobs))
+        return -1;
+      if (__test_jobs == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        __test_jobs = cpus > 0 ? cpus : 1;
+      }
+      break;
+    case OPT_TIMEOUT:
+      if (__test_parse_uint(argv[0], "timeout", optarg, &__test_timeout))
+        return -1;
+      break;
+    case OPT_GLOBAL_TIMEOUT:
+      if (__test_parse_uint(argv[0], "timeout", optarg,
+                            &__test_global_timeout))
+        return -1;
+      break;
+    case OPT_FORMAT:
+      if (!strcmp(optarg, "human")) {
+        __test_format = TEST_FORMAT_HUMAN;
+      } else if (!strcmp(optarg, "json")) {
+        __test_format = TEST_FORMAT_JSON;
+      } else if (!strcmp(optarg, "tap")) {
+        __test_format = TEST_FORMAT_TAP;
+      } else {
+        fprintf(stderr, "%s: unknown format '%s'\n", argv[0], optarg);
+        return -1;
+      }
+      break;
+    case OPT_FILTER:
+      __test_filter = optarg;
+      break;
+    case OPT_LIST:
+      __test_list_only = 1;
+      break;
+    case OPT_SHARD_INDEX:
+      if (__test_parse_uint(argv[0], "shard index", optarg, &shard))
+        return -1;
+      __test_shard_index = shard;
+      break;
+    case OPT_SHARD_COUNT:
+      if (__test_parse_uint(argv[0], "shard count", optarg, &shard))
+        return -1;
+      __test_shard_count = shard;
+      break;
+    case OPT_BENCH:
+      __test_bench = 1;
+      break;
+    case 'h':
+    default:
+      __test_usage(argv[0]);
+      return -1;
+    }
+  }
+  if (optind < argc) {
+    __test_usage(argv[0]);
+    return -1;
+  }
+  if ((__test_shard_index < 0) != (__test_shard_count < 0) ||
+      __test_shard_count == 0 ||
+      (__test_shard_count > 0 && __test_shard_index >= __test_shard_count)) {
+    fprintf(stderr, "%s: --shard-index must be less than --shard-count\n",
+            argv[0]);
+    return -1;
+  }
+  return 0;
+}
+
+/* Returns non-zero if |name| matches any of the ':'-separated globs in
+ * [patterns, end).
+ */
+static int __test_match_any(const char *name, const char *patterns,
+                            const char *end) {
+  char pattern[256];
+
+  while (patterns < end) {
+    const char *sep = memchr(patterns, ':', end - patterns);
+    size_t len = (sep ? sep : end) - patterns;
+    if (len < sizeof(pattern)) {
+      memcpy(pattern, patterns, len);
+      pattern[len] = '\0';
+      if (!fnmatch(pattern, name, 0))
+        return 1;
+    }
+    patterns += len + 1;
+  }
+  return 0;
+}
+
+/* 32-bit FNV-1a, used to shard tests by name. */
+static unsigned int __test_hash(const char *name) {
+  unsigned int hash = 2166136261U;
+
+  while (*name) {
+    hash ^= (unsigned char)*name++;
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+/* Marks the tests picked by --filter and --shard-* and returns how many. */
+static unsigned int __test_select(void) {
   struct __test_metadata *t;
-  int ret = 0;
-  unsigned int count = 0;
-  unsigned int pass_count = 0;
+  unsigned int selected = 0;
 
-  /* TODO(wad) add optional arguments similar to gtest. */
-  printf("[==========] Running %u tests from %u test cases.\n",
-          __test_count, __fixture_count + 1);
   for (t = __test_list; t; t = t->next) {
-    pid_t child_pid;
-    int status;
-    count++;
-    t->passed = 1;
-    t->trigger = 0;
-    printf("[ RUN      ] %s\n", t->name);
-    child_pid = fork();
-    if (child_pid < 0) {
-      printf("ERROR SPAWNING TEST CHILD\n");
-      t->passed = 0;
-    } else if (child_pid == 0) {
-      t->fn(t);
-      _exit(t->passed);
+    t->selected = t->benchmark == __test_bench;
+    if (__test_filter) {
+      const char *neg = strchr(__test_filter, '-');
+      const char *end = neg ? neg : __test_filter + strlen(__test_filter);
+      /* An empty positive part means everything, as in gtest. */
+      if (end != __test_filter &&
+          !__test_match_any(t->name, __test_filter, end))
+        t->selected = 0;
+      if (neg && __test_match_any(t->name, neg + 1, neg + strlen(neg)))
+        t->selected = 0;
+    }
+    if (__test_shard_count > 0 &&
+        __test_hash(t->name) % __test_shard_count != __test_shard_index)
+      t->selected = 0;
+    selected += t->selected;
+  }
+  return selected;
+}
+
+/* Returns the first selected test at or after |t|. */
+static struct __test_metadata *__test_next_selected(
+    struct __test_metadata *t) {
+  while (t && !t->selected)
+    t = t->next;
+  return t;
+}
+
+/* Forks the child for |t|.  When |capture| is set, the child's stdout and
+ * stderr are redirected to a temporary file which __test_print() replays
+ * once the test has completed.
+ */
+static void __test_start(struct __test_metadata *t, int capture) {
+  t->passed = 1;
+  t->trigger = 0;
+  t->status = 0;
+  t->timed_out = 0;
+  memset(&t->usage, 0, sizeof(t->usage));
+  t->output = capture ? tmpfile() : NULL;
+  t->results = t->benchmark ? tmpfile() : NULL;
+  /* Don't let pending harness output get duplicated into the child. */
+  fflush(stdout);
+  fflush(TH_LOG_STREAM);
+  clock_gettime(CLOCK_MONOTONIC, &t->start);
+  t->end = t->start;
+  t->pid = fork();
+  if (t->pid < 0) {
+    t->passed = 0;
+  } else if (t->pid == 0) {
+    /* Lead a process group so a timeout can take out any helpers too. */
+    setpgid(0, 0);
+    signal(SIGALRM, SIG_DFL);
+    if (t->output) {
+      dup2(fileno(t->output), STDOUT_FILENO);
+      dup2(fileno(t->output), STDERR_FILENO);
+      /* Tests may _exit() at any point, so never hold output back. */
+      setvbuf(stdout, NULL, _IONBF, 0);
+    }
+    t->fn(t);
+    _exit(t->passed);
+  } else {
+    /* Also set it here so the parent can't race the child's setpgid(). */
+    setpgid(t->pid, t->pid);
+  }
+}
+
+static inline long long __test_elapsed_ns(const struct timespec *from,
+                                          const struct timespec *to) {
+  return (to->tv_sec - from->tv_sec) * 1000000000LL +
+         (to->tv_nsec - from->tv_nsec);
+}
+
+static unsigned int __test_timeout_of(const struct __test_metadata *t) {
+  return t->timeout ? t->timeout : __test_timeout;
+}
+
+static void __test_alarm(int sig) {
+  /* Only here to interrupt waitpid(). */
+}
+
+/* Kills every running test whose deadline has passed and arms the interval
+ * timer for the next one.  The timer repeats so a signal which lands just
+ * before waitpid() blocks is only late, not lost.
+ */
+static void __test_check_timeouts(void) {
+  struct __test_metadata *t;
+  struct timespec now;
+  struct itimerval timer;
+  long long next = -1;
+  long long left;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (__test_global_timeout && !__test_expired) {
+    left = __test_global_timeout * 1000000000LL -
+           __test_elapsed_ns(&__test_run_start, &now);
+    if (left <= 0)
+      __test_expired = 1;
+    else
+      next = left;
+  }
+  for (t = __test_list; t; t = t->next) {
+    if (t->pid <= 0 || t->timed_out)
+      continue;
+    if (__test_expired) {
+      left = 0;
+    } else if (__test_timeout_of(t)) {
+      left = __test_timeout_of(t) * 1000000000LL -
+             __test_elapsed_ns(&t->start, &now);
     } else {
-      /* TODO(wad) add timeout support. */
-      waitpid(child_pid, &status, 0);
-      if (WIFEXITED(status)) {
-        t->passed = t->termsig == -1 ? WEXITSTATUS(status) : 0;
-        if (t->termsig != -1) {
-         fprintf(TH_LOG_STREAM,
-                  "%s: Test exited normally instead of by signal (code: %d)\n",
-                 t->name,
-                 WEXITSTATUS(status));
-        }
-      } else if (WIFSIGNALED(status)) {
-        t->passed = 0;
-        if (WTERMSIG(status) == SIGABRT) {
-          fprintf(TH_LOG_STREAM,
-                  "%s: Test terminated by assertion\n",
-                 t->name);
-        } else if (WTERMSIG(status) == t->termsig) {
-          t->passed = 1;
-        } else {
-          fprintf(TH_LOG_STREAM,
-                  "%s: Test terminated unexpectedly by signal %d\n",
-                 t->name,
-                 WTERMSIG(status));
-        }
-      } else {
-          fprintf(TH_LOG_STREAM,
-                  "%s: Test ended in some other way [%u]\n",
-                 t->name,
-                 status);
+      continue;
+    }
+    if (left <= 0) {
+      t->timed_out = __test_expired ? __test_global_timeout
+                                    : __test_timeout_of(t);
+      kill(-t->pid, SIGKILL);
+      kill(t->pid, SIGKILL);
+    } else if (next < 0 || left < next) {
+      next = left;
+    }
+  }
+
+  memset(&timer, 0, sizeof(timer));
+  if (next >= 0) {
+    /* Round up so we never wake just short of a deadline. */
+    next = next / 1000 + 1;
+    timer.it_value.tv_sec = next / 1000000;
+    timer.it_value.tv_usec = next % 1000000;
+    timer.it_interval.tv_usec = 10000;
+  }
+  setitimer(ITIMER_REAL, &timer, NULL);
+}
+
+/* Waits for any running test child and records its status.  Returns the
+ * test that finished, or NULL if there was nothing left to wait for.
+ */
+static struct __test_metadata *__test_reap(void) {
+  struct __test_metadata *t;
+  struct rusage usage;
+  pid_t pid;
+  int status;
+
+  for (;;) {
+    __test_check_timeouts();
+    pid = wait4(-1, &status, 0, &usage);
+    if (pid < 0) {
+      if (errno == EINTR)
+        continue;
+      return NULL;
+    }
+    for (t = __test_list; t; t = t->next) {
+      if (t->pid == pid) {
+        clock_gettime(CLOCK_MONOTONIC, &t->end);
+        t->pid = 0;
+        t->status = status;
+        t->usage = usage;
+        return t;
       }
     }
-    printf("[     %4s ] %s\n", (t->passed ? "OK" : "FAIL"), t->name);
-    if (t->passed)
-      pass_count++;
+  }
+}
+
+/* Interprets the exit status of a finished test, setting t->passed and
+ * logging why it failed, if it did, to |log|.
+ */
+static void __test_evaluate(struct __test_metadata *t, FILE *log) {
+  int status = t->status;
+
+  if (t->pid < 0) {
+    fprintf(log, "%s: Error spawning test child\n", t->name);
+  } else if (t->timed_out) {
+    t->passed = 0;
+    fprintf(log,
+            "%s: Test timed out after %.3fs (limit %us)\n",
+            t->name,
+            __test_elapsed_ns(&t->start, &t->end) / 1e9,
+            t->timed_out);
+  } else if (WIFEXITED(status)) {
+    t->passed = t->termsig == -1 ? WEXITSTATUS(status) : 0;
+    if (t->termsig != -1) {
+     fprintf(log,
+              "%s: Test exited normally instead of by signal (code: %d)\n",
+             t->name,
+             WEXITSTATUS(status));
+    }
+  } else if (WIFSIGNALED(status)) {
+    t->passed = 0;
+    if (WTERMSIG(status) == SIGABRT) {
+      fprintf(log,
+              "%s: Test terminated by assertion\n",
+             t->name);
+    } else if (WTERMSIG(status) == t->termsig) {
+      t->passed = 1;
+    } else {
+      fprintf(log,
+              "%s: Test terminated unexpectedly by signal %d\n",
+             t->name,
+             WTERMSIG(status));
+    }
+  } else {
+      fprintf(log,
+              "%s: Test ended in some other way [%u]\n",
+             t->name,
+             status);
+  }
+}
+
+static const char *__test_result(const struct __test_metadata *t, int ran) {
+  if (!ran)
+    return "not run";
+  if (t->passed)
+    return "pass";
+  return t->timed_out ? "timeout" : "fail";
+}
+
+/* Returns the benchmark results recorded by |t| as a malloc()d array. */
+static struct __bench_result *__test_take_results(struct __test_metadata *t,
+                                                  size_t *count) {
+  struct __bench_result *results = NULL;
+  long size;
+
+  *count = 0;
+  if (!t->results)
+    return NULL;
+  if (fseek(t->results, 0, SEEK_END) == 0 &&
+      (size = ftell(t->results)) >= (long)sizeof(*results)) {
+    results = malloc(size);
+    rewind(t->results);
+    if (results)
+      *count = fread(results, sizeof(*results), size / sizeof(*results),
+                     t->results);
+  }
+  fclose(t->results);
+  t->results = NULL;
+  return results;
+}
+
+/* Returns the captured output of |t| as a malloc()d buffer, or NULL. */
+static char *__test_take_output(struct __test_metadata *t, size_t *len) {
+  char *buf = NULL;
+  long size;
+
+  *len = 0;
+  if (!t->output)
+    return NULL;
+  fflush(t->output);
+  if (fseek(t->output, 0, SEEK_END) == 0 && (size = ftell(t->output)) > 0) {
+    buf = malloc(size);
+    rewind(t->output);
+    if (buf)
+      *len = fread(buf, 1, size, t->output);
+  }
+  fclose(t->output);
+  t->output = NULL;
+  return buf;
+}
+
+static void __test_json_string(const char *str, size_t len) {
+  size_t i;
+
+  putchar('"');
+  for (i = 0; i < len; i++) {
+    unsigned char c = str[i];
+    if (c == '"' || c == '\\')
+      printf("\\%c", c);
+    else if (c == '\n')
+      printf("\\n");
+    else if (c == '\t')
+      printf("\\t");
+    else if (c < 0x20 || c == 0x7f)
+      printf("\\u%04x", c);
     else
-      ret = 1;
+      putchar(c);
+  }
+  putchar('"');
+}
+
+static inline long long __test_timeval_us(const struct timeval *tv) {
+  return tv->tv_sec * 1000000LL + tv->tv_usec;
+}
+
+/* Prints the result of test number |n|.  Captured tests print their RUN
+ * banner and buffered output here so that results always appear in
+ * declaration order, and why they failed is added to that output so it
+ * is carried in the JSON and TAP reports too.  |ran| is zero for tests
+ * which were never started.
+ */
+static void __test_print(struct __test_metadata *t, unsigned int n,
+                         int ran, int capture) {
+  const char *result;
+  const struct rusage *ru = &t->usage;
+  long long wall_ns = __test_elapsed_ns(&t->start, &t->end);
+  size_t len, nresults, i;
+  char *output;
+  struct __bench_result *results;
+
+  if (ran) {
+    fflush(stdout);
+    __test_evaluate(t, t->output ? t->output : TH_LOG_STREAM);
+  }
+  output = __test_take_output(t, &len);
+  results = __test_take_results(t, &nresults);
+
+  switch (__test_format) {
+  case TEST_FORMAT_HUMAN:
+    if (!ran)
+      break;
+    if (capture)
+      printf("[ RUN      ] %s\n", t->name);
+    if (output)
+      fwrite(output, 1, len, stdout);
+    printf("[  %7s ] %s\n",
+           (t->passed ? "OK" : t->timed_out ? "TIMEOUT" : "FAIL"), t->name);
+    break;
+  case TEST_FORMAT_TAP: {
+    i = 0;
+    while (i < len) {
+      size_t eol = i;
+      while (eol < len && output[eol] != '\n')
+        eol++;
+      printf("# %.*s\n", (int)(eol - i), output + i);
+      i = eol + 1;
+    }
+    result = __test_result(t, ran);
+    printf("%sok %u %s\n", t->passed && ran ? "" : "not ", n, t->name);
+    printf("  ---\n");
+    printf("  result: %s\n", result);
+    if (ran) {
+      printf("  duration_ms: %.3f\n", wall_ns / 1e6);
+      printf("  user_ms: %.3f\n", __test_timeval_us(&ru->ru_utime) / 1e3);
+      printf("  sys_ms: %.3f\n", __test_timeval_us(&ru->ru_stime) / 1e3);
+      printf("  max_rss_kb: %ld\n", ru->ru_maxrss);
+      printf("  voluntary_ctxt_switches: %ld\n", ru->ru_nvcsw);
+      printf("  involuntary_ctxt_switches: %ld\n", ru->ru_nivcsw);
+    }
+    if (nresults)
+      printf("  benchmarks:\n");
+    for (i = 0; i < nresults; i++) {
+      const struct __bench_result *r = &results[i];
+      printf("    - name: \"%s\"\n", r->name);
+      if (r->unit[0]) {
+        printf("      value: %.3f\n", r->mean);
+        printf("      unit: \"%s\"\n", r->unit);
+        continue;
+      }
+      printf("      samples: %u\n", r->samples);
+      printf("      batch: %llu\n", r->batch);
+      printf("      min_ns: %.3f\n", r->min);
+      printf("      median_ns: %.3f\n", r->median);
+      printf("      p99_ns: %.3f\n", r->p99);
+      printf("      max_ns: %.3f\n", r->max);
+      printf("      mean_ns: %.3f\n", r->mean);
+      printf("      stddev_ns: %.3f\n", r->stddev);
+    }
+    printf("  ...\n");
+    break;
+  }
+  case TEST_FORMAT_JSON:
+    result = __test_result(t, ran);
+    printf("%s    {\n", n > 1 ? ",\n" : "");
+    printf("      \"name\": ");
+    __test_json_string(t->name, strlen(t->name));
+    printf(",\n      \"result\": \"%s\"", result);
+    if (ran) {
+      printf(",\n      \"wall_ns\": %lld", wall_ns);
+      printf(",\n      \"user_us\": %lld", __test_timeval_us(&ru->ru_utime));
+      printf(",\n      \"sys_us\": %lld", __test_timeval_us(&ru->ru_stime));
+      printf(",\n      \"max_rss_kb\": %ld", ru->ru_maxrss);
+      printf(",\n      \"voluntary_ctxt_switches\": %ld", ru->ru_nvcsw);
+      printf(",\n      \"involuntary_ctxt_switches\": %ld", ru->ru_nivcsw);
+      printf(",\n      \"output\": ");
+      __test_json_string(output ? output : "", len);
+    }
+    if (nresults)
+      printf(",\n      \"benchmarks\": [");
+    for (i = 0; i < nresults; i++) {
+      const struct __bench_result *r = &results[i];
+      printf("%s\n        {\"name\": ", i ? "," : "");
+      __test_json_string(r->name, strnlen(r->name, sizeof(r->name)));
+      if (r->unit[0]) {
+        printf(", \"value\": %.3f, \"unit\": ", r->mean);
+        __test_json_string(r->unit, strnlen(r->unit, sizeof(r->unit)));
+        printf("}");
+        continue;
+      }
+      printf(", \"samples\": %u, \"batch\": %llu, ", r->samples, r->batch);
+      printf("\"min_ns\": %.3f, \"median_ns\": %.3f, \"p99_ns\": %.3f, ",
+             r->min, r->median, r->p99);
+      printf("\"max_ns\": %.3f, \"mean_ns\": %.3f, \"stddev_ns\": %.3f}",
+             r->max, r->mean, r->stddev);
+    }
+    if (nresults)
+      printf("\n      ]");
+    printf("\n    }");
+    break;
+  }
+  free(results);
+  free(output);
+}
+
+static int test_harness_run(int argc, char **argv) {
+  struct __test_metadata *t, *next_report;
+  struct sigaction alarm_action;
+  int ret = 0;
+  int capture;
+  int lost = 0;
+  unsigned int count = 0;
+  unsigned int pass_count = 0;
+  unsigned int running = 0;
+  unsigned int selected;
+
+  if (__test_parse_args(argc, argv))
+    return 1;
+  selected = __test_select();
+  if (__test_bench && __test_jobs > 1)
+    fprintf(TH_LOG_STREAM,
+            "Warning: running benchmarks in parallel skews their results\n");
+  if (__test_list_only) {
+    for (t = __test_next_selected(__test_list); t;
+         t = __test_next_selected(t->next))
+      printf("%s\n", t->name);
+    return 0;
+  }
+  /* SIGALRM must interrupt waitpid() so hung tests can be killed. */
+  memset(&alarm_action, 0, sizeof(alarm_action));
+  alarm_action.sa_handler = __test_alarm;
+  sigaction(SIGALRM, &alarm_action, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &__test_run_start);
+  /* Only a single test may own the terminal at a time, and machine-readable
+   * output must not be interleaved with whatever the tests print.
+   */
+  capture = __test_jobs > 1 || __test_format != TEST_FORMAT_HUMAN;
+
+  switch (__test_format) {
+  case TEST_FORMAT_HUMAN:
+    printf("[==========] Running %u tests from %u test cases.\n",
+            selected, __fixture_count + 1);
+    break;
+  case TEST_FORMAT_TAP:
+    printf("TAP version 13\n1..%u\n", selected);
+    break;
+  case TEST_FORMAT_JSON:
+    printf("{\n  \"tests\": [\n");
+    break;
+  }
+  t = next_report = __test_next_selected(__test_list);
+  while (t || running) {
+    if (t && __test_expired && !running) {
+      /* Out of time: leave the rest unstarted. */
+      break;
+    } else if (t && !__test_expired && running < __test_jobs) {
+      if (!capture)
+        printf("[ RUN      ] %s\n", t->name);
+      __test_start(t, capture);
+      if (t->pid > 0)
+        running++;
+      t = __test_next_selected(t->next);
+    } else if (__test_reap()) {
+      running--;
+    } else {
+      /* Children still counted as running, but none left to wait for. */
+      lost = 1;
+      break;
+    }
+    /* Report everything that has finished, in declaration order. */
+    while (next_report && next_report != t && next_report->pid <= 0) {
+      __test_print(next_report, ++count, 1, capture);
+      if (next_report->passed)
+        pass_count++;
+      else
+        ret = 1;
+      next_report = __test_next_selected(next_report->next);
+    }
+  }
+  if (lost) {
+    /* Nothing more will be reaped: report the rest, started or not. */
+    unsigned int skipped = 0;
+    for (t = next_report; t; t = __test_next_selected(t->next)) {
+      skipped++;
+      t->passed = 0;
+      __test_print(t, ++count, 0, capture);
+    }
+    fflush(stdout);
+    fprintf(TH_LOG_STREAM,
+            "Lost track of %u running tests; %u tests were not reported\n",
+            running, skipped);
+    ret = 1;
+  } else if (t) {
+    unsigned int skipped = 0;
+    for (; t; t = __test_next_selected(t->next)) {
+      skipped++;
+      t->passed = 0;
+      __test_print(t, ++count, 0, capture);
+    }
+    fflush(stdout);
+    fprintf(TH_LOG_STREAM,
+            "Global timeout of %us expired; %u tests were not run\n",
+            __test_global_timeout, skipped);
+    ret = 1;
+  }
+  switch (__test_format) {
+  case TEST_FORMAT_HUMAN:
+    /* TODO(wad) organize by fixtures since ordering is not guaranteed now. */
+    printf("[==========] %u / %u tests passed.\n", pass_count, count);
+    printf("[  %s  ]\n", (ret ? "FAILED" : "PASSED"));
+    break;
+  case TEST_FORMAT_TAP:
+    printf("# %u / %u tests passed.\n", pass_count, count);
+    break;
+  case TEST_FORMAT_JSON:
+    printf("\n  ],\n");
+    printf("  \"passed\": %u,\n", pass_count);
+    printf("  \"total\": %u,\n", count);
+    printf("  \"result\": \"%s\"\n}\n", (ret ? "FAILED" : "PASSED"));
+    break;
   }
-  /* TODO(wad) organize by fixtures since ordering is not guaranteed now. */
-  printf("[==========] %u / %u tests passed.\n", pass_count, count);
-  printf("[  %s  ]\n", (ret ? "FAILED" : "PASSED"));
   return ret;
 }
 
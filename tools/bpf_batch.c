@@ -0,0 +1,331 @@
+/* bpf_batch.c
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Runs one seccomp filter over many struct seccomp_data records at once.
+ */
+
+#include "bpf_batch.h"
+
+/* Program counter of lanes which have returned. */
+#define BATCH_DONE 0xffffffffU
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HAVE_BATCH_SIMD 1
+#include <immintrin.h>
+
+/* Records are 64 bytes, so lane n's words start at word 16 * n. */
+#define RECORD_WORDS (sizeof(struct seccomp_data) / sizeof(__u32))
+
+/*
+ * AVX2: 8 lanes.  Masks are vectors of all-ones lanes, and the unsigned
+ * comparisons AVX2 lacks are built from max and a sign flip.
+ */
+#define AVX2 __attribute__((target("avx2")))
+
+typedef __m256i avx2_vec;
+typedef __m256i avx2_mask;
+
+AVX2 static inline avx2_vec avx2_set1(__u32 x)
+{
+	return _mm256_set1_epi32(x);
+}
+
+AVX2 static inline avx2_vec avx2_record_base(void)
+{
+	return _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+				  _mm256_set1_epi32(RECORD_WORDS));
+}
+
+AVX2 static inline avx2_vec avx2_gather(const struct seccomp_data *data,
+					avx2_vec idx)
+{
+	return _mm256_i32gather_epi32((const int *)data, idx, 4);
+}
+
+AVX2 static inline avx2_vec avx2_blend(avx2_mask m, avx2_vec a, avx2_vec b)
+{
+	return _mm256_blendv_epi8(a, b, m);
+}
+
+AVX2 static inline avx2_mask avx2_gt(avx2_vec a, avx2_vec b)
+{
+	const __m256i sign = _mm256_set1_epi32(0x80000000);
+
+	return _mm256_cmpgt_epi32(_mm256_xor_si256(a, sign),
+				  _mm256_xor_si256(b, sign));
+}
+
+AVX2 static inline avx2_mask avx2_ge(avx2_vec a, avx2_vec b)
+{
+	return _mm256_cmpeq_epi32(_mm256_max_epu32(a, b), a);
+}
+
+AVX2 static inline avx2_mask avx2_test(avx2_vec a, avx2_vec b)
+{
+	__m256i zero = _mm256_cmpeq_epi32(_mm256_and_si256(a, b),
+					  _mm256_setzero_si256());
+
+	return _mm256_xor_si256(zero, _mm256_set1_epi32(-1));
+}
+
+AVX2 static inline __u32 avx2_min(avx2_vec v)
+{
+	/* Swap halves, then pairs of lanes, then neighbouring lanes. */
+	v = _mm256_min_epu32(v, _mm256_permute2x128_si256(v, v, 1));
+	v = _mm256_min_epu32(v, _mm256_shuffle_epi32(v, 0x4e));
+	v = _mm256_min_epu32(v, _mm256_shuffle_epi32(v, 0xb1));
+	return _mm256_cvtsi256_si32(v);
+}
+
+AVX2 static inline avx2_vec avx2_div(unsigned int lanes, avx2_vec a,
+				     avx2_vec b)
+{
+	__u32 va[8], vb[8];
+	int i;
+
+	_mm256_storeu_si256((__m256i *)va, a);
+	_mm256_storeu_si256((__m256i *)vb, b);
+	for (i = 0; i < 8; i++)
+		if (lanes & (1U << i))
+			va[i] /= vb[i];
+	return _mm256_loadu_si256((const __m256i *)va);
+}
+
+#define BATCH_FN		batch_avx2
+#define BATCH_TARGET		AVX2
+#define vec_t			avx2_vec
+#define mask_t			avx2_mask
+#define v_set1			avx2_set1
+#define v_record_base		avx2_record_base
+#define v_gather		avx2_gather
+#define v_blend			avx2_blend
+#define v_add			_mm256_add_epi32
+#define v_sub			_mm256_sub_epi32
+#define v_mul			_mm256_mullo_epi32
+#define v_and			_mm256_and_si256
+#define v_or			_mm256_or_si256
+#define v_xor			_mm256_xor_si256
+#define v_sllv			_mm256_sllv_epi32
+#define v_srlv			_mm256_srlv_epi32
+#define v_div			avx2_div
+#define v_min			avx2_min
+#define v_store(_p, _v)		_mm256_storeu_si256((__m256i *)(_p), _v)
+#define m_eq			_mm256_cmpeq_epi32
+#define m_gt			avx2_gt
+#define m_ge			avx2_ge
+#define m_test			avx2_test
+#define m_and			_mm256_and_si256
+#define m_andnot(_a, _b)	_mm256_andnot_si256(_b, _a)
+#define m_bits(_m)		_mm256_movemask_ps(_mm256_castsi256_ps(_m))
+#include "bpf_batch_lanes.h"
+#undef BATCH_FN
+#undef BATCH_TARGET
+#undef vec_t
+#undef mask_t
+#undef v_set1
+#undef v_record_base
+#undef v_gather
+#undef v_blend
+#undef v_add
+#undef v_sub
+#undef v_mul
+#undef v_and
+#undef v_or
+#undef v_xor
+#undef v_sllv
+#undef v_srlv
+#undef v_div
+#undef v_min
+#undef v_store
+#undef m_eq
+#undef m_gt
+#undef m_ge
+#undef m_test
+#undef m_and
+#undef m_andnot
+#undef m_bits
+
+/* AVX-512: 16 lanes, with native unsigned compares and mask registers. */
+#define AVX512 __attribute__((target("avx512f")))
+
+AVX512 static inline __m512i avx512_record_base(void)
+{
+	return _mm512_mullo_epi32(
+		_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+				  8, 9, 10, 11, 12, 13, 14, 15),
+		_mm512_set1_epi32(RECORD_WORDS));
+}
+
+AVX512 static inline __m512i avx512_gather(const struct seccomp_data *data,
+					   __m512i idx)
+{
+	return _mm512_i32gather_epi32(idx, (const void *)data, 4);
+}
+
+AVX512 static inline __m512i avx512_div(unsigned int lanes, __m512i a,
+					__m512i b)
+{
+	__u32 va[16], vb[16];
+	int i;
+
+	_mm512_storeu_si512(va, a);
+	_mm512_storeu_si512(vb, b);
+	for (i = 0; i < 16; i++)
+		if (lanes & (1U << i))
+			va[i] /= vb[i];
+	return _mm512_loadu_si512(va);
+}
+
+#define BATCH_FN		batch_avx512
+#define BATCH_TARGET		AVX512
+#define vec_t			__m512i
+#define mask_t			__mmask16
+#define v_set1(_x)		_mm512_set1_epi32(_x)
+#define v_record_base		avx512_record_base
+#define v_gather		avx512_gather
+#define v_blend(_m, _a, _b)	_mm512_mask_blend_epi32(_m, _a, _b)
+#define v_add			_mm512_add_epi32
+#define v_sub			_mm512_sub_epi32
+#define v_mul			_mm512_mullo_epi32
+#define v_and			_mm512_and_si512
+#define v_or			_mm512_or_si512
+#define v_xor			_mm512_xor_si512
+#define v_sllv			_mm512_sllv_epi32
+#define v_srlv			_mm512_srlv_epi32
+#define v_div			avx512_div
+#define v_min			_mm512_reduce_min_epu32
+#define v_store(_p, _v)		_mm512_storeu_si512(_p, _v)
+#define m_eq(_a, _b)		_mm512_cmpeq_epu32_mask(_a, _b)
+#define m_gt(_a, _b)		_mm512_cmpgt_epu32_mask(_a, _b)
+#define m_ge(_a, _b)		_mm512_cmpge_epu32_mask(_a, _b)
+#define m_test			_mm512_test_epi32_mask
+#define m_and(_a, _b)		((__mmask16)((_a) & (_b)))
+#define m_andnot(_a, _b)	((__mmask16)((_a) & ~(_b)))
+#define m_bits(_m)		((unsigned int)(_m))
+#include "bpf_batch_lanes.h"
+#undef BATCH_FN
+#undef BATCH_TARGET
+#undef vec_t
+#undef mask_t
+#undef v_set1
+#undef v_record_base
+#undef v_gather
+#undef v_blend
+#undef v_add
+#undef v_sub
+#undef v_mul
+#undef v_and
+#undef v_or
+#undef v_xor
+#undef v_sllv
+#undef v_srlv
+#undef v_div
+#undef v_min
+#undef v_store
+#undef m_eq
+#undef m_gt
+#undef m_ge
+#undef m_test
+#undef m_and
+#undef m_andnot
+#undef m_bits
+#endif  /* __x86_64__ && __GNUC__ */
+
+int bpf_batch_isa_supported(enum bpf_batch_isa isa)
+{
+	switch (isa) {
+	case BPF_BATCH_SCALAR:
+		return 1;
+#ifdef HAVE_BATCH_SIMD
+	case BPF_BATCH_AVX2:
+		return __builtin_cpu_supports("avx2");
+	case BPF_BATCH_AVX512:
+		return __builtin_cpu_supports("avx512f");
+#endif
+	default:
+		return 0;
+	}
+}
+
+enum bpf_batch_isa bpf_batch_best_isa(void)
+{
+	enum bpf_batch_isa isa = BPF_BATCH_ISAS;
+
+	while (isa-- > BPF_BATCH_SCALAR)
+		if (bpf_batch_isa_supported(isa))
+			return isa;
+	return BPF_BATCH_SCALAR;
+}
+
+const char *bpf_batch_isa_name(enum bpf_batch_isa isa)
+{
+	static const char * const names[BPF_BATCH_ISAS] = {
+		[BPF_BATCH_SCALAR] = "scalar",
+		[BPF_BATCH_AVX2] = "avx2",
+		[BPF_BATCH_AVX512] = "avx512",
+	};
+
+	if (isa >= BPF_BATCH_ISAS)
+		return NULL;
+	return names[isa];
+}
+
+unsigned int bpf_batch_lanes(enum bpf_batch_isa isa)
+{
+	switch (isa) {
+	case BPF_BATCH_AVX2:
+		return 8;
+	case BPF_BATCH_AVX512:
+		return 16;
+	default:
+		return 1;
+	}
+}
+
+void bpf_run_batch(const struct sock_filter *filter,
+		   const struct seccomp_data *data, size_t count,
+		   __u32 *ret, unsigned int *steps, enum bpf_batch_isa isa)
+{
+	size_t i = 0;
+
+	if (!bpf_batch_isa_supported(isa))
+		isa = BPF_BATCH_SCALAR;
+#ifdef HAVE_BATCH_SIMD
+	if (isa == BPF_BATCH_AVX512)
+		for (; i + 16 <= count; i += 16)
+			batch_avx512(filter, &data[i], &ret[i],
+				     steps ? &steps[i] : NULL);
+	else if (isa == BPF_BATCH_AVX2)
+		for (; i + 8 <= count; i += 8)
+			batch_avx2(filter, &data[i], &ret[i],
+				   steps ? &steps[i] : NULL);
+#endif
+	for (; i < count; i++)
+		ret[i] = bpf_run(filter, &data[i], steps ? &steps[i] : NULL);
+}
+
+size_t bpf_batch_verify(const struct sock_filter *filter,
+			const struct seccomp_data *data, size_t count,
+			enum bpf_batch_isa isa)
+{
+	__u32 ret[16];
+	unsigned int steps[16];
+	size_t i, j;
+
+	/* In chunks of the widest batch, so no allocation is needed. */
+	for (i = 0; i < count; i += 16) {
+		size_t n = count - i < 16 ? count - i : 16;
+
+		bpf_run_batch(filter, &data[i], n, ret, steps, isa);
+		for (j = 0; j < n; j++) {
+			unsigned int want_steps;
+			__u32 want = bpf_run(filter, &data[i + j], &want_steps);
+
+			if (ret[j] != want || steps[j] != want_steps)
+				return i + j;
+		}
+	}
+	return count;
+}
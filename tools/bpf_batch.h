@@ -0,0 +1,54 @@
+/* bpf_batch.h
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Runs one seccomp filter over many struct seccomp_data records at once.
+ *
+ * The vector paths keep a program counter per lane and walk the filter in
+ * lockstep: every instruction runs for the lanes sitting on it, masked so
+ * that lanes which jumped elsewhere are left alone.  Jumps only go forward,
+ * so after a branch the walk resumes at the lowest program counter of any
+ * lane and each instruction is visited at most once per batch.  Results are
+ * the same as bpf_run()'s, record for record.
+ */
+#ifndef BPF_BATCH_H
+#define BPF_BATCH_H
+
+#include <stddef.h>
+
+#include "bpf_interp.h"
+
+enum bpf_batch_isa {
+	BPF_BATCH_SCALAR,	/* bpf_run() per record */
+	BPF_BATCH_AVX2,		/* 8 lanes */
+	BPF_BATCH_AVX512,	/* 16 lanes */
+	BPF_BATCH_ISAS
+};
+
+/* The widest instruction set this CPU and build support. */
+enum bpf_batch_isa bpf_batch_best_isa(void);
+int bpf_batch_isa_supported(enum bpf_batch_isa isa);
+const char *bpf_batch_isa_name(enum bpf_batch_isa isa);
+unsigned int bpf_batch_lanes(enum bpf_batch_isa isa);
+
+/*
+ * Runs the checked |filter| over |count| records of |data|, storing each
+ * verdict in |ret| and, if |steps| is not NULL, the number of instructions
+ * each run executed.  An unsupported |isa| falls back to the scalar path,
+ * as do the records left over after the last full batch.
+ */
+void bpf_run_batch(const struct sock_filter *filter,
+		   const struct seccomp_data *data, size_t count,
+		   __u32 *ret, unsigned int *steps, enum bpf_batch_isa isa);
+
+/*
+ * Cross-checks bpf_run_batch() against bpf_run() over |count| records.
+ * Returns the index of the first record where the verdict or step count
+ * differs, or |count| if they all agree.
+ */
+size_t bpf_batch_verify(const struct sock_filter *filter,
+			const struct seccomp_data *data, size_t count,
+			enum bpf_batch_isa isa);
+
+#endif  /* BPF_BATCH_H */
@@ -0,0 +1,189 @@
+/* bpf_batch_lanes.h
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * The lockstep evaluator, included by bpf_batch.c once per instruction set
+ * with BATCH_FN, BATCH_TARGET, vec_t, mask_t and the v_ and m_
+ * helpers defined.  Not a standalone header.
+ */
+
+BATCH_TARGET
+static void BATCH_FN(const struct sock_filter *filter,
+		     const struct seccomp_data *data, __u32 *ret,
+		     unsigned int *steps)
+{
+	const vec_t done = v_set1(BATCH_DONE), one = v_set1(1);
+	const vec_t zero = v_set1(0), thirty_one = v_set1(31);
+	vec_t pcv = zero, A = zero, X = zero, R = zero, nsteps = zero;
+	vec_t mem[BPF_MEMWORDS];
+	vec_t base = v_record_base();
+	unsigned int pc = 0;
+
+	while (pc != BATCH_DONE) {
+		const struct sock_filter *insn = &filter[pc];
+		const vec_t k = v_set1(insn->k);
+		mask_t act = m_eq(pcv, v_set1(pc)), c;
+
+		nsteps = v_blend(act, nsteps, v_add(nsteps, one));
+		switch (insn->code) {
+		case BPF_LD|BPF_W|BPF_ABS:
+			A = v_blend(act, A,
+				    v_gather(data, v_add(base,
+						v_set1(insn->k / 4))));
+			break;
+		case BPF_LD|BPF_W|BPF_LEN:
+			A = v_blend(act, A, v_set1(sizeof(*data)));
+			break;
+		case BPF_LDX|BPF_W|BPF_LEN:
+			X = v_blend(act, X, v_set1(sizeof(*data)));
+			break;
+		case BPF_LD|BPF_IMM:
+			A = v_blend(act, A, k);
+			break;
+		case BPF_LDX|BPF_IMM:
+			X = v_blend(act, X, k);
+			break;
+		case BPF_LD|BPF_MEM:
+			A = v_blend(act, A, mem[insn->k]);
+			break;
+		case BPF_LDX|BPF_MEM:
+			X = v_blend(act, X, mem[insn->k]);
+			break;
+		case BPF_ST:
+			mem[insn->k] = v_blend(act, mem[insn->k], A);
+			break;
+		case BPF_STX:
+			mem[insn->k] = v_blend(act, mem[insn->k], X);
+			break;
+		case BPF_MISC|BPF_TAX:
+			X = v_blend(act, X, A);
+			break;
+		case BPF_MISC|BPF_TXA:
+			A = v_blend(act, A, X);
+			break;
+		case BPF_ALU|BPF_ADD|BPF_K:
+			A = v_blend(act, A, v_add(A, k));
+			break;
+		case BPF_ALU|BPF_ADD|BPF_X:
+			A = v_blend(act, A, v_add(A, X));
+			break;
+		case BPF_ALU|BPF_SUB|BPF_K:
+			A = v_blend(act, A, v_sub(A, k));
+			break;
+		case BPF_ALU|BPF_SUB|BPF_X:
+			A = v_blend(act, A, v_sub(A, X));
+			break;
+		case BPF_ALU|BPF_MUL|BPF_K:
+			A = v_blend(act, A, v_mul(A, k));
+			break;
+		case BPF_ALU|BPF_MUL|BPF_X:
+			A = v_blend(act, A, v_mul(A, X));
+			break;
+		case BPF_ALU|BPF_DIV|BPF_K:
+			A = v_div(m_bits(act), A, k);
+			break;
+		case BPF_ALU|BPF_DIV|BPF_X:
+			/* Lanes dividing by zero return 0, i.e. kill. */
+			c = m_and(act, m_eq(X, zero));
+			R = v_blend(c, R, zero);
+			pcv = v_blend(c, pcv, done);
+			act = m_andnot(act, c);
+			A = v_div(m_bits(act), A, X);
+			pcv = v_blend(act, pcv, v_set1(pc + 1));
+			pc = v_min(pcv);
+			continue;
+		case BPF_ALU|BPF_AND|BPF_K:
+			A = v_blend(act, A, v_and(A, k));
+			break;
+		case BPF_ALU|BPF_AND|BPF_X:
+			A = v_blend(act, A, v_and(A, X));
+			break;
+		case BPF_ALU|BPF_OR|BPF_K:
+			A = v_blend(act, A, v_or(A, k));
+			break;
+		case BPF_ALU|BPF_OR|BPF_X:
+			A = v_blend(act, A, v_or(A, X));
+			break;
+		case BPF_ALU|BPF_XOR|BPF_K:
+			A = v_blend(act, A, v_xor(A, k));
+			break;
+		case BPF_ALU|BPF_XOR|BPF_X:
+			A = v_blend(act, A, v_xor(A, X));
+			break;
+		case BPF_ALU|BPF_LSH|BPF_K:
+			A = v_blend(act, A, v_sllv(A, k));
+			break;
+		case BPF_ALU|BPF_LSH|BPF_X:
+			A = v_blend(act, A, v_sllv(A, v_and(X, thirty_one)));
+			break;
+		case BPF_ALU|BPF_RSH|BPF_K:
+			A = v_blend(act, A, v_srlv(A, k));
+			break;
+		case BPF_ALU|BPF_RSH|BPF_X:
+			A = v_blend(act, A, v_srlv(A, v_and(X, thirty_one)));
+			break;
+		case BPF_ALU|BPF_NEG:
+			A = v_blend(act, A, v_sub(zero, A));
+			break;
+		case BPF_JMP|BPF_JA:
+			pcv = v_blend(act, pcv, v_set1(pc + 1 + insn->k));
+			pc = v_min(pcv);
+			continue;
+		case BPF_JMP|BPF_JEQ|BPF_K:
+			c = m_eq(A, k);
+			goto branch;
+		case BPF_JMP|BPF_JEQ|BPF_X:
+			c = m_eq(A, X);
+			goto branch;
+		case BPF_JMP|BPF_JGE|BPF_K:
+			c = m_ge(A, k);
+			goto branch;
+		case BPF_JMP|BPF_JGE|BPF_X:
+			c = m_ge(A, X);
+			goto branch;
+		case BPF_JMP|BPF_JGT|BPF_K:
+			c = m_gt(A, k);
+			goto branch;
+		case BPF_JMP|BPF_JGT|BPF_X:
+			c = m_gt(A, X);
+			goto branch;
+		case BPF_JMP|BPF_JSET|BPF_K:
+			c = m_test(A, k);
+			goto branch;
+		case BPF_JMP|BPF_JSET|BPF_X:
+			c = m_test(A, X);
+			goto branch;
+		case BPF_RET|BPF_K:
+			R = v_blend(act, R, k);
+			pcv = v_blend(act, pcv, done);
+			pc = v_min(pcv);
+			continue;
+		case BPF_RET|BPF_A:
+			R = v_blend(act, R, A);
+			pcv = v_blend(act, pcv, done);
+			pc = v_min(pcv);
+			continue;
+		default:
+			/* Unchecked program; fail closed like bpf_run(). */
+			R = v_blend(act, R, v_set1(SECCOMP_RET_KILL));
+			pcv = v_blend(act, pcv, done);
+			pc = v_min(pcv);
+			continue;
+		}
+		/* Everything else falls through to the next instruction. */
+		pcv = v_blend(act, pcv, v_set1(pc + 1));
+		pc++;
+		continue;
+
+branch:
+		c = m_and(act, c);
+		pcv = v_blend(c, pcv, v_set1(pc + 1 + insn->jt));
+		pcv = v_blend(m_andnot(act, c), pcv,
+			      v_set1(pc + 1 + insn->jf));
+		pc = v_min(pcv);
+	}
+	v_store(ret, R);
+	if (steps)
+		v_store(steps, nsteps);
+}
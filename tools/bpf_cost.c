@@ -0,0 +1,756 @@
+/* bpf_cost.c
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Static path costs of seccomp filters.  See bpf_cost.h.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bpf_cost.h"
+
+#define MAX_OPS 2		/* constant operations kept on nr */
+#define SPLIT_LIMIT 256		/* most numbers an interval is split into */
+#define MAX_STATES (1UL << 20)	/* states walked before giving up */
+
+/* Fields are all 32 bits so that states compare and hash as bytes. */
+struct op {
+	__u32 code;		/* BPF_ALU|op|BPF_K or BPF_ALU|BPF_NEG */
+	__u32 k;
+};
+
+/*
+ * A value: a constant, nr with |nops| constant operations applied in
+ * order, or anything.  Zeroed, it is the constant 0.
+ */
+struct val {
+	__u32 kind;
+	__u32 k;
+	__u32 nops;
+	struct op ops[MAX_OPS];
+};
+
+enum { VAL_CONST, VAL_NR, VAL_ANY };
+
+struct state {
+	__u32 pc;
+	__u32 lo, hi;		/* what nr can still be */
+	struct val A, X, mem[BPF_MEMWORDS];
+};
+
+/* Costs from an instruction to the return, by ranges of nr in order. */
+struct costs {
+	struct bpf_cost_range *r;
+	unsigned int n, cap;
+};
+
+struct memo {
+	struct state key;
+	struct costs costs;
+	int used;
+};
+
+struct walker {
+	const struct sock_filter *filter;
+	const __u32 *arch;
+	unsigned char *joins;	/* instructions reached from two places */
+	struct memo *memo;	/* walked states at joins, open addressed */
+	size_t nmemo, cap;
+	unsigned long states;
+};
+
+static int walk(struct walker *w, const struct state *in, struct costs *out);
+
+static __u32 alu(__u32 code, __u32 a, __u32 k)
+{
+	switch (BPF_OP(code)) {
+	case BPF_ADD:
+		return a + k;
+	case BPF_SUB:
+		return a - k;
+	case BPF_MUL:
+		return a * k;
+	case BPF_DIV:
+		return a / k;
+	case BPF_AND:
+		return a & k;
+	case BPF_OR:
+		return a | k;
+	case BPF_XOR:
+		return a ^ k;
+	case BPF_LSH:
+		return a << (k & 31);
+	case BPF_RSH:
+		return a >> (k & 31);
+	}
+	return -a;
+}
+
+static int taken(__u32 op, __u32 a, __u32 k)
+{
+	switch (op) {
+	case BPF_JEQ:
+		return a == k;
+	case BPF_JGE:
+		return a >= k;
+	case BPF_JGT:
+		return a > k;
+	}
+	return (a & k) != 0;
+}
+
+static struct val constant(__u32 k)
+{
+	struct val v;
+
+	memset(&v, 0, sizeof(v));
+	v.k = k;
+	return v;
+}
+
+static struct val any(void)
+{
+	struct val v = constant(0);
+
+	v.kind = VAL_ANY;
+	return v;
+}
+
+/*
+ * Applies an operation to |v|.  Returns -1, leaving |v| alone, if nr has
+ * as many operations on it as are kept.
+ */
+static int apply(struct val *v, __u32 code, __u32 k)
+{
+	if (v->kind == VAL_CONST) {
+		v->k = alu(code, v->k, k);
+	} else if (v->kind == VAL_NR) {
+		if (v->nops == MAX_OPS)
+			return -1;
+		v->ops[v->nops].code = code;
+		v->ops[v->nops++].k = k;
+	}
+	return 0;
+}
+
+/* Narrows |st| to nr in [lo, hi], where its values become constants. */
+static void narrow(struct state *st, __u32 lo, __u32 hi)
+{
+	struct val *vals[2 + BPF_MEMWORDS];
+	unsigned int i, j;
+
+	st->lo = lo;
+	st->hi = hi;
+	if (lo != hi)
+		return;
+	vals[0] = &st->A;
+	vals[1] = &st->X;
+	for (i = 0; i < BPF_MEMWORDS; i++)
+		vals[2 + i] = &st->mem[i];
+	for (i = 0; i < 2 + BPF_MEMWORDS; i++) {
+		__u32 v = lo;
+
+		if (vals[i]->kind != VAL_NR)
+			continue;
+		for (j = 0; j < vals[i]->nops; j++)
+			v = alu(vals[i]->ops[j].code, v, vals[i]->ops[j].k);
+		*vals[i] = constant(v);
+	}
+}
+
+static int small(const struct state *st)
+{
+	return st->hi - st->lo < SPLIT_LIMIT;
+}
+
+static int add_range(struct costs *c, __u32 lo, __u32 hi, unsigned int min,
+		     unsigned int max)
+{
+	struct bpf_cost_range *r;
+
+	if (c->n && c->r[c->n - 1].hi + 1 == lo &&
+	    c->r[c->n - 1].min == min && c->r[c->n - 1].max == max) {
+		c->r[c->n - 1].hi = hi;
+		return 0;
+	}
+	if (c->n == c->cap) {
+		unsigned int cap = c->cap ? 2 * c->cap : 8;
+
+		r = realloc(c->r, cap * sizeof(*r));
+		if (!r)
+			return -1;
+		c->r = r;
+		c->cap = cap;
+	}
+	r = &c->r[c->n++];
+	r->lo = lo;
+	r->hi = hi;
+	r->min = min;
+	r->max = max;
+	return 0;
+}
+
+static int append(struct costs *out, const struct costs *c)
+{
+	unsigned int i;
+
+	for (i = 0; i < c->n; i++)
+		if (add_range(out, c->r[i].lo, c->r[i].hi, c->r[i].min,
+			      c->r[i].max))
+			return -1;
+	return 0;
+}
+
+static void offset(struct costs *c, unsigned int steps)
+{
+	unsigned int i;
+
+	for (i = 0; i < c->n; i++) {
+		c->r[i].min += steps;
+		c->r[i].max += steps;
+	}
+}
+
+/*
+ * Combines costs over the same numbers into |out|: the two ways of a test,
+ * or if |sum|, two filters which both run.
+ */
+static int combine(const struct costs *a, const struct costs *b, int sum,
+		   struct costs *out)
+{
+	unsigned int i = 0, j = 0;
+	__u32 lo = a->r[0].lo;
+
+	while (i < a->n && j < b->n) {
+		const struct bpf_cost_range *x = &a->r[i], *y = &b->r[j];
+		__u32 hi = x->hi < y->hi ? x->hi : y->hi;
+		unsigned int min, max;
+
+		if (sum) {
+			min = x->min + y->min;
+			max = x->max + y->max;
+		} else {
+			min = x->min < y->min ? x->min : y->min;
+			max = x->max > y->max ? x->max : y->max;
+		}
+		if (add_range(out, lo, hi, min, max))
+			return -1;
+		i += x->hi == hi;
+		j += y->hi == hi;
+		lo = hi + 1;
+	}
+	return 0;
+}
+
+static __u32 hash(const struct state *st)
+{
+	const unsigned char *p = (const unsigned char *)st;
+	__u32 h = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < sizeof(*st); i++)
+		h = (h ^ p[i]) * 16777619U;
+	return h;
+}
+
+/* The slot for |st| in the memo: where it is, or where it would go. */
+static struct memo *slot(const struct walker *w, const struct state *st)
+{
+	size_t i = hash(st) & (w->cap - 1);
+
+	while (w->memo[i].used && memcmp(&w->memo[i].key, st, sizeof(*st)))
+		i = (i + 1) & (w->cap - 1);
+	return &w->memo[i];
+}
+
+static int remember(struct walker *w, const struct state *st,
+		    const struct costs *c)
+{
+	struct memo *m;
+
+	if (2 * (w->nmemo + 1) > w->cap) {
+		struct memo *old = w->memo;
+		size_t i, cap = w->cap;
+
+		w->cap = cap ? 2 * cap : 64;
+		w->memo = calloc(w->cap, sizeof(*w->memo));
+		if (!w->memo) {
+			w->memo = old;
+			w->cap = cap;
+			return -1;
+		}
+		for (i = 0; i < cap; i++)
+			if (old[i].used)
+				*slot(w, &old[i].key) = old[i];
+		free(old);
+	}
+	m = slot(w, st);
+	m->key = *st;
+	memset(&m->costs, 0, sizeof(m->costs));
+	if (append(&m->costs, c))
+		return -1;
+	m->used = 1;
+	w->nmemo++;
+	return 0;
+}
+
+/*
+ * Walks |st| once for each nr it can have, from the instruction which
+ * needed it, |steps| into the path.
+ */
+static int split(struct walker *w, const struct state *st, unsigned int steps,
+		 struct costs *out)
+{
+	struct costs c = { 0 };
+	struct state *one;
+	__u32 nr = st->lo;
+	int ret = 0;
+
+	one = malloc(sizeof(*one));
+	if (!one)
+		return -1;
+	for (;;) {
+		*one = *st;
+		narrow(one, nr, nr);
+		c.n = 0;
+		ret = walk(w, one, &c);
+		if (ret)
+			break;
+		offset(&c, steps);
+		ret = append(out, &c);
+		if (ret || nr++ == st->hi)
+			break;
+	}
+	free(c.r);
+	free(one);
+	return ret;
+}
+
+/* Copies |base| into |out| with the numbers of |part| taken from it. */
+static int patch(const struct costs *base, const struct costs *part,
+		 struct costs *out)
+{
+	__u32 lo = part->r[0].lo, hi = part->r[part->n - 1].hi;
+	unsigned int i;
+
+	for (i = 0; i < base->n && base->r[i].lo < lo; i++)
+		if (add_range(out, base->r[i].lo,
+			      base->r[i].hi < lo ? base->r[i].hi : lo - 1,
+			      base->r[i].min, base->r[i].max))
+			return -1;
+	if (append(out, part))
+		return -1;
+	for (i = 0; i < base->n; i++)
+		if (base->r[i].hi > hi &&
+		    add_range(out, base->r[i].lo > hi ? base->r[i].lo : hi + 1,
+			      base->r[i].hi, base->r[i].min, base->r[i].max))
+			return -1;
+	return 0;
+}
+
+/* Walks from |pc| with nr in [lo, hi], |steps| into the path. */
+static int follow_to(struct walker *w, const struct state *st, __u32 pc,
+		     __u32 lo, __u32 hi, unsigned int steps,
+		     struct costs *out)
+{
+	struct costs c = { 0 };
+	struct state *next;
+	int ret;
+
+	next = malloc(sizeof(*next));
+	if (!next)
+		return -1;
+	*next = *st;
+	next->pc = pc;
+	narrow(next, lo, hi);
+	ret = walk(w, next, &c);
+	if (!ret) {
+		offset(&c, steps);
+		ret = append(out, &c);
+	}
+	free(c.r);
+	free(next);
+	return ret;
+}
+
+/* Follows both |jt| and |jf| for all of |st|'s numbers. */
+static int both_ways(struct walker *w, const struct state *st, __u32 jt,
+		     __u32 jf, unsigned int steps, struct costs *out)
+{
+	struct costs t = { 0 }, f = { 0 };
+	int ret;
+
+	ret = follow_to(w, st, jt, st->lo, st->hi, steps, &t) ||
+	      follow_to(w, st, jf, st->lo, st->hi, steps, &f) ||
+	      combine(&t, &f, 0, out);
+	free(t.r);
+	free(f.r);
+	return ret ? -1 : 0;
+}
+
+/* A division by an X which may be 0: it returns there, or goes on. */
+static int divide_any(struct walker *w, struct state *st, unsigned int steps,
+		      struct costs *out)
+{
+	struct costs here = { 0 }, on = { 0 };
+	int ret;
+
+	st->A = any();
+	ret = add_range(&here, st->lo, st->hi, steps + 1, steps + 1) ||
+	      follow_to(w, st, st->pc + 1, st->lo, st->hi, steps + 1, &on) ||
+	      combine(&here, &on, 0, out);
+	free(here.r);
+	free(on.r);
+	return ret ? -1 : 0;
+}
+
+/*
+ * Takes the jump |insn| at |steps| into the path: by the numbers it is
+ * taken for where it tests nr itself, for every number where it tests what
+ * was computed from nr in a small interval, and otherwise both ways.
+ */
+static int branch(struct walker *w, const struct state *st,
+		  const struct sock_filter *insn, unsigned int steps,
+		  struct costs *out)
+{
+	__u32 op = BPF_OP(insn->code);
+	__u32 jt = st->pc + 1 + insn->jt, jf = st->pc + 1 + insn->jf;
+	struct val a = st->A, b;
+	__u64 lo = st->lo, hi = st->hi, tlo, thi, k;
+	int reversed;
+
+	b = BPF_SRC(insn->code) == BPF_X ? st->X : constant(insn->k);
+	steps++;
+	if (jt == jf)
+		return follow_to(w, st, jt, lo, hi, steps, out);
+	if (a.kind == VAL_CONST && b.kind == VAL_CONST)
+		return follow_to(w, st, taken(op, a.k, b.k) ? jt : jf, lo, hi,
+				 steps, out);
+	if (a.kind == VAL_ANY || b.kind == VAL_ANY)
+		return both_ways(w, st, jt, jf, steps, out);
+	if (op == BPF_JSET || (a.kind == VAL_NR && a.nops) ||
+	    (b.kind == VAL_NR && b.nops) || a.kind == b.kind) {
+		if (small(st))
+			return split(w, st, steps - 1, out);
+		return both_ways(w, st, jt, jf, steps, out);
+	}
+
+	/* nr itself against a constant: taken for nr in [tlo, thi]. */
+	reversed = b.kind == VAL_NR;
+	k = reversed ? a.k : b.k;
+	tlo = 0;
+	thi = 0xffffffffULL;
+	if (op == BPF_JEQ)
+		tlo = thi = k;
+	else if (!reversed)
+		tlo = k + (op == BPF_JGT);
+	else if (op == BPF_JGT)
+		thi = k - 1;	/* k > nr, none if k is 0 */
+	else
+		thi = k;
+	if (thi + 1 == 0 || tlo > thi) {
+		tlo = 1ULL << 32;	/* never taken */
+		thi = tlo - 1;
+	}
+
+	/*
+	 * Not taken either side of where it is taken: both sides are walked
+	 * as one, with the numbers inside patched in after, or a chain of
+	 * BPF_JEQ would walk its tail once for every gap between its numbers.
+	 * The numbers inside would only add paths the others don't take.
+	 */
+	if (lo < tlo && thi < hi) {
+		struct costs around = { 0 }, inside = { 0 };
+		int ret;
+
+		ret = follow_to(w, st, jf, lo, hi, steps, &around) ||
+		      follow_to(w, st, jt, tlo, thi, steps, &inside) ||
+		      patch(&around, &inside, out);
+		free(around.r);
+		free(inside.r);
+		return ret ? -1 : 0;
+	}
+
+	/* Not taken below, taken inside, and not taken above. */
+	if (lo < tlo && follow_to(w, st, jf, lo, tlo - 1 < hi ? tlo - 1 : hi,
+				  steps, out))
+		return -1;
+	if (tlo <= hi && thi >= lo &&
+	    follow_to(w, st, jt, tlo > lo ? tlo : lo, thi < hi ? thi : hi,
+		      steps, out))
+		return -1;
+	if (thi < hi &&
+	    follow_to(w, st, jf, thi + 1 > lo ? thi + 1 : lo, hi, steps, out))
+		return -1;
+	return 0;
+}
+
+/* Runs the ALU instruction |insn|.  Returns 1 if nr must be split first. */
+static int run_alu(struct state *st, const struct sock_filter *insn)
+{
+	struct val k = constant(insn->k);
+
+	if (BPF_SRC(insn->code) == BPF_X && BPF_OP(insn->code) != BPF_NEG)
+		k = st->X;
+	if (st->A.kind == VAL_ANY || k.kind == VAL_ANY) {
+		st->A = any();
+		return 0;
+	}
+	if (k.kind == VAL_CONST &&
+	    !apply(&st->A, BPF_ALU|BPF_OP(insn->code)|BPF_K, k.k))
+		return 0;
+	if (small(st))
+		return 1;
+	st->A = any();
+	return 0;
+}
+
+/* Walks on from |st|, which it changes, for the costs from st->pc on. */
+static int follow(struct walker *w, struct state *st, struct costs *out)
+{
+	unsigned int steps;
+	int ret;
+
+	for (steps = 0;; steps++) {
+		const struct sock_filter *insn = &w->filter[st->pc];
+
+		if (steps && w->joins[st->pc]) {
+			ret = walk(w, st, out);
+			offset(out, steps);
+			return ret;
+		}
+		switch (insn->code) {
+		case BPF_LD|BPF_W|BPF_ABS:
+			st->A = any();
+			if (insn->k == offsetof(struct seccomp_data, nr)) {
+				st->A = constant(st->lo);
+				if (st->lo != st->hi) {
+					st->A.kind = VAL_NR;
+					st->A.k = 0;
+				}
+			} else if (insn->k ==
+				   offsetof(struct seccomp_data, arch) &&
+				   w->arch) {
+				st->A = constant(*w->arch);
+			}
+			break;
+		case BPF_LD|BPF_W|BPF_LEN:
+			st->A = constant(sizeof(struct seccomp_data));
+			break;
+		case BPF_LDX|BPF_W|BPF_LEN:
+			st->X = constant(sizeof(struct seccomp_data));
+			break;
+		case BPF_LD|BPF_IMM:
+			st->A = constant(insn->k);
+			break;
+		case BPF_LDX|BPF_IMM:
+			st->X = constant(insn->k);
+			break;
+		case BPF_LD|BPF_MEM:
+			st->A = st->mem[insn->k];
+			break;
+		case BPF_LDX|BPF_MEM:
+			st->X = st->mem[insn->k];
+			break;
+		case BPF_ST:
+			st->mem[insn->k] = st->A;
+			break;
+		case BPF_STX:
+			st->mem[insn->k] = st->X;
+			break;
+		case BPF_MISC|BPF_TAX:
+			st->X = st->A;
+			break;
+		case BPF_MISC|BPF_TXA:
+			st->A = st->X;
+			break;
+		case BPF_JMP|BPF_JA:
+			st->pc += insn->k;
+			break;
+		case BPF_RET|BPF_K:
+		case BPF_RET|BPF_A:
+			return add_range(out, st->lo, st->hi, steps + 1,
+					 steps + 1);
+		case BPF_ALU|BPF_DIV|BPF_X:
+			/* A zero X returns 0 here. */
+			if (st->X.kind == VAL_CONST && !st->X.k)
+				return add_range(out, st->lo, st->hi,
+						 steps + 1, steps + 1);
+			/* Few enough numbers: find the one X is 0 for. */
+			if (st->X.kind == VAL_NR && small(st))
+				return split(w, st, steps, out);
+			if (st->X.kind != VAL_CONST)
+				return divide_any(w, st, steps, out);
+			/* fall through */
+		default:
+			if (BPF_CLASS(insn->code) == BPF_JMP)
+				return branch(w, st, insn, steps, out);
+			if (run_alu(st, insn))
+				return split(w, st, steps, out);
+			break;
+		}
+		st->pc++;
+	}
+}
+
+static int walk(struct walker *w, const struct state *in, struct costs *out)
+{
+	struct state *st;
+	int ret;
+
+	if (w->joins[in->pc] && w->cap) {
+		const struct memo *m = slot(w, in);
+
+		if (m->used)
+			return append(out, &m->costs);
+	}
+	if (++w->states > MAX_STATES) {
+		errno = E2BIG;
+		return -1;
+	}
+	st = malloc(sizeof(*st));
+	if (!st)
+		return -1;
+	*st = *in;
+	ret = follow(w, st, out);
+	free(st);
+	if (!ret && w->joins[in->pc])
+		ret = remember(w, in, out);
+	return ret;
+}
+
+/* Marks the instructions of |prog| which two others lead to. */
+static unsigned char *find_joins(const struct sock_fprog *prog)
+{
+	unsigned char *preds;
+	unsigned int i;
+
+	preds = calloc(prog->len, 1);
+	if (!preds)
+		return NULL;
+	for (i = 0; i < prog->len; i++) {
+		const struct sock_filter *insn = &prog->filter[i];
+		unsigned int t[2], n = 0, j;
+
+		if (BPF_CLASS(insn->code) == BPF_RET)
+			continue;
+		if (insn->code == (BPF_JMP|BPF_JA)) {
+			t[n++] = i + 1 + insn->k;
+		} else if (BPF_CLASS(insn->code) == BPF_JMP) {
+			t[n++] = i + 1 + insn->jt;
+			if (insn->jf != insn->jt)
+				t[n++] = i + 1 + insn->jf;
+		} else {
+			t[n++] = i + 1;
+		}
+		for (j = 0; j < n; j++)
+			if (preds[t[j]] < 2)
+				preds[t[j]]++;
+	}
+	for (i = 0; i < prog->len; i++)
+		preds[i] = preds[i] == 2;
+	return preds;
+}
+
+static int cost_filter(const struct sock_fprog *prog, const __u32 *arch,
+		       struct costs *out, unsigned long *states)
+{
+	struct walker w = { .filter = prog->filter, .arch = arch };
+	struct state st;
+	size_t i;
+	int ret;
+
+	w.joins = find_joins(prog);
+	if (!w.joins)
+		return -1;
+	memset(&st, 0, sizeof(st));
+	st.hi = ~0U;
+	ret = walk(&w, &st, out);
+	*states += w.states;
+	for (i = 0; i < w.cap; i++)
+		free(w.memo[i].costs.r);
+	free(w.memo);
+	free(w.joins);
+	return ret;
+}
+
+unsigned int bpf_converted_len(const struct sock_filter *filter,
+			       unsigned int len)
+{
+	/* Clearing A and X, and keeping the context in a callee-saved one. */
+	unsigned int pc, n = 3;
+
+	for (pc = 0; pc < len; pc++) {
+		const struct sock_filter *insn = &filter[pc];
+		__u32 op = BPF_OP(insn->code);
+
+		switch (BPF_CLASS(insn->code)) {
+		case BPF_RET:
+			/* Moving the verdict into R0, and an exit. */
+			n += 2;
+			break;
+		case BPF_ALU:
+			/* X checked against 0, returning 0 if it is. */
+			if (insn->code == (BPF_ALU|BPF_DIV|BPF_X))
+				n += 4;
+			n++;
+			break;
+		case BPF_JMP:
+			n++;
+			if (op == BPF_JA)
+				break;
+			/* Immediates are signed: k goes through a register. */
+			if (BPF_SRC(insn->code) == BPF_K && (__s32)insn->k < 0)
+				n++;
+			/* A BPF_JA too, unless one way can fall through. */
+			if (insn->jf && (insn->jt || op == BPF_JSET))
+				n++;
+			break;
+		default:
+			n++;
+		}
+	}
+	return n;
+}
+
+int bpf_cost_chain(const struct sock_fprog *chain, unsigned int count,
+		   const __u32 *arch, struct bpf_cost *cost)
+{
+	struct costs total = { 0 };
+	unsigned int i;
+
+	memset(cost, 0, sizeof(*cost));
+	for (i = 0; i < count; i++)
+		if (bpf_check(chain[i].filter, chain[i].len, NULL))
+			return -1;
+	if (add_range(&total, 0, ~0U, 0, 0))
+		return -1;
+	for (i = 0; i < count; i++) {
+		struct costs one = { 0 }, sum = { 0 };
+
+		if (cost_filter(&chain[i], arch, &one, &cost->states) ||
+		    combine(&total, &one, 1, &sum)) {
+			free(one.r);
+			free(sum.r);
+			free(total.r);
+			return -1;
+		}
+		free(one.r);
+		free(total.r);
+		total = sum;
+		cost->classic += chain[i].len;
+		cost->insns += bpf_converted_len(chain[i].filter,
+						 chain[i].len) +
+			       (i + 1 < count ? BPF_FILTER_PENALTY : 0);
+	}
+	for (i = 0; i < total.n; i++)
+		if (total.r[i].max > cost->worst)
+			cost->worst = total.r[i].max;
+	cost->ranges = total.r;
+	cost->count = total.n;
+	return 0;
+}
@@ -0,0 +1,65 @@
+/* bpf_cost.h
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Static cost of seccomp filters: the fewest and most instructions each
+ * syscall number runs through, found without running them.
+ *
+ * Jumps only go forward, so the paths can be walked from the entry.  nr is
+ * followed as an interval of syscall numbers, which tests on it split, and
+ * through constant arithmetic done on it; where a value computed from it
+ * can't be tested that way, as with the shift by nr in a bitmap leaf, the
+ * interval is split into each of its numbers once it is small enough.
+ * Tests on anything else, the arguments, the instruction pointer and arch
+ * unless it is given, are followed both ways.  That is exact for filters
+ * which only look at nr and arch; otherwise a path no arguments can take
+ * may still count, so min and max are bounds.  Paths which meet again in
+ * the same state are walked once.
+ *
+ * Every filter of a chain runs on each syscall, so a chain's cost is the
+ * sum of its filters'.  The kernel limits something else when a filter is
+ * installed: not any path but the programs' lengths, the new one's plus
+ * every other's with a penalty of 4, against MAX_INSNS_PER_PATH.  Those
+ * are the lengths once converted to eBPF, which bpf_converted_len() works
+ * out as bpf_convert_filter() does: a prologue of 3, 2 for each return, 5
+ * for a division by X, and a jump can take up to 3.  Hardened JITs, which
+ * blind constants, make them longer still.
+ */
+#ifndef BPF_COST_H
+#define BPF_COST_H
+
+#include "bpf_interp.h"
+
+#define BPF_MAX_INSNS_PER_PATH 32768	/* (1 << 18) / sizeof(sock_filter) */
+#define BPF_FILTER_PENALTY 4		/* charged per filter installed */
+
+struct bpf_cost_range {
+	__u32 lo, hi;		/* syscall numbers, inclusive */
+	unsigned int min, max;	/* instructions run, as bpf_run() counts */
+};
+
+struct bpf_cost {
+	struct bpf_cost_range *ranges;	/* in order, covering every nr */
+	unsigned int count;
+	unsigned int worst;	/* the largest max */
+	unsigned int insns;	/* checked against BPF_MAX_INSNS_PER_PATH */
+	unsigned int classic;	/* the filters' lengths, as given */
+	unsigned long states;	/* states walked */
+};
+
+/* The length of |len| instructions of |filter| converted to eBPF. */
+unsigned int bpf_converted_len(const struct sock_filter *filter,
+			       unsigned int len);
+
+/*
+ * Works out the cost of the chain |chain| of |count| filters, given in the
+ * order they would be installed, into |cost|, whose ranges must be released
+ * with free().  If |arch| is not NULL, arch is taken to be *|arch|.
+ * Returns 0, or -1 with errno set: EINVAL if a filter fails bpf_check(),
+ * E2BIG if one has too many paths to walk, or ENOMEM.
+ */
+int bpf_cost_chain(const struct sock_fprog *chain, unsigned int count,
+		   const __u32 *arch, struct bpf_cost *cost);
+
+#endif  /* BPF_COST_H */
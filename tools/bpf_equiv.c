@@ -0,0 +1,1034 @@
+/* bpf_equiv.c
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Symbolic comparison of seccomp filter chains.  See bpf_equiv.h.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bpf_equiv.h"
+
+#define WORDS (sizeof(struct seccomp_data) / sizeof(__u32))
+#define MAX_OPS 6		/* constant operations kept on a word */
+#define MAX_EXCLUDED 4		/* values a word may not take */
+#define MAX_PREDS 16		/* tests kept on functions of a word */
+#define SPLIT_LIMIT 256		/* most values a word is split into */
+#define FIND_TRIES 256		/* candidates tried against predicates */
+#define MAX_STATES (1UL << 20)	/* states explored before giving up */
+#define MAX_STACK (1UL << 15)	/* states pending, about 100MB of them */
+
+struct op {
+	__u32 k;
+	__u16 code;		/* BPF_ALU|op|BPF_K or BPF_ALU|BPF_NEG */
+};
+
+/*
+ * A value: a constant, a word of struct seccomp_data with |nops| constant
+ * operations applied in order, or something else.
+ */
+struct sym {
+	enum { SYM_CONST, SYM_WORD, SYM_UNKNOWN } kind;
+	__u32 k;
+	unsigned int word;
+	unsigned int nops;
+	struct op ops[MAX_OPS];
+};
+
+/* What a word can still be on a path. */
+struct range {
+	__u32 lo, hi;
+	__u32 set, clear;	/* bits known to be 1 and 0 */
+	__u32 excluded[MAX_EXCLUDED];
+	unsigned int nexcluded;
+};
+
+/* The outcome of a test on a function of a word. */
+struct pred {
+	struct sym fn;
+	__u16 op;		/* BPF_JEQ, BPF_JGE, BPF_JGT or BPF_JSET */
+	__u32 k;
+	int taken;
+};
+
+struct state {
+	unsigned int side;	/* 0 runs |a|, then 1 runs |b| */
+	unsigned int filter;	/* in the order the kernel runs them */
+	unsigned int pc;
+	struct sym A, X, mem[BPF_MEMWORDS];
+	struct sym ret;		/* the verdict of this side so far */
+	struct sym verdict;	/* that of side 0, once it is done */
+	struct range words[WORDS];
+	struct pred preds[MAX_PREDS];
+	unsigned int npreds;
+	int approx;		/* a test was followed without narrowing */
+};
+
+struct equiv {
+	const struct sock_fprog *chain[2];
+	unsigned int count[2];
+	struct state *stack;
+	size_t nstack, cap;
+	unsigned long pushed;
+	struct seccomp_data *counter;
+	struct bpf_equiv_stats *stats;
+	int different, unknown, nomem, full;
+};
+
+static __u32 alu(__u16 code, __u32 a, __u32 k)
+{
+	switch (BPF_OP(code)) {
+	case BPF_ADD:
+		return a + k;
+	case BPF_SUB:
+		return a - k;
+	case BPF_MUL:
+		return a * k;
+	case BPF_DIV:
+		return a / k;
+	case BPF_AND:
+		return a & k;
+	case BPF_OR:
+		return a | k;
+	case BPF_XOR:
+		return a ^ k;
+	case BPF_LSH:
+		return a << (k & 31);
+	case BPF_RSH:
+		return a >> (k & 31);
+	}
+	return -a;
+}
+
+static int taken(__u16 op, __u32 a, __u32 k)
+{
+	switch (op) {
+	case BPF_JEQ:
+		return a == k;
+	case BPF_JGE:
+		return a >= k;
+	case BPF_JGT:
+		return a > k;
+	}
+	return (a & k) != 0;
+}
+
+static __u32 eval(const struct sym *s, __u32 v)
+{
+	unsigned int i;
+
+	for (i = 0; i < s->nops; i++)
+		v = alu(s->ops[i].code, v, s->ops[i].k);
+	return v;
+}
+
+static struct sym constant(__u32 k)
+{
+	struct sym s = { .kind = SYM_CONST, .k = k };
+
+	return s;
+}
+
+static int same_sym(const struct sym *x, const struct sym *y)
+{
+	unsigned int i;
+
+	if (x->kind != y->kind)
+		return 0;
+	if (x->kind == SYM_CONST)
+		return x->k == y->k;
+	if (x->kind == SYM_UNKNOWN || x->word != y->word ||
+	    x->nops != y->nops)
+		return 0;
+	for (i = 0; i < x->nops; i++)
+		if (x->ops[i].code != y->ops[i].code ||
+		    x->ops[i].k != y->ops[i].k)
+			return 0;
+	return 1;
+}
+
+/* Appends an operation to |s|, which becomes unknown if it is full. */
+static void apply(struct sym *s, __u16 code, __u32 k)
+{
+	if (s->kind == SYM_CONST) {
+		s->k = alu(code, s->k, k);
+	} else if (s->kind == SYM_WORD && s->nops < MAX_OPS) {
+		s->ops[s->nops].code = code;
+		s->ops[s->nops++].k = k;
+	} else {
+		s->kind = SYM_UNKNOWN;
+	}
+}
+
+/*
+ * The smallest v >= |from| with the bits of |set| 1 and of |clear| 0.
+ * Returns 0, or -1 if there is none.
+ */
+static int masked_next(__u32 from, __u32 set, __u32 clear, __u32 *v)
+{
+	__u32 fixed = set | clear, bit;
+	int b, p;
+
+	if (set & clear)
+		return -1;
+	for (b = 31; b >= 0; b--) {
+		bit = 1U << b;
+		if (!(fixed & bit) || (from & bit) == (set & bit))
+			continue;
+		if (!(set & bit)) {
+			/* Too big here: carry into a free 0 above. */
+			for (p = b + 1; p < 32; p++) {
+				bit = 1U << p;
+				if (!(from & bit) && !(fixed & bit))
+					break;
+			}
+			if (p == 32)
+				return -1;
+		}
+		*v = (from & ~(bit | (bit - 1))) | bit | (set & (bit - 1));
+		return 0;
+	}
+	*v = from;
+	return 0;
+}
+
+/* The smallest value |r| allows from |from| on.  Returns 0 or -1. */
+static int first_fit(const struct range *r, __u64 from, __u32 *v)
+{
+	unsigned int i;
+
+again:
+	if (from < r->lo)
+		from = r->lo;
+	if (from > r->hi || masked_next(from, r->set, r->clear, v) ||
+	    *v > r->hi || *v < from)
+		return -1;
+	for (i = 0; i < r->nexcluded; i++) {
+		if (r->excluded[i] == *v) {
+			from = (__u64)*v + 1;
+			goto again;
+		}
+	}
+	return 0;
+}
+
+static int preds_hold(const struct state *st, unsigned int w, __u32 v)
+{
+	unsigned int i;
+
+	for (i = 0; i < st->npreds; i++) {
+		const struct pred *p = &st->preds[i];
+
+		if (p->fn.word == w &&
+		    taken(p->op, eval(&p->fn, v), p->k) != p->taken)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Undoes |s|'s operations on |k| where they can be undone, so a predicate
+ * about them suggests a value.  Returns 0 or -1.
+ */
+static int invert(const struct sym *s, __u32 k, __u32 *v)
+{
+	unsigned int i = s->nops;
+
+	while (i-- > 0) {
+		switch (s->ops[i].code) {
+		case BPF_ALU|BPF_ADD|BPF_K:
+			k -= s->ops[i].k;
+			break;
+		case BPF_ALU|BPF_SUB|BPF_K:
+			k += s->ops[i].k;
+			break;
+		case BPF_ALU|BPF_XOR|BPF_K:
+			k ^= s->ops[i].k;
+			break;
+		case BPF_ALU|BPF_NEG:
+			k = -k;
+			break;
+		default:
+			return -1;
+		}
+	}
+	*v = k;
+	return 0;
+}
+
+/*
+ * Looks for a value of word |w| meeting its range and predicates: the
+ * first few the range allows, what the predicates' constants suggest, and
+ * then values spread over the range.  |seed| varies the spread.
+ */
+static int find_value(const struct state *st, unsigned int w, __u64 seed,
+		      __u32 *v)
+{
+	const struct range *r = &st->words[w];
+	__u64 from = r->lo, span = (__u64)r->hi - r->lo + 1;
+	unsigned int i, j;
+	__u32 c;
+
+	for (i = 0; i < 16; i++) {
+		if (first_fit(r, from, v))
+			break;
+		if (preds_hold(st, w, *v))
+			return 0;
+		from = (__u64)*v + 1;
+	}
+	for (i = 0; i < st->npreds; i++) {
+		const struct pred *p = &st->preds[i];
+
+		if (p->fn.word != w || invert(&p->fn, p->k, &c))
+			continue;
+		for (j = 0; j < 3; j++) {
+			if (!first_fit(r, (__u32)(c + j - 1), v) &&
+			    preds_hold(st, w, *v))
+				return 0;
+		}
+	}
+	for (i = 0; i < FIND_TRIES; i++) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		if (!first_fit(r, r->lo + (seed >> 16) % span, v) &&
+		    preds_hold(st, w, *v))
+			return 0;
+	}
+	return -1;
+}
+
+/*
+ * Whether word |w| can still take a value: 1 if it can, 0 if it cannot,
+ * and -1 if the predicates on it defeated the search.  Few enough values
+ * are all tried, so the answer is exact.
+ */
+static int word_feasible(const struct state *st, unsigned int w)
+{
+	const struct range *r = &st->words[w];
+	unsigned int i;
+	__u64 from;
+	__u32 v;
+
+	if (first_fit(r, 0, &v))
+		return 0;
+	for (i = 0; i < st->npreds; i++)
+		if (st->preds[i].fn.word == w)
+			break;
+	if (i == st->npreds)
+		return 1;
+	if (r->hi - r->lo < SPLIT_LIMIT) {
+		for (from = r->lo; !first_fit(r, from, &v); from = (__u64)v + 1)
+			if (preds_hold(st, w, v))
+				return 1;
+		return 0;
+	}
+	return find_value(st, w, w, &v) ? -1 : 1;
+}
+
+static const struct sock_fprog *filter_of(const struct equiv *e,
+					  const struct state *st)
+{
+	unsigned int count = e->count[st->side];
+
+	return &e->chain[st->side][count - 1 - st->filter];
+}
+
+/*
+ * Pushes a copy of |st|, unless word |w| has no value left on it.  |w| is
+ * -1 if no word was just narrowed.  Past MAX_STATES pushes, or MAX_STACK
+ * pending, the search is given up as full.
+ */
+static void push(struct equiv *e, const struct state *st, int w)
+{
+	int feasible;
+
+	if (e->nomem || e->full)
+		return;
+	feasible = w < 0 ? 1 : word_feasible(st, w);
+	if (!feasible)
+		return;
+	if (e->pushed == MAX_STATES || e->nstack == MAX_STACK) {
+		e->full = 1;
+		return;
+	}
+	if (e->nstack == e->cap) {
+		size_t cap = e->cap ? 2 * e->cap : 64;
+		struct state *stack;
+
+		stack = realloc(e->stack, cap * sizeof(*stack));
+		if (!stack) {
+			e->nomem = 1;
+			return;
+		}
+		e->stack = stack;
+		e->cap = cap;
+	}
+	e->stack[e->nstack] = *st;
+	if (feasible < 0)
+		e->stack[e->nstack].approx = 1;
+	e->nstack++;
+	e->pushed++;
+}
+
+/*
+ * Whether testing |s| against |k| with |op| is already decided by what is
+ * known of its word: 1 if taken, 0 if not, or -1 if it depends on the data.
+ */
+static int decided(const struct state *st, const struct sym *s, __u16 op,
+		   __u32 k)
+{
+	const struct range *r;
+	__u32 m = ~0U;
+	unsigned int i;
+
+	if (s->kind == SYM_CONST)
+		return taken(op, s->k, k);
+	if (s->kind != SYM_WORD)
+		return -1;
+	r = &st->words[s->word];
+	if (s->nops == 1 && s->ops[0].code == (BPF_ALU|BPF_AND|BPF_K))
+		m = s->ops[0].k;
+	else if (s->nops)
+		return -1;
+
+	switch (op) {
+	case BPF_JEQ:
+		if ((k & ~m) || (k & r->clear) || (~k & r->set & m))
+			return 0;
+		if (m != ~0U)
+			return ((r->set | r->clear) & m) == m ? 1 : -1;
+		if (k < r->lo || k > r->hi)
+			return 0;
+		for (i = 0; i < r->nexcluded; i++)
+			if (r->excluded[i] == k)
+				return 0;
+		if (r->lo == r->hi)
+			return 1;
+		break;
+	case BPF_JGE:
+	case BPF_JGT:
+		if (m != ~0U)
+			break;
+		if (r->lo > k || (op == BPF_JGE && r->lo == k))
+			return 1;
+		if (r->hi < k || (op == BPF_JGT && r->hi == k))
+			return 0;
+		break;
+	case BPF_JSET:
+		k &= m;
+		if (r->set & k)
+			return 1;
+		if (!(k & ~r->clear))
+			return 0;
+		break;
+	}
+	return -1;
+}
+
+/* Narrows word |w| of |st| to [lo, hi].  Returns 0 if nothing is left. */
+static int narrow(struct state *st, unsigned int w, __u32 lo, __u32 hi)
+{
+	struct range *r = &st->words[w];
+
+	if (lo > r->lo)
+		r->lo = lo;
+	if (hi < r->hi)
+		r->hi = hi;
+	return word_feasible(st, w) != 0;
+}
+
+/*
+ * Narrows |st| to the data on which word |w|, taken as signed, is below
+ * |bound|, or if |below| is 0, not below it.  Either is one or two
+ * intervals; the first of two is pushed.  Returns 0 if nothing is left.
+ */
+static int refine_signed(struct equiv *e, struct state *st, unsigned int w,
+			 __s64 bound, int below)
+{
+	struct state other = *st;
+
+	if (bound > INT32_MAX || bound <= INT32_MIN)
+		return below == (bound > INT32_MAX);
+	if (below && bound > 0) {
+		if (narrow(&other, w, 0, bound - 1))
+			push(e, &other, -1);
+		return narrow(st, w, 0x80000000U, ~0U);
+	}
+	if (below)
+		return narrow(st, w, 0x80000000U, (__u32)(bound - 1));
+	if (bound > 0)
+		return narrow(st, w, bound, 0x7fffffffU);
+	if (bound < 0 && narrow(&other, w, (__u32)bound, ~0U))
+		push(e, &other, -1);
+	return narrow(st, w, 0, 0x7fffffffU);
+}
+
+/*
+ * Tests of the top bits of a word, (w & m) with m a run of high bits and
+ * maybe the sign flipped after, against |k|: the rank comparisons merged
+ * filters make.  Those are intervals of w, unsigned or signed.  Returns -1
+ * if |s| is not of that form.
+ */
+static int refine_top_bits(struct equiv *e, struct state *st,
+			   const struct sym *s, __u16 op, __u32 k,
+			   int is_taken)
+{
+	__u64 t = (__u64)k + (op == BPF_JGT);
+	__u32 m;
+	__s64 c;
+
+	if ((op != BPF_JGE && op != BPF_JGT) || !s->nops || s->nops > 2 ||
+	    s->ops[0].code != (BPF_ALU|BPF_AND|BPF_K))
+		return -1;
+	m = s->ops[0].k;
+	if (!m || m + (m & -m) != 0)
+		return -1;
+	if (s->nops == 1) {
+		/* w & m >= t: w from t rounded up to a multiple of m's step. */
+		t = (t + ~m) & ~(__u64)~m;
+		if (t > ~0U)
+			return !is_taken;
+		return is_taken ? narrow(st, s->word, t, ~0U) :
+			t ? narrow(st, s->word, 0, t - 1) : 0;
+	}
+	if (s->ops[1].code != (BPF_ALU|BPF_XOR|BPF_K) ||
+	    s->ops[1].k != 0x80000000U)
+		return -1;
+	if (t > ~0U)
+		return !is_taken;
+	/* Flipping the sign makes it signed: w >= t's signed, rounded up. */
+	c = (__s32)((__u32)t ^ 0x80000000U);
+	c = (c + ~m) & ~(__s64)~m;
+	return refine_signed(e, st, s->word, c, !is_taken);
+}
+
+static void exclude(struct state *st, struct range *r, __u32 k)
+{
+	if (k == r->lo && k != r->hi)
+		r->lo++;
+	else if (k == r->hi && k != r->lo)
+		r->hi--;
+	else if (r->nexcluded < MAX_EXCLUDED)
+		r->excluded[r->nexcluded++] = k;
+	else
+		st->approx = 1;
+}
+
+/*
+ * Narrows |st| to the data on which testing |s| against |k| with |op| is
+ * |is_taken|.  Returns 0 if there is none.  An outcome which is a choice,
+ * as when one of several bits is set, is split into cases that say exactly
+ * which: all but the last are pushed, if |e| is not NULL, so |st| must
+ * already be set up to go on from the test.
+ */
+static int refine(struct equiv *e, struct state *st, struct sym s, __u16 op,
+		  __u32 k, int is_taken)
+{
+	int known = decided(st, &s, op, k);
+	struct range *r;
+	__u32 m, free, rest, bit;
+
+	if (known >= 0)
+		return known == is_taken;
+	if (s.kind == SYM_UNKNOWN) {
+		st->approx = 1;
+		return 1;
+	}
+	r = &st->words[s.word];
+
+	/* Masks are the common case: (w & m) & k is w & (m & k). */
+	if (s.nops == 1 && s.ops[0].code == (BPF_ALU|BPF_AND|BPF_K)) {
+		m = s.ops[0].k;
+		if (op == BPF_JSET) {
+			k &= m;
+			s.nops = 0;
+		} else if (op == BPF_JEQ && is_taken) {
+			r->set |= k;
+			r->clear |= m & ~k;
+			return word_feasible(st, s.word) != 0;
+		} else if (op == BPF_JEQ && e) {
+			/* Some bit of m differs from k: the first is b. */
+			free = m & ~(r->set | r->clear);
+			for (rest = free; rest & (rest - 1); rest &= rest - 1) {
+				struct state one = *st;
+				struct range *q = &one.words[s.word];
+
+				bit = rest & -rest;
+				q->set |= (k & free & (bit - 1)) | (~k & bit);
+				q->clear |= (~k & free & (bit - 1)) | (k & bit);
+				push(e, &one, s.word);
+			}
+			bit = rest;
+			r->set |= (k & free & (bit - 1)) | (~k & bit);
+			r->clear |= (~k & free & (bit - 1)) | (k & bit);
+			return word_feasible(st, s.word) != 0;
+		}
+	}
+
+	if (s.nops == 0 && op == BPF_JSET && is_taken && e) {
+		/* Some bit of k is set: the first is b. */
+		free = k & ~r->clear;
+		for (rest = free; rest & (rest - 1); rest &= rest - 1) {
+			struct state one = *st;
+
+			bit = rest & -rest;
+			one.words[s.word].set |= bit;
+			one.words[s.word].clear |= free & (bit - 1);
+			push(e, &one, s.word);
+		}
+		bit = rest;
+		r->set |= bit;
+		r->clear |= free & (bit - 1);
+	} else if (s.nops == 0 && op == BPF_JEQ && !is_taken &&
+		   r->nexcluded == MAX_EXCLUDED && k > r->lo && k < r->hi &&
+		   e) {
+		/* No room to exclude k: either side of it, then. */
+		struct state above = *st;
+
+		above.words[s.word].lo = k + 1;
+		push(e, &above, s.word);
+		r->hi = k - 1;
+	} else if (s.nops == 0 && (op != BPF_JSET || !is_taken)) {
+		switch (op) {
+		case BPF_JEQ:
+			if (is_taken)
+				r->lo = r->hi = k;
+			else
+				exclude(st, r, k);
+			break;
+		case BPF_JGE:
+			if (is_taken)
+				r->lo = k;
+			else
+				r->hi = k - 1;
+			break;
+		case BPF_JGT:
+			if (is_taken)
+				r->lo = k + 1;
+			else
+				r->hi = k;
+			break;
+		case BPF_JSET:
+			r->clear |= k;
+			break;
+		}
+	} else if (e && (known = refine_top_bits(e, st, &s, op, k,
+						is_taken)) >= 0) {
+		return known;
+	} else if (st->npreds < MAX_PREDS) {
+		struct pred *p = &st->preds[st->npreds++];
+
+		p->fn = s;
+		p->op = op;
+		p->k = k;
+		p->taken = is_taken;
+	} else {
+		st->approx = 1;
+	}
+
+	known = word_feasible(st, s.word);
+	if (known < 0)
+		st->approx = 1;
+	return known != 0;
+}
+
+/* Folds |s| into a constant if its word is down to one value. */
+static void resolve(const struct state *st, struct sym *s)
+{
+	const struct range *r;
+
+	if (s->kind != SYM_WORD)
+		return;
+	r = &st->words[s->word];
+	if (r->lo == r->hi)
+		*s = constant(eval(s, r->lo));
+}
+
+/*
+ * Replaces |st| with one state per value word |w| can take, if there are
+ * few enough.  Returns 1 if it did.
+ */
+static int split(struct equiv *e, struct state *st, const struct sym *s)
+{
+	const struct range *r;
+	__u64 from;
+	__u32 v;
+
+	if (s->kind != SYM_WORD)
+		return 0;
+	r = &st->words[s->word];
+	if (r->hi - r->lo >= SPLIT_LIMIT)
+		return 0;
+	e->stats->splits++;
+	for (from = r->lo; !first_fit(r, from, &v); from = (__u64)v + 1) {
+		struct state one = *st;
+
+		one.words[s->word].lo = one.words[s->word].hi = v;
+		push(e, &one, s->word);
+	}
+	return 1;
+}
+
+/*
+ * Runs the jump at st->pc on |s| against |k|: the taken side continues in
+ * |st| and the other is pushed.  If the jump cannot be taken, st->pc is set
+ * to ~0U.
+ */
+static void branch(struct equiv *e, struct state *st, const struct sym *s,
+		   __u16 op, __u32 k, int invert_taken)
+{
+	const struct sock_filter *insn = &filter_of(e, st)->filter[st->pc];
+	unsigned int jt = insn->jt, jf = insn->jf;
+	struct state other;
+	int known;
+
+	if (invert_taken) {
+		jt = insn->jf;
+		jf = insn->jt;
+	}
+	known = decided(st, s, op, k);
+	if (jt == jf || known >= 0) {
+		st->pc += 1 + (jt == jf || known ? jt : jf);
+		return;
+	}
+	other = *st;
+	other.pc += 1 + jf;
+	if (refine(e, &other, *s, op, k, 0))
+		push(e, &other, s->kind == SYM_WORD ? (int)s->word : -1);
+	st->pc += 1 + jt;
+	if (!refine(e, st, *s, op, k, 1))
+		st->pc = ~0U;
+}
+
+/* Data meeting |st|'s constraints, as far as they can be met. */
+static void witness(const struct state *st, __u64 seed,
+		    struct seccomp_data *data)
+{
+	__u32 words[WORDS];
+	unsigned int w;
+
+	for (w = 0; w < WORDS; w++)
+		if (find_value(st, w, seed + w, &words[w]))
+			words[w] = st->words[w].lo;
+	memcpy(data, words, sizeof(*data));
+}
+
+/*
+ * The verdicts of |st| may differ: looks for data on which they do.
+ * Returns 1 if it found some.
+ */
+static int differ(struct equiv *e, const struct state *st)
+{
+	struct seccomp_data data;
+	unsigned int seed;
+
+	for (seed = 0; seed < 8; seed++) {
+		witness(st, seed, &data);
+		if (bpf_run_chain(e->chain[0], e->count[0], &data) !=
+		    bpf_run_chain(e->chain[1], e->count[1], &data)) {
+			*e->counter = data;
+			e->different = 1;
+			return 1;
+		}
+	}
+	e->stats->undecided++;
+	e->unknown = 1;
+	return 0;
+}
+
+/*
+ * Narrows |st| to the data on which seccomp_action_rank(|s|) is below
+ * |rank|, or not.  Ranks ignore the low 16 bits, so for a plain word that
+ * is the word itself, taken as signed, against |rank|.
+ */
+static int refine_rank(struct equiv *e, struct state *st, struct sym s,
+		       __s64 rank, int below)
+{
+	if (s.kind == SYM_WORD && !s.nops)
+		return refine_signed(e, st, s.word, rank, below);
+	/* Otherwise as bpf_merge.c does: unsigned, with the top bit flipped. */
+	apply(&s, BPF_ALU|BPF_AND|BPF_K, SECCOMP_RET_ACTION_FULL);
+	apply(&s, BPF_ALU|BPF_XOR|BPF_K, 0x80000000U);
+	if (rank > INT32_MAX || rank <= INT32_MIN)
+		return below == (rank > INT32_MAX);
+	return refine(e, st, s, BPF_JGE, (__u32)rank ^ 0x80000000U, !below);
+}
+
+/*
+ * A filter returned |cur|: keeps it over st->ret if it ranks lower, as the
+ * kernel does, splitting the paths where that depends on the data.
+ */
+static void combine(struct equiv *e, struct state *st, struct sym cur)
+{
+	struct state other;
+
+	resolve(st, &st->ret);
+	if (cur.kind == SYM_CONST && st->ret.kind == SYM_CONST) {
+		if (seccomp_action_rank(cur.k) <
+		    seccomp_action_rank(st->ret.k))
+			st->ret = cur;
+		return;
+	}
+	other = *st;
+	other.ret = cur;
+	if (cur.kind == SYM_CONST) {
+		/* cur wins unless ret ranks no higher. */
+		__s64 rank = (__s64)seccomp_action_rank(cur.k) + 0x10000;
+
+		if (refine_rank(e, &other, st->ret, rank, 0))
+			push(e, &other, -1);
+		if (!refine_rank(e, st, st->ret, rank, 1))
+			st->pc = ~0U;
+	} else if (st->ret.kind == SYM_CONST) {
+		__s64 rank = seccomp_action_rank(st->ret.k);
+
+		if (refine_rank(e, &other, cur, rank, 1))
+			push(e, &other, -1);
+		if (!refine_rank(e, st, cur, rank, 0))
+			st->pc = ~0U;
+	} else {
+		other.approx = st->approx = 1;
+		push(e, &other, -1);
+	}
+}
+
+/* Compares the verdicts of the two sides at the end of a path. */
+static void compare(struct equiv *e, struct state *st)
+{
+	struct sym *v0 = &st->verdict, *v1 = &st->ret;
+
+	e->stats->paths++;
+	resolve(st, v0);
+	resolve(st, v1);
+	if (same_sym(v0, v1))
+		return;
+	/* Against a constant, only the data making them unequal is left. */
+	if (v0->kind == SYM_CONST || v1->kind == SYM_CONST) {
+		const struct sym *k = v0->kind == SYM_CONST ? v0 : v1;
+		const struct sym *s = v0->kind == SYM_CONST ? v1 : v0;
+
+		if (!refine(NULL, st, *s, BPF_JEQ, k->k, 0))
+			return;
+	}
+	differ(e, st);
+}
+
+/* Sets up |st| to run the first filter of |side|. */
+static void start_side(struct state *st, unsigned int side)
+{
+	st->side = side;
+	st->filter = 0;
+	st->pc = 0;
+	st->ret = constant(SECCOMP_RET_ALLOW);
+}
+
+/* Ends the current filter with |cur| and moves on to the next. */
+static void filter_return(struct equiv *e, struct state *st, struct sym cur)
+{
+	unsigned int i;
+
+	st->filter++;
+	st->pc = 0;
+	st->A = st->X = constant(0);
+	for (i = 0; i < BPF_MEMWORDS; i++)
+		st->mem[i].kind = SYM_UNKNOWN;
+	combine(e, st, cur);
+}
+
+/* Runs the ALU instruction at st->pc on A and |src|. */
+static void run_alu(struct equiv *e, struct state *st, __u16 code,
+		    struct sym src)
+{
+	if (BPF_OP(code) == BPF_NEG) {
+		apply(&st->A, BPF_ALU|BPF_NEG, 0);
+		st->pc++;
+		return;
+	}
+	/* Division by a zero X ends the filter with 0. */
+	if (BPF_OP(code) == BPF_DIV && src.kind != SYM_CONST) {
+		struct state zero = *st;
+
+		if (refine(e, &zero, src, BPF_JEQ, 0, 1)) {
+			filter_return(e, &zero, constant(0));
+			push(e, &zero, -1);
+		}
+		if (!refine(e, st, src, BPF_JEQ, 0, 0)) {
+			/* X can only be 0: the path ends above. */
+			st->pc = ~0U;
+			return;
+		}
+		resolve(st, &st->X);
+		src = st->X;
+	} else if (BPF_OP(code) == BPF_DIV && !src.k) {
+		filter_return(e, st, constant(0));
+		return;
+	}
+	if (src.kind == SYM_CONST) {
+		apply(&st->A, BPF_ALU|BPF_OP(code)|BPF_K, src.k);
+		st->pc++;
+		return;
+	}
+	/* Two values: fix one of them, if it can be. */
+	if (split(e, st, &src) || split(e, st, &st->A)) {
+		st->pc = ~0U;
+		return;
+	}
+	st->A.kind = SYM_UNKNOWN;
+	st->pc++;
+}
+
+/* Runs the conditional jump at st->pc on A and |src|. */
+static void run_jump(struct equiv *e, struct state *st, __u16 code,
+		     struct sym src)
+{
+	__u16 op = BPF_OP(code);
+
+	if (src.kind == SYM_CONST) {
+		branch(e, st, &st->A, op, src.k, 0);
+	} else if (st->A.kind == SYM_CONST) {
+		/* k op X: the same test with X on the left. */
+		if (op == BPF_JGE || op == BPF_JGT)
+			branch(e, st, &src, op == BPF_JGE ? BPF_JGT : BPF_JGE,
+			       st->A.k, 1);
+		else
+			branch(e, st, &src, op, st->A.k, 0);
+	} else if (split(e, st, &src) || split(e, st, &st->A)) {
+		st->pc = ~0U;
+	} else {
+		src.kind = SYM_UNKNOWN;
+		branch(e, st, &src, BPF_JEQ, 0, 0);
+	}
+}
+
+/* Runs |st| to the end of its path, pushing the branches it does not take. */
+static void run(struct equiv *e, struct state *st)
+{
+	for (;;) {
+		const struct sock_filter *insn;
+		struct sym src;
+
+		/* A branch which cannot be taken. */
+		if (st->pc == ~0U)
+			return;
+		if (st->filter == e->count[st->side]) {
+			if (st->side == 1) {
+				compare(e, st);
+				return;
+			}
+			st->verdict = st->ret;
+			start_side(st, 1);
+			continue;
+		}
+
+		insn = &filter_of(e, st)->filter[st->pc];
+		resolve(st, &st->A);
+		resolve(st, &st->X);
+		src = BPF_SRC(insn->code) == BPF_X ? st->X :
+			constant(insn->k);
+
+		switch (BPF_CLASS(insn->code)) {
+		case BPF_LD:
+		case BPF_LDX: {
+			struct sym *dst = BPF_CLASS(insn->code) == BPF_LD ?
+				&st->A : &st->X;
+
+			switch (BPF_MODE(insn->code)) {
+			case BPF_ABS:
+				*dst = (struct sym){ .kind = SYM_WORD,
+						     .word = insn->k / 4 };
+				break;
+			case BPF_LEN:
+				*dst = constant(sizeof(struct seccomp_data));
+				break;
+			case BPF_IMM:
+				*dst = constant(insn->k);
+				break;
+			case BPF_MEM:
+				*dst = st->mem[insn->k];
+				break;
+			}
+			st->pc++;
+			break;
+		}
+		case BPF_ST:
+			st->mem[insn->k] = st->A;
+			st->pc++;
+			break;
+		case BPF_STX:
+			st->mem[insn->k] = st->X;
+			st->pc++;
+			break;
+		case BPF_MISC:
+			if (BPF_MISCOP(insn->code) == BPF_TAX)
+				st->X = st->A;
+			else
+				st->A = st->X;
+			st->pc++;
+			break;
+		case BPF_ALU:
+			run_alu(e, st, insn->code, src);
+			break;
+		case BPF_JMP:
+			if (BPF_OP(insn->code) == BPF_JA)
+				st->pc += 1 + insn->k;
+			else
+				run_jump(e, st, insn->code, src);
+			break;
+		case BPF_RET:
+			if (BPF_RVAL(insn->code) == BPF_A)
+				src = st->A;
+			filter_return(e, st, src);
+			break;
+		}
+	}
+}
+
+int bpf_equiv(const struct sock_fprog *a, unsigned int na,
+	      const struct sock_fprog *b, unsigned int nb,
+	      struct seccomp_data *counter, struct bpf_equiv_stats *stats)
+{
+	struct bpf_equiv_stats unused;
+	struct equiv e = {
+		.chain = { a, b },
+		.count = { na, nb },
+		.counter = counter,
+		.stats = stats ? stats : &unused,
+	};
+	struct state *st;
+	unsigned int i, w;
+	int ret = -1;
+
+	for (i = 0; i < na + nb; i++) {
+		const struct sock_fprog *f = i < na ? &a[i] : &b[i - na];
+
+		if (bpf_check(f->filter, f->len, NULL))
+			return -1;
+	}
+	memset(e.stats, 0, sizeof(*e.stats));
+	st = calloc(1, sizeof(*st));
+	if (!st)
+		return -1;
+	for (w = 0; w < WORDS; w++)
+		st->words[w].hi = ~0U;
+	start_side(st, 0);
+	push(&e, st, -1);
+
+	while (e.nstack && !e.different && !e.nomem && !e.full) {
+		*st = e.stack[--e.nstack];
+		run(&e, st);
+	}
+	if (e.full)
+		e.unknown = 1;
+	if (e.nomem)
+		errno = ENOMEM;
+	else if (e.different)
+		ret = BPF_EQUIV_DIFFERENT;
+	else
+		ret = e.unknown ? BPF_EQUIV_UNKNOWN : BPF_EQUIV_SAME;
+	free(e.stack);
+	free(st);
+	return ret;
+}
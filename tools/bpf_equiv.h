@@ -0,0 +1,51 @@
+/* bpf_equiv.h
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Proves two seccomp filters, or chains of them, return the same verdict
+ * for every struct seccomp_data, or finds data on which they differ.
+ *
+ * Both sides run symbolically over the whole input: each 32-bit word of
+ * struct seccomp_data starts out unknown, and every test on it splits the
+ * paths and narrows the word on each, to an interval, bits known set or
+ * clear, and a few values excluded.  A value computed from one word with
+ * constants is tested by splitting the word into every value it can still
+ * take if there are few, as with nr inside a bitmap leaf, and otherwise by
+ * keeping the test as a predicate to check candidates against.  The second
+ * side runs on each path the first takes, and where the verdicts may
+ * differ, data is built from the words' constraints and both sides run on
+ * it with bpf_run_chain(): only a real difference is reported.  What is
+ * beyond the model, such as arithmetic mixing two words, is followed down
+ * every branch, so a proof stays a proof, but may leave the answer
+ * unknown.
+ */
+#ifndef BPF_EQUIV_H
+#define BPF_EQUIV_H
+
+#include "bpf_interp.h"
+
+enum bpf_equiv_result {
+	BPF_EQUIV_SAME,		/* the same verdict for all data */
+	BPF_EQUIV_DIFFERENT,	/* a different verdict for the counterexample */
+	BPF_EQUIV_UNKNOWN,	/* neither could be shown */
+};
+
+struct bpf_equiv_stats {
+	unsigned long paths;	/* pairs of paths whose verdicts were compared */
+	unsigned long splits;	/* states split into each value of a word */
+	unsigned long undecided; /* differing paths no data was found for */
+};
+
+/*
+ * Compares the chains |a| and |b|, of |na| and |nb| filters given in the
+ * order they were installed; a single filter is a chain of one.  Returns a
+ * bpf_equiv_result, filling |counter| for BPF_EQUIV_DIFFERENT, or -1 with
+ * errno set: EINVAL if a filter fails bpf_check(), or ENOMEM.  Chains with
+ * too many paths to follow give BPF_EQUIV_UNKNOWN.  |stats| may be NULL.
+ */
+int bpf_equiv(const struct sock_fprog *a, unsigned int na,
+	      const struct sock_fprog *b, unsigned int nb,
+	      struct seccomp_data *counter, struct bpf_equiv_stats *stats);
+
+#endif  /* BPF_EQUIV_H */
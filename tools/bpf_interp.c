@@ -0,0 +1,349 @@
+/* bpf_interp.c
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Userspace evaluation of seccomp BPF programs.  The checks mirror the
+ * kernel's bpf_check_classic() and seccomp_check_filter(), and the
+ * semantics those of the classic-to-eBPF conversion the kernel runs.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "bpf_interp.h"
+
+/* Instructions the kernel accepts in a seccomp filter. */
+static int seccomp_code_allowed(__u16 code)
+{
+	switch (code) {
+	case BPF_RET|BPF_K:
+	case BPF_RET|BPF_A:
+	case BPF_ALU|BPF_ADD|BPF_K:
+	case BPF_ALU|BPF_ADD|BPF_X:
+	case BPF_ALU|BPF_SUB|BPF_K:
+	case BPF_ALU|BPF_SUB|BPF_X:
+	case BPF_ALU|BPF_MUL|BPF_K:
+	case BPF_ALU|BPF_MUL|BPF_X:
+	case BPF_ALU|BPF_DIV|BPF_K:
+	case BPF_ALU|BPF_DIV|BPF_X:
+	case BPF_ALU|BPF_AND|BPF_K:
+	case BPF_ALU|BPF_AND|BPF_X:
+	case BPF_ALU|BPF_OR|BPF_K:
+	case BPF_ALU|BPF_OR|BPF_X:
+	case BPF_ALU|BPF_XOR|BPF_K:
+	case BPF_ALU|BPF_XOR|BPF_X:
+	case BPF_ALU|BPF_LSH|BPF_K:
+	case BPF_ALU|BPF_LSH|BPF_X:
+	case BPF_ALU|BPF_RSH|BPF_K:
+	case BPF_ALU|BPF_RSH|BPF_X:
+	case BPF_ALU|BPF_NEG:
+	case BPF_LD|BPF_W|BPF_ABS:
+	case BPF_LD|BPF_W|BPF_LEN:
+	case BPF_LDX|BPF_W|BPF_LEN:
+	case BPF_LD|BPF_IMM:
+	case BPF_LDX|BPF_IMM:
+	case BPF_MISC|BPF_TAX:
+	case BPF_MISC|BPF_TXA:
+	case BPF_LD|BPF_MEM:
+	case BPF_LDX|BPF_MEM:
+	case BPF_ST:
+	case BPF_STX:
+	case BPF_JMP|BPF_JA:
+	case BPF_JMP|BPF_JEQ|BPF_K:
+	case BPF_JMP|BPF_JEQ|BPF_X:
+	case BPF_JMP|BPF_JGE|BPF_K:
+	case BPF_JMP|BPF_JGE|BPF_X:
+	case BPF_JMP|BPF_JGT|BPF_K:
+	case BPF_JMP|BPF_JGT|BPF_X:
+	case BPF_JMP|BPF_JSET|BPF_K:
+	case BPF_JMP|BPF_JSET|BPF_X:
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Scratch memory must be stored before it is loaded on every path.  Jumps
+ * only go forward, so one pass which intersects the valid words flowing
+ * into each instruction is enough.
+ */
+static int check_load_and_stores(const struct sock_filter *filter,
+				 unsigned int len, unsigned int *bad)
+{
+	__u16 masks[BPF_MAXINSNS];
+	__u16 valid = 0;
+	unsigned int pc;
+
+	memset(masks, 0xff, len * sizeof(masks[0]));
+	for (pc = 0; pc < len; pc++) {
+		const struct sock_filter *insn = &filter[pc];
+
+		valid &= masks[pc];
+		switch (insn->code) {
+		case BPF_ST:
+		case BPF_STX:
+			valid |= 1 << insn->k;
+			break;
+		case BPF_LD|BPF_MEM:
+		case BPF_LDX|BPF_MEM:
+			if (!(valid & (1 << insn->k))) {
+				*bad = pc;
+				return -1;
+			}
+			break;
+		case BPF_JMP|BPF_JA:
+			masks[pc + 1 + insn->k] &= valid;
+			valid = ~0;
+			break;
+		case BPF_JMP|BPF_JEQ|BPF_K:
+		case BPF_JMP|BPF_JEQ|BPF_X:
+		case BPF_JMP|BPF_JGE|BPF_K:
+		case BPF_JMP|BPF_JGE|BPF_X:
+		case BPF_JMP|BPF_JGT|BPF_K:
+		case BPF_JMP|BPF_JGT|BPF_X:
+		case BPF_JMP|BPF_JSET|BPF_K:
+		case BPF_JMP|BPF_JSET|BPF_X:
+			masks[pc + 1 + insn->jt] &= valid;
+			masks[pc + 1 + insn->jf] &= valid;
+			valid = ~0;
+			break;
+		}
+	}
+	return 0;
+}
+
+int bpf_check(const struct sock_filter *filter, unsigned int len,
+	      unsigned int *bad)
+{
+	unsigned int pc, unused;
+
+	if (!bad)
+		bad = &unused;
+	*bad = len;
+	if (len == 0 || len > BPF_MAXINSNS)
+		goto invalid;
+
+	for (pc = 0; pc < len; pc++) {
+		const struct sock_filter *insn = &filter[pc];
+
+		*bad = pc;
+		if (!seccomp_code_allowed(insn->code))
+			goto invalid;
+		switch (insn->code) {
+		case BPF_ALU|BPF_DIV|BPF_K:
+			if (insn->k == 0)
+				goto invalid;
+			break;
+		case BPF_ALU|BPF_LSH|BPF_K:
+		case BPF_ALU|BPF_RSH|BPF_K:
+			if (insn->k >= 32)
+				goto invalid;
+			break;
+		case BPF_LD|BPF_MEM:
+		case BPF_LDX|BPF_MEM:
+		case BPF_ST:
+		case BPF_STX:
+			if (insn->k >= BPF_MEMWORDS)
+				goto invalid;
+			break;
+		case BPF_LD|BPF_W|BPF_ABS:
+			if (insn->k >= sizeof(struct seccomp_data) ||
+			    insn->k & 3)
+				goto invalid;
+			break;
+		case BPF_JMP|BPF_JA:
+			if (insn->k >= len - pc - 1)
+				goto invalid;
+			break;
+		case BPF_JMP|BPF_JEQ|BPF_K:
+		case BPF_JMP|BPF_JEQ|BPF_X:
+		case BPF_JMP|BPF_JGE|BPF_K:
+		case BPF_JMP|BPF_JGE|BPF_X:
+		case BPF_JMP|BPF_JGT|BPF_K:
+		case BPF_JMP|BPF_JGT|BPF_X:
+		case BPF_JMP|BPF_JSET|BPF_K:
+		case BPF_JMP|BPF_JSET|BPF_X:
+			if (pc + insn->jt + 1 >= len ||
+			    pc + insn->jf + 1 >= len)
+				goto invalid;
+			break;
+		}
+	}
+	if (check_load_and_stores(filter, len, bad))
+		goto invalid;
+	*bad = len;
+	if (BPF_CLASS(filter[len - 1].code) != BPF_RET)
+		goto invalid;
+	return 0;
+
+invalid:
+	errno = EINVAL;
+	return -1;
+}
+
+__u32 bpf_run(const struct sock_filter *filter,
+	      const struct seccomp_data *data, unsigned int *steps)
+{
+	const struct sock_filter *insn = filter;
+	__u32 A = 0, X = 0, ret;
+	__u32 mem[BPF_MEMWORDS];
+	unsigned int executed = 0;
+
+	for (;; insn++) {
+		executed++;
+		switch (insn->code) {
+		case BPF_LD|BPF_W|BPF_ABS:
+			memcpy(&A, (const char *)data + insn->k, sizeof(A));
+			continue;
+		case BPF_LD|BPF_W|BPF_LEN:
+			A = sizeof(*data);
+			continue;
+		case BPF_LDX|BPF_W|BPF_LEN:
+			X = sizeof(*data);
+			continue;
+		case BPF_LD|BPF_IMM:
+			A = insn->k;
+			continue;
+		case BPF_LDX|BPF_IMM:
+			X = insn->k;
+			continue;
+		case BPF_LD|BPF_MEM:
+			A = mem[insn->k];
+			continue;
+		case BPF_LDX|BPF_MEM:
+			X = mem[insn->k];
+			continue;
+		case BPF_ST:
+			mem[insn->k] = A;
+			continue;
+		case BPF_STX:
+			mem[insn->k] = X;
+			continue;
+		case BPF_MISC|BPF_TAX:
+			X = A;
+			continue;
+		case BPF_MISC|BPF_TXA:
+			A = X;
+			continue;
+		case BPF_ALU|BPF_ADD|BPF_K:
+			A += insn->k;
+			continue;
+		case BPF_ALU|BPF_ADD|BPF_X:
+			A += X;
+			continue;
+		case BPF_ALU|BPF_SUB|BPF_K:
+			A -= insn->k;
+			continue;
+		case BPF_ALU|BPF_SUB|BPF_X:
+			A -= X;
+			continue;
+		case BPF_ALU|BPF_MUL|BPF_K:
+			A *= insn->k;
+			continue;
+		case BPF_ALU|BPF_MUL|BPF_X:
+			A *= X;
+			continue;
+		case BPF_ALU|BPF_DIV|BPF_K:
+			A /= insn->k;
+			continue;
+		case BPF_ALU|BPF_DIV|BPF_X:
+			/* The kernel bails out with 0, i.e. kill. */
+			if (X == 0) {
+				ret = 0;
+				goto out;
+			}
+			A /= X;
+			continue;
+		case BPF_ALU|BPF_AND|BPF_K:
+			A &= insn->k;
+			continue;
+		case BPF_ALU|BPF_AND|BPF_X:
+			A &= X;
+			continue;
+		case BPF_ALU|BPF_OR|BPF_K:
+			A |= insn->k;
+			continue;
+		case BPF_ALU|BPF_OR|BPF_X:
+			A |= X;
+			continue;
+		case BPF_ALU|BPF_XOR|BPF_K:
+			A ^= insn->k;
+			continue;
+		case BPF_ALU|BPF_XOR|BPF_X:
+			A ^= X;
+			continue;
+		case BPF_ALU|BPF_LSH|BPF_K:
+			A <<= insn->k;
+			continue;
+		case BPF_ALU|BPF_LSH|BPF_X:
+			/* 32-bit eBPF shifts, as the JITs do, use 5 bits. */
+			A <<= X & 31;
+			continue;
+		case BPF_ALU|BPF_RSH|BPF_K:
+			A >>= insn->k;
+			continue;
+		case BPF_ALU|BPF_RSH|BPF_X:
+			A >>= X & 31;
+			continue;
+		case BPF_ALU|BPF_NEG:
+			A = -A;
+			continue;
+		case BPF_JMP|BPF_JA:
+			insn += insn->k;
+			continue;
+		case BPF_JMP|BPF_JEQ|BPF_K:
+			insn += A == insn->k ? insn->jt : insn->jf;
+			continue;
+		case BPF_JMP|BPF_JEQ|BPF_X:
+			insn += A == X ? insn->jt : insn->jf;
+			continue;
+		case BPF_JMP|BPF_JGE|BPF_K:
+			insn += A >= insn->k ? insn->jt : insn->jf;
+			continue;
+		case BPF_JMP|BPF_JGE|BPF_X:
+			insn += A >= X ? insn->jt : insn->jf;
+			continue;
+		case BPF_JMP|BPF_JGT|BPF_K:
+			insn += A > insn->k ? insn->jt : insn->jf;
+			continue;
+		case BPF_JMP|BPF_JGT|BPF_X:
+			insn += A > X ? insn->jt : insn->jf;
+			continue;
+		case BPF_JMP|BPF_JSET|BPF_K:
+			insn += A & insn->k ? insn->jt : insn->jf;
+			continue;
+		case BPF_JMP|BPF_JSET|BPF_X:
+			insn += A & X ? insn->jt : insn->jf;
+			continue;
+		case BPF_RET|BPF_K:
+			ret = insn->k;
+			goto out;
+		case BPF_RET|BPF_A:
+			ret = A;
+			goto out;
+		default:
+			/* Unchecked program; fail closed. */
+			ret = SECCOMP_RET_KILL;
+			goto out;
+		}
+	}
+out:
+	if (steps)
+		*steps = executed;
+	return ret;
+}
+
+__u32 bpf_run_chain(const struct sock_fprog *chain, unsigned int count,
+		    const struct seccomp_data *data)
+{
+	__u32 ret = SECCOMP_RET_ALLOW;
+
+	while (count--) {
+		__u32 cur = bpf_run(chain[count].filter, data, NULL);
+
+		if (seccomp_action_rank(cur) < seccomp_action_rank(ret))
+			ret = cur;
+	}
+	return ret;
+}
@@ -0,0 +1,93 @@
+/* bpf_interp.h
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Userspace evaluation of seccomp BPF programs.
+ *
+ * bpf_check() accepts exactly the programs the kernel accepts for
+ * SECCOMP_MODE_FILTER, and bpf_run() returns what the kernel's filter would
+ * return for the same struct seccomp_data, so filters can be checked and
+ * profiled offline without forking or installing anything.  E.g.,
+ *
+ *   struct seccomp_data data = { .nr = __NR_getpid, .arch = ARCH_NR };
+ *   unsigned int bad;
+ *
+ *   if (bpf_check(filter, len, &bad))
+ *     errx(1, "instruction %u is invalid", bad);
+ *   if (SECCOMP_ACTION(bpf_run(filter, &data, NULL)) == SECCOMP_RET_TRAP)
+ *     ...
+ */
+#ifndef BPF_INTERP_H
+#define BPF_INTERP_H
+
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <linux/types.h>
+
+#ifndef SECCOMP_RET_KILL
+#define SECCOMP_RET_KILL        0x00000000U /* kill the task immediately */
+#define SECCOMP_RET_TRAP        0x00030000U /* disallow and force a SIGSYS */
+#define SECCOMP_RET_ERRNO       0x00050000U /* returns an errno */
+#define SECCOMP_RET_TRACE       0x7ff00000U /* pass to a tracer or disallow */
+#define SECCOMP_RET_ALLOW       0x7fff0000U /* allow */
+
+/* Masks for the return value sections. */
+#define SECCOMP_RET_ACTION      0x7fff0000U
+#define SECCOMP_RET_DATA        0x0000ffffU
+
+struct seccomp_data {
+	int nr;
+	__u32 arch;
+	__u64 instruction_pointer;
+	__u64 args[6];
+};
+#endif
+
+#ifndef SECCOMP_RET_KILL_PROCESS
+#define SECCOMP_RET_KILL_PROCESS 0x80000000U /* kill the whole process */
+#endif
+#ifndef SECCOMP_RET_ACTION_FULL
+#define SECCOMP_RET_ACTION_FULL 0xffff0000U
+#endif
+
+/* The action part of a filter's return value. */
+#define SECCOMP_ACTION(_ret) ((_ret) & SECCOMP_RET_ACTION_FULL)
+
+/*
+ * Orders actions the way the kernel does when several filters are stacked:
+ * the lowest rank wins, so KILL_PROCESS < KILL < TRAP < ERRNO < TRACE < ALLOW.
+ */
+static inline __s32 seccomp_action_rank(__u32 ret)
+{
+	return (__s32)SECCOMP_ACTION(ret);
+}
+
+/*
+ * Checks |len| instructions of |filter| the way the kernel does before
+ * installing them as a seccomp filter.  Returns 0 if the program would be
+ * accepted.  Otherwise returns -1 with errno set to EINVAL and, if |bad| is
+ * not NULL, sets it to the index of the offending instruction, or to |len|
+ * if the program is empty, too long or doesn't end with a return.
+ */
+int bpf_check(const struct sock_filter *filter, unsigned int len,
+	      unsigned int *bad);
+
+/*
+ * Runs a filter which passed bpf_check() over |data| and returns its
+ * verdict.  If |steps| is not NULL, it is set to the number of instructions
+ * executed.
+ */
+__u32 bpf_run(const struct sock_filter *filter,
+	      const struct seccomp_data *data, unsigned int *steps);
+
+/*
+ * Runs a chain of checked filters, given in the order they were installed,
+ * and combines their verdicts as the kernel does: the newest filter runs
+ * first and the lowest seccomp_action_rank() wins, the newest filter winning
+ * ties.  An empty chain allows everything.
+ */
+__u32 bpf_run_chain(const struct sock_fprog *chain, unsigned int count,
+		    const struct seccomp_data *data);
+
+#endif  /* BPF_INTERP_H */
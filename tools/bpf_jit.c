@@ -0,0 +1,364 @@
+/* bpf_jit.c
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Compiles seccomp filters to native x86-64 code.
+ *
+ * A lives in eax and X in ecx, so shifts by X can use cl, whose count the
+ * CPU already masks to 5 bits just as bpf_run() does.  The data pointer
+ * stays in rdi, the first argument, and the scratch words sit in the red
+ * zone below rsp, which a leaf function may use without moving the stack.
+ * Every instruction has a fixed size encoding, near jumps included, so one
+ * sizing pass gives every instruction's offset and the second pass emits
+ * into a buffer of exactly that size.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "bpf_jit.h"
+
+#if defined(__x86_64__)
+
+struct jit_ctx {
+	__u8 *image;		/* NULL while sizing */
+	size_t size;		/* bytes available in image */
+	size_t len;		/* bytes emitted so far */
+	int overflow;
+	unsigned int *offsets;	/* start of each instruction */
+	size_t ret0;		/* start of the shared "return 0" stub */
+};
+
+static void emit(struct jit_ctx *ctx, const __u8 *bytes, size_t n)
+{
+	if (ctx->image) {
+		if (n > ctx->size - ctx->len) {
+			ctx->overflow = 1;
+			return;
+		}
+		memcpy(ctx->image + ctx->len, bytes, n);
+	}
+	ctx->len += n;
+}
+
+#define EMIT(...) do { \
+	const __u8 __bytes[] = { __VA_ARGS__ }; \
+	emit(ctx, __bytes, sizeof(__bytes)); \
+} while (0)
+
+static void emit_imm32(struct jit_ctx *ctx, __u32 imm)
+{
+	EMIT(imm, imm >> 8, imm >> 16, imm >> 24);
+}
+
+/* |op| followed by a 32-bit immediate, e.g. "add eax, imm32". */
+static void emit_op_imm32(struct jit_ctx *ctx, const __u8 *op, size_t n,
+			  __u32 imm)
+{
+	emit(ctx, op, n);
+	emit_imm32(ctx, imm);
+}
+
+#define EMIT_IMM32(_imm, ...) do { \
+	const __u8 __op[] = { __VA_ARGS__ }; \
+	emit_op_imm32(ctx, __op, sizeof(__op), _imm); \
+} while (0)
+
+/* Jumps are relative to the end of the jump instruction. */
+static void emit_jmp(struct jit_ctx *ctx, size_t target)
+{
+	EMIT(0xe9);
+	emit_imm32(ctx, target - (ctx->len + 4));
+}
+
+static void emit_jcc(struct jit_ctx *ctx, __u8 cc, size_t target)
+{
+	EMIT(0x0f, cc);
+	emit_imm32(ctx, target - (ctx->len + 4));
+}
+
+/* Near jcc condition bytes. */
+#define JB	0x82
+#define JAE	0x83
+#define JE	0x84
+#define JNE	0x85
+#define JBE	0x86
+#define JA	0x87
+
+/* After a cmp or test, jumps to jt if |cc| holds and to jf if it doesn't. */
+static void emit_branch(struct jit_ctx *ctx, unsigned int pc,
+			const struct sock_filter *insn, __u8 cc)
+{
+	size_t t = ctx->offsets[pc + 1 + insn->jt];
+	size_t f = ctx->offsets[pc + 1 + insn->jf];
+
+	if (insn->jt == insn->jf) {
+		if (insn->jt)
+			emit_jmp(ctx, t);
+	} else if (insn->jf == 0) {
+		emit_jcc(ctx, cc, t);
+	} else if (insn->jt == 0) {
+		/* The condition codes come in pairs differing in bit 0. */
+		emit_jcc(ctx, cc ^ 1, f);
+	} else {
+		emit_jcc(ctx, cc, t);
+		emit_jmp(ctx, f);
+	}
+}
+
+/* Scratch word k lives at [rsp - 64 + 4 * k], in the red zone. */
+#define MEM_DISP(_k) ((__u8)(-4 * BPF_MEMWORDS + 4 * (_k)))
+
+static int jit_emit(struct jit_ctx *ctx, const struct sock_filter *filter,
+		    unsigned int len)
+{
+	unsigned int pc;
+
+	ctx->len = 0;
+	/* xor eax, eax; xor ecx, ecx */
+	EMIT(0x31, 0xc0, 0x31, 0xc9);
+
+	for (pc = 0; pc < len; pc++) {
+		const struct sock_filter *insn = &filter[pc];
+		__u32 k = insn->k;
+
+		if (ctx->image && ctx->offsets[pc] != ctx->len)
+			return -1;
+		ctx->offsets[pc] = ctx->len;
+
+		switch (insn->code) {
+		case BPF_LD|BPF_W|BPF_ABS:
+			/* mov eax, [rdi + k]; bpf_check() keeps k < 64. */
+			EMIT(0x8b, 0x47, k);
+			break;
+		case BPF_LD|BPF_W|BPF_LEN:
+			EMIT_IMM32(sizeof(struct seccomp_data), 0xb8);
+			break;
+		case BPF_LDX|BPF_W|BPF_LEN:
+			EMIT_IMM32(sizeof(struct seccomp_data), 0xb9);
+			break;
+		case BPF_LD|BPF_IMM:
+			EMIT_IMM32(k, 0xb8);		/* mov eax, k */
+			break;
+		case BPF_LDX|BPF_IMM:
+			EMIT_IMM32(k, 0xb9);		/* mov ecx, k */
+			break;
+		case BPF_LD|BPF_MEM:
+			EMIT(0x8b, 0x44, 0x24, MEM_DISP(k));
+			break;
+		case BPF_LDX|BPF_MEM:
+			EMIT(0x8b, 0x4c, 0x24, MEM_DISP(k));
+			break;
+		case BPF_ST:
+			EMIT(0x89, 0x44, 0x24, MEM_DISP(k));
+			break;
+		case BPF_STX:
+			EMIT(0x89, 0x4c, 0x24, MEM_DISP(k));
+			break;
+		case BPF_MISC|BPF_TAX:
+			EMIT(0x89, 0xc1);		/* mov ecx, eax */
+			break;
+		case BPF_MISC|BPF_TXA:
+			EMIT(0x89, 0xc8);		/* mov eax, ecx */
+			break;
+		case BPF_ALU|BPF_ADD|BPF_K:
+			EMIT_IMM32(k, 0x05);
+			break;
+		case BPF_ALU|BPF_ADD|BPF_X:
+			EMIT(0x01, 0xc8);
+			break;
+		case BPF_ALU|BPF_SUB|BPF_K:
+			EMIT_IMM32(k, 0x2d);
+			break;
+		case BPF_ALU|BPF_SUB|BPF_X:
+			EMIT(0x29, 0xc8);
+			break;
+		case BPF_ALU|BPF_MUL|BPF_K:
+			EMIT_IMM32(k, 0x69, 0xc0);	/* imul eax, eax, k */
+			break;
+		case BPF_ALU|BPF_MUL|BPF_X:
+			EMIT(0x0f, 0xaf, 0xc1);		/* imul eax, ecx */
+			break;
+		case BPF_ALU|BPF_DIV|BPF_K:
+			/* mov esi, k; xor edx, edx; div esi */
+			EMIT_IMM32(k, 0xbe);
+			EMIT(0x31, 0xd2, 0xf7, 0xf6);
+			break;
+		case BPF_ALU|BPF_DIV|BPF_X:
+			/* test ecx, ecx; jz ret0; xor edx, edx; div ecx */
+			EMIT(0x85, 0xc9);
+			emit_jcc(ctx, JE, ctx->ret0);
+			EMIT(0x31, 0xd2, 0xf7, 0xf1);
+			break;
+		case BPF_ALU|BPF_AND|BPF_K:
+			EMIT_IMM32(k, 0x25);
+			break;
+		case BPF_ALU|BPF_AND|BPF_X:
+			EMIT(0x21, 0xc8);
+			break;
+		case BPF_ALU|BPF_OR|BPF_K:
+			EMIT_IMM32(k, 0x0d);
+			break;
+		case BPF_ALU|BPF_OR|BPF_X:
+			EMIT(0x09, 0xc8);
+			break;
+		case BPF_ALU|BPF_XOR|BPF_K:
+			EMIT_IMM32(k, 0x35);
+			break;
+		case BPF_ALU|BPF_XOR|BPF_X:
+			EMIT(0x31, 0xc8);
+			break;
+		case BPF_ALU|BPF_LSH|BPF_K:
+			EMIT(0xc1, 0xe0, k);		/* shl eax, k */
+			break;
+		case BPF_ALU|BPF_LSH|BPF_X:
+			EMIT(0xd3, 0xe0);		/* shl eax, cl */
+			break;
+		case BPF_ALU|BPF_RSH|BPF_K:
+			EMIT(0xc1, 0xe8, k);		/* shr eax, k */
+			break;
+		case BPF_ALU|BPF_RSH|BPF_X:
+			EMIT(0xd3, 0xe8);		/* shr eax, cl */
+			break;
+		case BPF_ALU|BPF_NEG:
+			EMIT(0xf7, 0xd8);
+			break;
+		case BPF_JMP|BPF_JA:
+			emit_jmp(ctx, ctx->offsets[pc + 1 + k]);
+			break;
+		case BPF_JMP|BPF_JEQ|BPF_K:
+			EMIT_IMM32(k, 0x3d);		/* cmp eax, k */
+			emit_branch(ctx, pc, insn, JE);
+			break;
+		case BPF_JMP|BPF_JEQ|BPF_X:
+			EMIT(0x39, 0xc8);		/* cmp eax, ecx */
+			emit_branch(ctx, pc, insn, JE);
+			break;
+		case BPF_JMP|BPF_JGE|BPF_K:
+			EMIT_IMM32(k, 0x3d);
+			emit_branch(ctx, pc, insn, JAE);
+			break;
+		case BPF_JMP|BPF_JGE|BPF_X:
+			EMIT(0x39, 0xc8);
+			emit_branch(ctx, pc, insn, JAE);
+			break;
+		case BPF_JMP|BPF_JGT|BPF_K:
+			EMIT_IMM32(k, 0x3d);
+			emit_branch(ctx, pc, insn, JA);
+			break;
+		case BPF_JMP|BPF_JGT|BPF_X:
+			EMIT(0x39, 0xc8);
+			emit_branch(ctx, pc, insn, JA);
+			break;
+		case BPF_JMP|BPF_JSET|BPF_K:
+			EMIT_IMM32(k, 0xa9);		/* test eax, k */
+			emit_branch(ctx, pc, insn, JNE);
+			break;
+		case BPF_JMP|BPF_JSET|BPF_X:
+			EMIT(0x85, 0xc8);		/* test eax, ecx */
+			emit_branch(ctx, pc, insn, JNE);
+			break;
+		case BPF_RET|BPF_K:
+			EMIT_IMM32(k, 0xb8);
+			EMIT(0xc3);
+			break;
+		case BPF_RET|BPF_A:
+			EMIT(0xc3);
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	/* Division by zero returns 0, i.e. kill, as in the kernel. */
+	if (ctx->image && ctx->ret0 != ctx->len)
+		return -1;
+	ctx->ret0 = ctx->len;
+	EMIT(0x31, 0xc0, 0xc3);
+	return ctx->overflow ? -1 : 0;
+}
+
+int bpf_jit_compile(const struct sock_filter *filter, unsigned int len,
+		    struct bpf_jit *jit)
+{
+	struct jit_ctx ctx;
+	void *image;
+	int saved;
+
+	memset(jit, 0, sizeof(*jit));
+	if (bpf_check(filter, len, NULL))
+		return -1;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.offsets = calloc(len, sizeof(*ctx.offsets));
+	if (!ctx.offsets)
+		return -1;
+	/* Size, then emit into exactly that much memory. */
+	if (jit_emit(&ctx, filter, len))
+		goto internal_error;
+	ctx.size = ctx.len;
+	image = mmap(NULL, ctx.size, PROT_READ|PROT_WRITE,
+		     MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (image == MAP_FAILED)
+		goto fail;
+	ctx.image = image;
+	if (jit_emit(&ctx, filter, len) || ctx.len != ctx.size) {
+		munmap(image, ctx.size);
+		goto internal_error;
+	}
+	if (mprotect(image, ctx.size, PROT_READ|PROT_EXEC)) {
+		saved = errno;
+		munmap(image, ctx.size);
+		errno = saved;
+		goto fail;
+	}
+	free(ctx.offsets);
+
+	jit->image = image;
+	jit->size = ctx.size;
+	jit->func = (bpf_jit_func)image;
+	return 0;
+
+internal_error:
+	/* The two passes disagreed; nothing half-written is ever run. */
+	errno = EFAULT;
+fail:
+	saved = errno;
+	free(ctx.offsets);
+	errno = saved;
+	return -1;
+}
+
+#else
+
+int bpf_jit_compile(const struct sock_filter *filter, unsigned int len,
+		    struct bpf_jit *jit)
+{
+	memset(jit, 0, sizeof(*jit));
+	errno = ENOSYS;
+	return -1;
+}
+
+#endif  /* __x86_64__ */
+
+void bpf_jit_free(struct bpf_jit *jit)
+{
+	if (jit->image)
+		munmap(jit->image, jit->size);
+	memset(jit, 0, sizeof(*jit));
+}
+
+size_t bpf_jit_verify(const struct bpf_jit *jit,
+		      const struct sock_filter *filter,
+		      const struct seccomp_data *data, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		if (jit->func(&data[i]) != bpf_run(filter, &data[i], NULL))
+			return i;
+	return count;
+}
@@ -0,0 +1,54 @@
+/* bpf_jit.h
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Compiles seccomp filters to native x86-64 code.
+ *
+ * The compiled function takes a struct seccomp_data and returns what
+ * bpf_run() would, without the interpreter's dispatch per instruction.  A
+ * program is only compiled after it passes bpf_check(), which bounds every
+ * load, store and jump, and the code is written into a buffer sized by a
+ * first pass before it is made executable.  E.g.,
+ *
+ *   struct bpf_jit jit;
+ *
+ *   if (bpf_jit_compile(filter, len, &jit))
+ *     err(1, "bpf_jit_compile");
+ *   ret = jit.func(&data);
+ *   bpf_jit_free(&jit);
+ */
+#ifndef BPF_JIT_H
+#define BPF_JIT_H
+
+#include <stddef.h>
+
+#include "bpf_interp.h"
+
+typedef __u32 (*bpf_jit_func)(const struct seccomp_data *data);
+
+struct bpf_jit {
+	bpf_jit_func func;
+	void *image;
+	size_t size;
+};
+
+/*
+ * Compiles |len| instructions of |filter|.  Returns 0, or -1 with errno set:
+ * EINVAL if the program fails bpf_check(), ENOSYS if this isn't an x86-64
+ * build, or whatever mmap() or mprotect() failed with.
+ */
+int bpf_jit_compile(const struct sock_filter *filter, unsigned int len,
+		    struct bpf_jit *jit);
+void bpf_jit_free(struct bpf_jit *jit);
+
+/*
+ * Cross-checks |jit| against bpf_run() of the |filter| it was compiled
+ * from over |count| records.  Returns the index of the first record whose
+ * verdict differs, or |count| if they all agree.
+ */
+size_t bpf_jit_verify(const struct bpf_jit *jit,
+		      const struct sock_filter *filter,
+		      const struct seccomp_data *data, size_t count);
+
+#endif  /* BPF_JIT_H */
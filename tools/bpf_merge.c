@@ -0,0 +1,468 @@
+/* bpf_merge.c
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Flattens a chain of stacked seccomp filters into one program.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bpf_merge.h"
+
+/*
+ * The verdict so far, where it matters: a constant, or whatever is in the
+ * scratch word set aside for it.
+ */
+struct verdict {
+	int dynamic;
+	__u32 ret;
+};
+
+/* A BPF_JA into the copy of the next filter for next[index]. */
+struct fixup {
+	unsigned int pc;
+	unsigned int index;
+};
+
+struct merger {
+	struct sock_filter insns[BPF_MAXINSNS];
+	unsigned int len;
+	__u32 best, tmp;	/* scratch words for computed verdicts */
+	int save;		/* and for A around a guarded division */
+	int err;
+
+	/* Verdicts the next filter gets copies for, and jumps to them. */
+	struct verdict *next;
+	unsigned int nnext;
+	struct fixup fixups[BPF_MAXINSNS];
+	unsigned int nfixups;
+};
+
+static void emit(struct merger *m, __u16 code, __u32 k, __u8 jt, __u8 jf)
+{
+	if (m->len < BPF_MAXINSNS) {
+		struct sock_filter insn = BPF_JUMP(code, k, jt, jf);
+
+		m->insns[m->len] = insn;
+	}
+	/* Counting on past the end tells the caller how much was needed. */
+	m->len++;
+}
+
+/* Ranks as unsigned: lower wins, the same order seccomp_action_rank() has. */
+static __u32 urank(__u32 ret)
+{
+	return SECCOMP_ACTION(ret) ^ 0x80000000U;
+}
+
+/* Emits A = urank(A). */
+static void emit_urank(struct merger *m)
+{
+	emit(m, BPF_ALU|BPF_AND|BPF_K, SECCOMP_RET_ACTION_FULL, 0, 0);
+	emit(m, BPF_ALU|BPF_XOR|BPF_K, 0x80000000U, 0, 0);
+}
+
+/* Emits a jump into the next filter's copy for |v|. */
+static void emit_next(struct merger *m, struct verdict v)
+{
+	unsigned int i;
+
+	for (i = 0; i < m->nnext; i++)
+		if (m->next[i].dynamic == v.dynamic &&
+		    (v.dynamic || m->next[i].ret == v.ret))
+			break;
+	if (i == m->nnext)
+		m->next[m->nnext++] = v;
+	if (m->len < BPF_MAXINSNS)
+		m->fixups[m->nfixups++] = (struct fixup){ m->len, i };
+	emit(m, BPF_JMP|BPF_JA, 0, 0, 0);
+}
+
+/*
+ * Ends a path with the computed verdict in m->best: returns it after the
+ * last filter, or goes on to the next.
+ */
+static void emit_dynamic_end(struct merger *m, int last)
+{
+	if (last) {
+		emit(m, BPF_LD|BPF_MEM, m->best, 0, 0);
+		emit(m, BPF_RET|BPF_A, 0, 0, 0);
+	} else {
+		emit_next(m, (struct verdict){ 1, 0 });
+	}
+}
+
+/*
+ * Emits the code for a filter returning |ret| with |v| the verdict so far,
+ * which a later filter can only beat by ranking below |beat|.
+ */
+static void emit_return(struct merger *m, struct verdict v,
+			const struct sock_filter *ret, __s64 beat, int last)
+{
+	if (!v.dynamic && BPF_RVAL(ret->code) == BPF_K) {
+		/* The newer verdict wins ties. */
+		if (seccomp_action_rank(ret->k) < seccomp_action_rank(v.ret))
+			v.ret = ret->k;
+		if (seccomp_action_rank(v.ret) <= beat)
+			emit(m, BPF_RET|BPF_K, v.ret, 0, 0);
+		else
+			emit_next(m, v);
+		return;
+	}
+
+	if (!v.dynamic) {
+		/* A against a constant: keep whichever wins in m->best. */
+		emit(m, BPF_MISC|BPF_TAX, 0, 0, 0);
+		emit_urank(m);
+		if (last) {
+			emit(m, BPF_JMP|BPF_JGE|BPF_K, urank(v.ret), 0, 1);
+			emit(m, BPF_RET|BPF_K, v.ret, 0, 0);
+			emit(m, BPF_MISC|BPF_TXA, 0, 0, 0);
+			emit(m, BPF_RET|BPF_A, 0, 0, 0);
+			return;
+		}
+		emit(m, BPF_JMP|BPF_JGE|BPF_K, urank(v.ret), 0, 2);
+		emit(m, BPF_LD|BPF_IMM, v.ret, 0, 0);
+		emit(m, BPF_JMP|BPF_JA, 1, 0, 0);
+		emit(m, BPF_MISC|BPF_TXA, 0, 0, 0);
+		emit(m, BPF_ST, m->best, 0, 0);
+	} else if (BPF_RVAL(ret->code) == BPF_K) {
+		/* A constant against m->best. */
+		emit(m, BPF_LD|BPF_MEM, m->best, 0, 0);
+		emit_urank(m);
+		emit(m, BPF_JMP|BPF_JGT|BPF_K, urank(ret->k), 0, 2);
+		emit(m, BPF_LD|BPF_IMM, ret->k, 0, 0);
+		emit(m, BPF_ST, m->best, 0, 0);
+	} else {
+		/* A against m->best, with A put by in m->tmp. */
+		emit(m, BPF_ST, m->tmp, 0, 0);
+		emit_urank(m);
+		emit(m, BPF_MISC|BPF_TAX, 0, 0, 0);
+		emit(m, BPF_LD|BPF_MEM, m->best, 0, 0);
+		emit_urank(m);
+		emit(m, BPF_JMP|BPF_JGT|BPF_X, 0, 0, 2);
+		emit(m, BPF_LD|BPF_MEM, m->tmp, 0, 0);
+		emit(m, BPF_ST, m->best, 0, 0);
+	}
+	emit_dynamic_end(m, last);
+}
+
+/*
+ * Whether a division by a zero X, which ends the filter with 0, needs to be
+ * caught: it ends the whole merged program, which only returns the right
+ * verdict if no other filter could rank below 0 or keep 0 with other data.
+ */
+static int guard_div(struct verdict v, __s64 beat)
+{
+	return v.dynamic || seccomp_action_rank(v.ret) <= 0 || beat < 0;
+}
+
+/* Instructions emit_copy() uses for |insn|. */
+static unsigned int copy_size(const struct sock_filter *insn, int guard)
+{
+	return guard && insn->code == (BPF_ALU|BPF_DIV|BPF_X) ? 6 : 1;
+}
+
+/* Moves a jump of the filter to where its target is in the copy. */
+static void relocate(struct merger *m, struct sock_filter *insn,
+		     unsigned int from, const unsigned int *pos)
+{
+	unsigned int jt, jf;
+
+	if (insn->code == (BPF_JMP|BPF_JA)) {
+		insn->k = pos[from + 1 + insn->k] - pos[from] - 1;
+		return;
+	}
+	if (BPF_CLASS(insn->code) != BPF_JMP)
+		return;
+	jt = pos[from + 1 + insn->jt] - pos[from] - 1;
+	jf = pos[from + 1 + insn->jf] - pos[from] - 1;
+	if (jt > 255 || jf > 255)
+		m->err = E2BIG;
+	insn->jt = jt;
+	insn->jf = jf;
+}
+
+/*
+ * Emits one copy of |f| for the verdict |v|.  Returns stay in place as one
+ * instruction each, a return or a jump, and those which need more code
+ * jump to it after the copy.  A guarded division becomes
+ *
+ *   ST save; TXA; JEQ 0,0,1; JA <return 0>; LD save; DIV X
+ *
+ * and the filter's own jumps are moved to match.
+ */
+static void emit_copy(struct merger *m, const struct sock_fprog *f,
+		      struct verdict v, __s64 beat, int last, int first)
+{
+	static const struct sock_filter div_zero =
+		BPF_STMT(BPF_RET|BPF_K, 0);
+	struct {
+		unsigned int at;
+		const struct sock_filter *ret;
+	} stubs[BPF_MAXINSNS];
+	unsigned int pos[BPF_MAXINSNS + 1], nstubs = 0, pc;
+	int guard = guard_div(v, beat);
+
+	/* Every filter starts with A and X zero. */
+	if (!first) {
+		emit(m, BPF_LD|BPF_IMM, 0, 0, 0);
+		emit(m, BPF_LDX|BPF_IMM, 0, 0, 0);
+	}
+	pos[0] = m->len;
+	for (pc = 0; pc < f->len; pc++)
+		pos[pc + 1] = pos[pc] + copy_size(&f->filter[pc], guard);
+
+	for (pc = 0; pc < f->len; pc++) {
+		struct sock_filter insn = f->filter[pc];
+
+		if (copy_size(&insn, guard) > 1) {
+			if (m->save < 0) {
+				m->err = ENOSPC;
+				return;
+			}
+			emit(m, BPF_ST, m->save, 0, 0);
+			emit(m, BPF_MISC|BPF_TXA, 0, 0, 0);
+			emit(m, BPF_JMP|BPF_JEQ|BPF_K, 0, 0, 1);
+			stubs[nstubs].at = m->len;
+			stubs[nstubs++].ret = &div_zero;
+			emit(m, BPF_JMP|BPF_JA, 0, 0, 0);
+			emit(m, BPF_LD|BPF_MEM, m->save, 0, 0);
+			emit(m, insn.code, insn.k, 0, 0);
+		} else if (BPF_CLASS(insn.code) != BPF_RET) {
+			relocate(m, &insn, pc, pos);
+			emit(m, insn.code, insn.k, insn.jt, insn.jf);
+		} else if (!v.dynamic && BPF_RVAL(insn.code) == BPF_K) {
+			emit_return(m, v, &insn, beat, last);
+		} else {
+			stubs[nstubs].at = m->len;
+			stubs[nstubs++].ret = &f->filter[pc];
+			emit(m, BPF_JMP|BPF_JA, 0, 0, 0);
+		}
+	}
+	for (pc = 0; pc < nstubs; pc++) {
+		if (stubs[pc].at < BPF_MAXINSNS)
+			m->insns[stubs[pc].at].k = m->len - stubs[pc].at - 1;
+		emit_return(m, v, stubs[pc].ret, beat, last);
+	}
+}
+
+/* Scratch words none of the |count| filters touch. */
+static __u32 unused_words(const struct sock_fprog *chain, unsigned int count)
+{
+	__u32 unused = (1U << BPF_MEMWORDS) - 1;
+	unsigned int i, pc;
+
+	for (i = 0; i < count; i++) {
+		for (pc = 0; pc < chain[i].len; pc++) {
+			const struct sock_filter *insn = &chain[i].filter[pc];
+
+			if (insn->code == BPF_ST || insn->code == BPF_STX ||
+			    insn->code == (BPF_LD|BPF_MEM) ||
+			    insn->code == (BPF_LDX|BPF_MEM))
+				unused &= ~(1U << insn->k);
+		}
+	}
+	return unused;
+}
+
+static int has_code(const struct sock_fprog *f, __u16 code)
+{
+	unsigned int pc;
+
+	for (pc = 0; pc < f->len; pc++)
+		if (f->filter[pc].code == code)
+			return 1;
+	return 0;
+}
+
+/* Takes the highest word in |unused|, or returns -1. */
+static int take_word(__u32 *unused, __u32 *word)
+{
+	int k;
+
+	for (k = BPF_MEMWORDS - 1; k >= 0; k--) {
+		if (*unused & (1U << k)) {
+			*unused &= ~(1U << k);
+			*word = k;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int bpf_chain_merge(const struct sock_fprog *chain, unsigned int count,
+		    struct sock_fprog *prog, struct bpf_opt_stats *stats)
+{
+	struct verdict *cur = NULL, *next = NULL;
+	unsigned int *start = NULL;
+	unsigned int i, j, ncur, cap = 2;
+	__s64 *beat = NULL;
+	struct merger *m;
+	__u32 unused, word;
+	int dynamic = 0, err = ENOMEM;
+
+	m = calloc(1, sizeof(*m));
+	if (!m)
+		goto fail;
+
+	/* The order the kernel runs them in, newest first. */
+	for (i = 0; i < count; i++) {
+		const struct sock_fprog *f = &chain[count - 1 - i];
+
+		err = EINVAL;
+		if (bpf_check(f->filter, f->len, NULL))
+			goto fail;
+		cap += f->len;
+	}
+	err = ENOMEM;
+	cur = malloc(cap * sizeof(*cur));
+	next = malloc(cap * sizeof(*next));
+	start = malloc(cap * sizeof(*start));
+	beat = malloc((count + 1) * sizeof(*beat));
+	if (!cur || !next || !start || !beat)
+		goto fail;
+
+	/*
+	 * beat[i] is the lowest rank filters i on can return: a verdict
+	 * ranked no higher is final.  Returning A may give any rank, and
+	 * dividing by X kills if X is 0.
+	 */
+	beat[count] = INT64_MAX;
+	for (i = count; i-- > 0;) {
+		const struct sock_fprog *f = &chain[count - 1 - i];
+		unsigned int pc;
+
+		beat[i] = beat[i + 1];
+		for (pc = 0; pc < f->len; pc++) {
+			const struct sock_filter *insn = &f->filter[pc];
+
+			if (insn->code == (BPF_RET|BPF_A))
+				beat[i] = INT32_MIN;
+			else if (insn->code == (BPF_RET|BPF_K) &&
+				 seccomp_action_rank(insn->k) < beat[i])
+				beat[i] = seccomp_action_rank(insn->k);
+			else if (insn->code == (BPF_ALU|BPF_DIV|BPF_X) &&
+				 seccomp_action_rank(SECCOMP_RET_KILL) <
+				 beat[i])
+				beat[i] = seccomp_action_rank(SECCOMP_RET_KILL);
+		}
+	}
+
+	/*
+	 * A filter other than the oldest returning A needs a word for the
+	 * verdict, and another if an older one returns A as well.
+	 */
+	unused = unused_words(chain, count);
+	err = ENOSPC;
+	for (i = count; i-- > 1;) {
+		if (!has_code(&chain[i], BPF_RET|BPF_A))
+			continue;
+		if (take_word(&unused, &m->best))
+			goto fail;
+		dynamic = 1;
+		for (j = 0; j < i; j++)
+			if (has_code(&chain[j], BPF_RET|BPF_A))
+				break;
+		if (j < i && take_word(&unused, &m->tmp))
+			goto fail;
+		break;
+	}
+	/* Guarding a division needs one more, if it comes to that. */
+	m->save = -1;
+	for (i = 0; count > 1 && i < count; i++) {
+		if (has_code(&chain[i], BPF_ALU|BPF_DIV|BPF_X)) {
+			if (!take_word(&unused, &word))
+				m->save = word;
+			break;
+		}
+	}
+
+	/*
+	 * bpf_check() carries what is stored before a return over to the
+	 * copy placed after it, which may be one whose way in stored no
+	 * verdict.  Storing one up front satisfies it on every path.
+	 */
+	if (dynamic)
+		emit(m, BPF_ST, m->best, 0, 0);
+
+	/* An empty chain allows everything, as does the kernel. */
+	cur[0] = (struct verdict){ 0, SECCOMP_RET_ALLOW };
+	ncur = 1;
+	if (!count)
+		emit(m, BPF_RET|BPF_K, SECCOMP_RET_ALLOW, 0, 0);
+	for (i = 0; i < count; i++) {
+		struct fixup fixups[BPF_MAXINSNS];
+		unsigned int nfixups = m->nfixups;
+		void *swap;
+
+		/* Jumps from the previous filter land in these copies. */
+		memcpy(fixups, m->fixups, nfixups * sizeof(*fixups));
+		m->next = next;
+		m->nnext = 0;
+		m->nfixups = 0;
+		for (j = 0; j < ncur; j++) {
+			start[j] = m->len;
+			emit_copy(m, &chain[count - 1 - i], cur[j], beat[i + 1],
+				  i + 1 == count, i == 0);
+		}
+		for (j = 0; j < nfixups; j++) {
+			struct sock_filter *ja = &m->insns[fixups[j].pc];
+
+			ja->k = start[fixups[j].index] - fixups[j].pc - 1;
+		}
+		swap = cur;
+		cur = next;
+		next = swap;
+		ncur = m->nnext;
+	}
+
+	err = m->err ? m->err : E2BIG;
+	if (m->err || m->len > BPF_MAXINSNS)
+		goto fail;
+	err = ENOMEM;
+	prog->filter = malloc(m->len * sizeof(*prog->filter));
+	if (!prog->filter)
+		goto fail;
+	memcpy(prog->filter, m->insns, m->len * sizeof(*prog->filter));
+	prog->len = m->len;
+	err = EINVAL;
+	if (bpf_check(prog->filter, prog->len, NULL)) {
+		free(prog->filter);
+		goto fail;
+	}
+	/*
+	 * The optimizer keeps what it makes checkable, but what the kernel
+	 * would refuse must never come back as merged: if it does, the merge
+	 * goes out as it was.
+	 */
+	if (bpf_optimize(prog, stats) ||
+	    bpf_check(prog->filter, prog->len, NULL)) {
+		memcpy(prog->filter, m->insns,
+		       m->len * sizeof(*prog->filter));
+		prog->len = m->len;
+		if (stats) {
+			memset(stats, 0, sizeof(*stats));
+			stats->before = m->len;
+		}
+	}
+	free(beat);
+	free(start);
+	free(next);
+	free(cur);
+	free(m);
+	return 0;
+
+fail:
+	free(beat);
+	free(start);
+	free(next);
+	free(cur);
+	free(m);
+	errno = err;
+	return -1;
+}
@@ -0,0 +1,39 @@
+/* bpf_merge.h
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Flattens a chain of stacked seccomp filters into one program.
+ *
+ * The kernel runs every filter in a chain for each syscall, newest first,
+ * and keeps the verdict of lowest seccomp_action_rank(), the newest winning
+ * ties.  The merged program runs the filters one after another in the same
+ * order, with each return replaced by a jump into the next filter.  Where
+ * the verdict so far is a constant, which it is unless a filter returns A,
+ * the next filter is copied once per verdict it can follow, so the
+ * precedence is decided while merging rather than at run time, and a
+ * verdict no later filter can beat returns at once.  A verdict computed
+ * from A is kept in a scratch word the filters leave unused.
+ *
+ * The result goes through bpf_optimize(), which removes the copies' repeated
+ * loads and returns.
+ */
+#ifndef BPF_MERGE_H
+#define BPF_MERGE_H
+
+#include "bpf_opt.h"
+
+/*
+ * Merges the |count| filters of |chain|, given in the order they were
+ * installed, into |prog|, whose filter must be released with free().  The
+ * program returns what bpf_run_chain() does for every struct seccomp_data
+ * and passes bpf_check(), unoptimized if the optimized one would not.
+ * |stats| may be NULL.  Returns 0, or -1 with errno set: EINVAL if a
+ * filter fails bpf_check(), E2BIG if the merged program would exceed
+ * BPF_MAXINSNS before optimizing, ENOSPC if a filter returns A and the
+ * filters leave too few scratch words unused, or ENOMEM.
+ */
+int bpf_chain_merge(const struct sock_fprog *chain, unsigned int count,
+		    struct sock_fprog *prog, struct bpf_opt_stats *stats);
+
+#endif  /* BPF_MERGE_H */
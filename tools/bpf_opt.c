@@ -0,0 +1,555 @@
+/* bpf_opt.c
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Peephole optimization of seccomp filters.  Jumps only go forward, so
+ * every analysis here is one pass in program order, or in reverse.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "bpf_opt.h"
+
+/* Longest forward jump a jt/jf offset can express. */
+#define MAX_COND_JUMP 255
+
+/* What a register is known to hold. */
+enum reg_kind {
+	REG_UNKNOWN,
+	REG_ABS,	/* the seccomp_data word at k */
+	REG_IMM,	/* the constant k */
+	REG_MEM,	/* scratch word k */
+};
+
+struct reg {
+	enum reg_kind kind;
+	__u32 k;
+};
+
+struct regs {
+	struct reg a, x;
+};
+
+/* Bits for liveness: A, X, then the scratch words. */
+#define LIVE_A (1U << 0)
+#define LIVE_X (1U << 1)
+#define LIVE_M(_k) (1U << (2 + (_k)))
+
+static int is_cond(const struct sock_filter *insn)
+{
+	return BPF_CLASS(insn->code) == BPF_JMP && BPF_OP(insn->code) != BPF_JA;
+}
+
+static int is_ret(const struct sock_filter *insn)
+{
+	return BPF_CLASS(insn->code) == BPF_RET;
+}
+
+static int same_insn(const struct sock_filter *a, const struct sock_filter *b)
+{
+	return a->code == b->code && a->k == b->k && a->jt == b->jt &&
+	       a->jf == b->jf;
+}
+
+/* Drops the instructions not in |keep|, retargeting jumps past them. */
+static unsigned int compact(struct sock_fprog *prog, const char *keep)
+{
+	struct sock_filter *insns = prog->filter;
+	unsigned int new_pc[BPF_MAXINSNS + 1];
+	unsigned int pc, n = 0;
+
+	for (pc = 0; pc < prog->len; pc++) {
+		new_pc[pc] = n;
+		n += keep[pc];
+	}
+	new_pc[pc] = n;
+	if (n == prog->len)
+		return 0;
+
+	for (pc = 0; pc < prog->len; pc++) {
+		struct sock_filter *insn = &insns[pc];
+
+		if (!keep[pc])
+			continue;
+		if (insn->code == (BPF_JMP|BPF_JA)) {
+			insn->k = new_pc[pc + 1 + insn->k] - new_pc[pc] - 1;
+		} else if (is_cond(insn)) {
+			insn->jt = new_pc[pc + 1 + insn->jt] - new_pc[pc] - 1;
+			insn->jf = new_pc[pc + 1 + insn->jf] - new_pc[pc] - 1;
+		}
+		insns[new_pc[pc]] = *insn;
+	}
+	n = prog->len - n;
+	prog->len -= n;
+	return n;
+}
+
+/*
+ * What is known about A on a jump edge: either its exact value, or the
+ * outcome of a test against a constant.
+ */
+struct fact {
+	enum { FACT_NONE, FACT_VALUE, FACT_TEST } kind;
+	__u16 code;
+	__u32 k;
+	int taken;
+};
+
+/* Returns where a test with a constant goes given |fact|, or -1. */
+static int decide(const struct sock_filter *insn, const struct fact *fact)
+{
+	__u32 a = fact->k;
+
+	if (!is_cond(insn) || BPF_SRC(insn->code) != BPF_K)
+		return -1;
+	if (fact->kind == FACT_TEST)
+		return insn->code == fact->code && insn->k == fact->k ?
+			fact->taken : -1;
+	if (fact->kind != FACT_VALUE)
+		return -1;
+	switch (BPF_OP(insn->code)) {
+	case BPF_JEQ:
+		return a == insn->k;
+	case BPF_JGT:
+		return a > insn->k;
+	case BPF_JGE:
+		return a >= insn->k;
+	case BPF_JSET:
+		return (a & insn->k) != 0;
+	}
+	return -1;
+}
+
+/*
+ * Follows the jump from |pc| to |target| on through BPF_JA and decided
+ * tests.  Returns the furthest instruction within |limit| of |pc|.
+ */
+static unsigned int follow(const struct sock_filter *insns, unsigned int pc,
+			   unsigned int target, const struct fact *fact,
+			   unsigned int limit)
+{
+	unsigned int best = target;
+
+	for (;;) {
+		const struct sock_filter *insn = &insns[target];
+		int taken;
+
+		if (insn->code == (BPF_JMP|BPF_JA)) {
+			target += 1 + insn->k;
+		} else {
+			taken = decide(insn, fact);
+			if (taken < 0)
+				break;
+			target += 1 + (taken ? insn->jt : insn->jf);
+		}
+		if (target - pc - 1 <= limit)
+			best = target;
+	}
+	return best;
+}
+
+/* Threads every jump through the jumps it lands on. */
+static unsigned int thread_jumps(struct sock_fprog *prog)
+{
+	struct sock_filter *insns = prog->filter;
+	unsigned int pc, target, changed = 0;
+
+	for (pc = 0; pc < prog->len; pc++) {
+		struct sock_filter *insn = &insns[pc];
+		struct fact fact = { FACT_NONE };
+
+		if (insn->code == (BPF_JMP|BPF_JA)) {
+			struct sock_filter ja = *insn;
+
+			target = follow(insns, pc, pc + 1 + insn->k, &fact,
+					~0U);
+			/*
+			 * bpf_check() forgets the words stored on the way to a
+			 * BPF_JA, not a return, so the next instruction may be
+			 * left with a load it rejects: then it stays a jump.
+			 */
+			if (is_ret(&insns[target])) {
+				*insn = insns[target];
+				if (!bpf_check(insns, prog->len, NULL)) {
+					changed++;
+					continue;
+				}
+				*insn = ja;
+			}
+			if (target != pc + 1 + insn->k) {
+				insn->k = target - pc - 1;
+				changed++;
+			}
+			continue;
+		}
+		if (!is_cond(insn))
+			continue;
+		if (BPF_SRC(insn->code) == BPF_K) {
+			fact.code = insn->code;
+			fact.k = insn->k;
+			fact.kind = BPF_OP(insn->code) == BPF_JEQ ?
+				FACT_VALUE : FACT_TEST;
+			fact.taken = 1;
+		}
+		target = follow(insns, pc, pc + 1 + insn->jt, &fact,
+				MAX_COND_JUMP);
+		if (target != pc + 1 + insn->jt) {
+			insn->jt = target - pc - 1;
+			changed++;
+		}
+		/* A != k only decides tests against k itself. */
+		if (fact.kind != FACT_NONE)
+			fact.kind = FACT_TEST;
+		fact.taken = 0;
+		target = follow(insns, pc, pc + 1 + insn->jf, &fact,
+				MAX_COND_JUMP);
+		if (target != pc + 1 + insn->jf) {
+			insn->jf = target - pc - 1;
+			changed++;
+		}
+		/* A test going the same way either way is a BPF_JA. */
+		if (insn->jt == insn->jf) {
+			insn->code = BPF_JMP|BPF_JA;
+			insn->k = insn->jt;
+			insn->jt = insn->jf = 0;
+			changed++;
+		}
+	}
+	return changed;
+}
+
+/* Returns the last copy of the return at |target| within reach of |pc|. */
+static unsigned int last_copy(const struct sock_fprog *prog, unsigned int pc,
+			      unsigned int target)
+{
+	unsigned int end = pc + 1 + MAX_COND_JUMP, i;
+
+	if (end >= prog->len)
+		end = prog->len - 1;
+	for (i = end; i > target; i--)
+		if (same_insn(&prog->filter[i], &prog->filter[target]))
+			return i;
+	return target;
+}
+
+/*
+ * Points every test landing on a return at the last copy of that return it
+ * can reach, so the others are left for dead.
+ */
+static unsigned int merge_returns(struct sock_fprog *prog)
+{
+	struct sock_filter *insns = prog->filter;
+	unsigned int pc, target, changed = 0;
+
+	for (pc = 0; pc < prog->len; pc++) {
+		struct sock_filter *insn = &insns[pc];
+
+		if (!is_cond(insn))
+			continue;
+		target = pc + 1 + insn->jt;
+		if (is_ret(&insns[target])) {
+			target = last_copy(prog, pc, target);
+			if (target != pc + 1 + insn->jt) {
+				insn->jt = target - pc - 1;
+				changed++;
+			}
+		}
+		target = pc + 1 + insn->jf;
+		if (is_ret(&insns[target])) {
+			target = last_copy(prog, pc, target);
+			if (target != pc + 1 + insn->jf) {
+				insn->jf = target - pc - 1;
+				changed++;
+			}
+		}
+	}
+	return changed;
+}
+
+static int same_reg(const struct reg *a, const struct reg *b)
+{
+	return a->kind != REG_UNKNOWN && a->kind == b->kind && a->k == b->k;
+}
+
+/* Merges what is known on a path into |pc| with the other paths. */
+static void meet(struct regs *in, char *seen, unsigned int pc,
+		 const struct regs *out)
+{
+	if (!seen[pc]) {
+		in[pc] = *out;
+		seen[pc] = 1;
+		return;
+	}
+	if (!same_reg(&in[pc].a, &out->a))
+		in[pc].a.kind = REG_UNKNOWN;
+	if (!same_reg(&in[pc].x, &out->x))
+		in[pc].x.kind = REG_UNKNOWN;
+}
+
+/* A store to scratch word |k| leaves the other register stale. */
+static void clobber_mem(struct reg *reg, const struct reg *stored, __u32 k)
+{
+	if (reg->kind == REG_MEM && reg->k == k && !same_reg(reg, stored))
+		reg->kind = REG_UNKNOWN;
+}
+
+/* Drops loads of a value the register is known to hold already. */
+static unsigned int remove_loads(struct sock_fprog *prog)
+{
+	struct regs in[BPF_MAXINSNS];
+	struct sock_filter *insns = prog->filter;
+	char seen[BPF_MAXINSNS] = { 0 };
+	char keep[BPF_MAXINSNS];
+	unsigned int pc;
+
+	memset(keep, 1, prog->len);
+	/* The kernel starts both registers at zero. */
+	in[0].a = in[0].x = (struct reg){ REG_IMM, 0 };
+	seen[0] = 1;
+	for (pc = 0; pc < prog->len; pc++) {
+		const struct sock_filter *insn = &insns[pc];
+		struct regs st = in[pc];
+		struct reg load = { REG_UNKNOWN, insn->k };
+
+		if (!seen[pc])
+			continue;
+		switch (insn->code) {
+		case BPF_LD|BPF_W|BPF_ABS:
+			load.kind = REG_ABS;
+			break;
+		case BPF_LD|BPF_IMM:
+		case BPF_LDX|BPF_IMM:
+			load.kind = REG_IMM;
+			break;
+		case BPF_LD|BPF_W|BPF_LEN:
+		case BPF_LDX|BPF_W|BPF_LEN:
+			load.kind = REG_IMM;
+			load.k = sizeof(struct seccomp_data);
+			break;
+		case BPF_LD|BPF_MEM:
+		case BPF_LDX|BPF_MEM:
+			load.kind = REG_MEM;
+			break;
+		}
+
+		if (BPF_CLASS(insn->code) == BPF_LD) {
+			if (same_reg(&st.a, &load))
+				keep[pc] = 0;
+			st.a = load;
+		} else if (BPF_CLASS(insn->code) == BPF_LDX) {
+			if (same_reg(&st.x, &load))
+				keep[pc] = 0;
+			st.x = load;
+		} else if (insn->code == BPF_ST) {
+			clobber_mem(&st.x, &st.a, insn->k);
+			/* A now also is what the word holds. */
+			if (st.a.kind == REG_UNKNOWN)
+				st.a = (struct reg){ REG_MEM, insn->k };
+		} else if (insn->code == BPF_STX) {
+			clobber_mem(&st.a, &st.x, insn->k);
+			if (st.x.kind == REG_UNKNOWN)
+				st.x = (struct reg){ REG_MEM, insn->k };
+		} else if (insn->code == (BPF_MISC|BPF_TAX)) {
+			st.x = st.a;
+		} else if (insn->code == (BPF_MISC|BPF_TXA)) {
+			st.a = st.x;
+		} else if (BPF_CLASS(insn->code) == BPF_ALU) {
+			st.a.kind = REG_UNKNOWN;
+		}
+
+		if (insn->code == (BPF_JMP|BPF_JA)) {
+			meet(in, seen, pc + 1 + insn->k, &st);
+		} else if (is_cond(insn)) {
+			meet(in, seen, pc + 1 + insn->jt, &st);
+			meet(in, seen, pc + 1 + insn->jf, &st);
+		} else if (!is_ret(insn)) {
+			meet(in, seen, pc + 1, &st);
+		}
+	}
+	return compact(prog, keep);
+}
+
+/* What |insn| reads and writes, as LIVE_* bits. */
+static void uses_defs(const struct sock_filter *insn, __u32 *uses,
+		      __u32 *defs)
+{
+	*uses = *defs = 0;
+	switch (BPF_CLASS(insn->code)) {
+	case BPF_LD:
+		*defs = LIVE_A;
+		if (BPF_MODE(insn->code) == BPF_MEM)
+			*uses = LIVE_M(insn->k);
+		break;
+	case BPF_LDX:
+		*defs = LIVE_X;
+		if (BPF_MODE(insn->code) == BPF_MEM)
+			*uses = LIVE_M(insn->k);
+		break;
+	case BPF_ST:
+		*uses = LIVE_A;
+		*defs = LIVE_M(insn->k);
+		break;
+	case BPF_STX:
+		*uses = LIVE_X;
+		*defs = LIVE_M(insn->k);
+		break;
+	case BPF_ALU:
+		*uses = LIVE_A;
+		if (BPF_OP(insn->code) != BPF_NEG &&
+		    BPF_SRC(insn->code) == BPF_X)
+			*uses |= LIVE_X;
+		*defs = LIVE_A;
+		break;
+	case BPF_MISC:
+		if (BPF_MISCOP(insn->code) == BPF_TAX) {
+			*uses = LIVE_A;
+			*defs = LIVE_X;
+		} else {
+			*uses = LIVE_X;
+			*defs = LIVE_A;
+		}
+		break;
+	case BPF_JMP:
+		if (BPF_OP(insn->code) == BPF_JA)
+			break;
+		*uses = LIVE_A;
+		if (BPF_SRC(insn->code) == BPF_X)
+			*uses |= LIVE_X;
+		break;
+	case BPF_RET:
+		if (BPF_RVAL(insn->code) == BPF_A)
+			*uses = LIVE_A;
+		break;
+	}
+}
+
+/*
+ * Drops what no path reaches, jumps to the next instruction, and writes
+ * no path reads before writing again.
+ */
+static unsigned int remove_dead(struct sock_fprog *prog)
+{
+	struct sock_filter *insns = prog->filter;
+	struct sock_filter saved[BPF_MAXINSNS];
+	char reach[BPF_MAXINSNS] = { 0 };
+	char keep[BPF_MAXINSNS];
+	__u32 live[BPF_MAXINSNS];
+	unsigned int pc, n, len = prog->len;
+
+	reach[0] = 1;
+	for (pc = 0; pc < prog->len; pc++) {
+		const struct sock_filter *insn = &insns[pc];
+
+		if (!reach[pc] || is_ret(insn))
+			continue;
+		if (insn->code == (BPF_JMP|BPF_JA)) {
+			reach[pc + 1 + insn->k] = 1;
+		} else if (is_cond(insn)) {
+			reach[pc + 1 + insn->jt] = 1;
+			reach[pc + 1 + insn->jf] = 1;
+		} else {
+			reach[pc + 1] = 1;
+		}
+	}
+
+	for (pc = prog->len; pc-- > 0;) {
+		const struct sock_filter *insn = &insns[pc];
+		__u32 out = 0, uses, defs;
+
+		keep[pc] = reach[pc];
+		live[pc] = 0;
+		if (!reach[pc])
+			continue;
+		if (insn->code == (BPF_JMP|BPF_JA)) {
+			out = live[pc + 1 + insn->k];
+			keep[pc] = insn->k != 0;
+		} else if (is_cond(insn)) {
+			out = live[pc + 1 + insn->jt] | live[pc + 1 + insn->jf];
+			keep[pc] = insn->jt || insn->jf;
+		} else if (!is_ret(insn)) {
+			out = live[pc + 1];
+		}
+		uses_defs(insn, &uses, &defs);
+		/* Division by a zero X returns 0, so it has an effect. */
+		if (defs && !(defs & out) &&
+		    insn->code != (BPF_ALU|BPF_DIV|BPF_X))
+			keep[pc] = 0;
+		live[pc] = keep[pc] ? (out & ~defs) | uses : out;
+	}
+
+	/*
+	 * bpf_check() carries the words stored before a return over to the
+	 * instruction after it, so dropping a store, or closing up the code
+	 * around a return, can leave a load it rejects.  The stores are kept
+	 * then, and failing that, everything is.
+	 */
+	memcpy(saved, insns, len * sizeof(*saved));
+	n = compact(prog, keep);
+	if (!n || !bpf_check(insns, prog->len, NULL))
+		return n;
+	memcpy(insns, saved, len * sizeof(*saved));
+	prog->len = len;
+	for (pc = 0; pc < len; pc++)
+		if (reach[pc] && (BPF_CLASS(insns[pc].code) == BPF_ST ||
+				  BPF_CLASS(insns[pc].code) == BPF_STX))
+			keep[pc] = 1;
+	n = compact(prog, keep);
+	if (!n || !bpf_check(insns, prog->len, NULL))
+		return n;
+	memcpy(insns, saved, len * sizeof(*saved));
+	prog->len = len;
+	return 0;
+}
+
+/*
+ * Runs |pass| over |prog|, undoing it if the result fails bpf_check(),
+ * which the kernel's check of loads and stores makes possible for any
+ * pass that moves returns or jumps.
+ */
+static unsigned int run_pass(struct sock_fprog *prog,
+			     unsigned int (*pass)(struct sock_fprog *))
+{
+	struct sock_filter saved[BPF_MAXINSNS];
+	unsigned int len = prog->len, n;
+
+	memcpy(saved, prog->filter, len * sizeof(*saved));
+	n = pass(prog);
+	if (!n || !bpf_check(prog->filter, prog->len, NULL))
+		return n;
+	memcpy(prog->filter, saved, len * sizeof(*saved));
+	prog->len = len;
+	return 0;
+}
+
+int bpf_optimize(struct sock_fprog *prog, struct bpf_opt_stats *stats)
+{
+	struct bpf_opt_stats unused;
+	unsigned int changed;
+
+	if (bpf_check(prog->filter, prog->len, NULL))
+		return -1;
+	if (!stats)
+		stats = &unused;
+	memset(stats, 0, sizeof(*stats));
+	stats->before = prog->len;
+	do {
+		unsigned int n;
+
+		stats->rounds++;
+		n = run_pass(prog, remove_loads);
+		stats->loads += n;
+		changed = n;
+		n = run_pass(prog, thread_jumps);
+		stats->threaded += n;
+		changed += n;
+		n = run_pass(prog, merge_returns);
+		stats->merged += n;
+		changed += n;
+		n = run_pass(prog, remove_dead);
+		stats->dead += n;
+		changed += n;
+	} while (changed);
+	return 0;
+}
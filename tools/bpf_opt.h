@@ -0,0 +1,44 @@
+/* bpf_opt.h
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Peephole optimization of seccomp filters.
+ *
+ * Hand-written and concatenated filters repeat work: the same word is
+ * loaded again on paths where A already holds it, jumps land on jumps or on
+ * one of several identical returns, and instructions are left behind that
+ * nothing reaches or whose result nothing reads.  bpf_optimize() repeats
+ *
+ *   - redundant-load elimination, dropping loads of what A or X hold,
+ *   - jump threading, through BPF_JA and through tests already decided on
+ *     the way in, with a BPF_JA to a return becoming that return,
+ *   - duplicate-return merging, pointing jumps at one copy of a BPF_RET,
+ *   - dead-instruction removal, of what is unreachable or written unread,
+ *
+ * until the program stops shrinking.  The result returns what the original
+ * does for every struct seccomp_data and still passes bpf_check().
+ */
+#ifndef BPF_OPT_H
+#define BPF_OPT_H
+
+#include "bpf_interp.h"
+
+/* What each pass did, summed over all the rounds. */
+struct bpf_opt_stats {
+	unsigned int before;	/* instructions on the way in */
+	unsigned int loads;	/* redundant loads removed */
+	unsigned int threaded;	/* jump offsets moved past a jump */
+	unsigned int merged;	/* jump offsets moved to another return */
+	unsigned int dead;	/* unreachable or unused instructions removed */
+	unsigned int rounds;
+};
+
+/*
+ * Optimizes |prog| in place, shortening prog->len.  Returns 0, or -1 with
+ * errno set to EINVAL if the program fails bpf_check().  |stats| may be
+ * NULL.
+ */
+int bpf_optimize(struct sock_fprog *prog, struct bpf_opt_stats *stats);
+
+#endif  /* BPF_OPT_H */
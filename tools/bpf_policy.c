@@ -0,0 +1,409 @@
+/* bpf_policy.c
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Compiles a syscall to action table into a seccomp filter.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bpf_policy.h"
+
+#ifndef SECCOMP_RET_LOG
+#define SECCOMP_RET_LOG 0x7ffc0000U
+#endif
+
+/* Longest forward jump a jt/jf offset can express. */
+#define MAX_COND_JUMP 255
+
+/*
+ * Fewest intervals worth a bitmap window: a smaller subtree is not much
+ * bigger than the window's leaf, and has a shorter path.
+ */
+#define MIN_WINDOW_INTERVALS 8
+
+/* Syscall numbers a JSET on a 32-bit word can tell apart. */
+#define WINDOW_BITS 32
+
+/*
+ * Syscall numbers lo up to the next interval's lo take |action|, or, where
+ * bit nr - lo of a non-zero |bitmap| is set, |other|.
+ */
+struct interval {
+	__u32 lo;
+	__u32 action;
+	__u32 other;
+	__u32 bitmap;
+};
+
+struct emitter {
+	struct sock_filter insns[BPF_MAXINSNS];
+	unsigned int len;
+};
+
+static void emit(struct emitter *e, __u16 code, __u32 k, __u8 jt, __u8 jf)
+{
+	if (e->len < BPF_MAXINSNS) {
+		struct sock_filter insn = BPF_JUMP(code, k, jt, jf);
+
+		e->insns[e->len] = insn;
+	}
+	/* Counting on past the end tells the caller how much was needed. */
+	e->len++;
+}
+
+static int rule_cmp(const void *a, const void *b)
+{
+	const struct bpf_policy_rule *ra = a, *rb = b;
+
+	return ra->nr < rb->nr ? -1 : ra->nr > rb->nr;
+}
+
+/*
+ * Appends the interval starting at |lo|, merging it into the last one if
+ * they take the same action and replacing the last one if it is empty.
+ */
+static void push_interval(struct interval *iv, unsigned int *n, __u32 lo,
+			  __u32 action)
+{
+	if (*n && iv[*n - 1].lo == lo)
+		(*n)--;
+	if (*n && iv[*n - 1].action == action)
+		return;
+	iv[(*n)++] = (struct interval){ .lo = lo, .action = action };
+}
+
+/*
+ * Turns the rules, sorted, into the fewest intervals covering every
+ * syscall number, the gaps between rules taking the default action.  |iv|
+ * needs room for 2 * count + 1 entries.
+ */
+static int build_intervals(const struct bpf_policy *policy,
+			   const struct bpf_policy_rule *sorted,
+			   struct interval *iv, unsigned int *n)
+{
+	unsigned int i;
+
+	*n = 0;
+	push_interval(iv, n, 0, policy->default_action);
+	for (i = 0; i < policy->count; i++) {
+		if (i && sorted[i].nr == sorted[i - 1].nr)
+			return -1;
+		push_interval(iv, n, sorted[i].nr, sorted[i].action);
+		if (sorted[i].nr != 0xffffffff)
+			push_interval(iv, n, sorted[i].nr + 1,
+				      policy->default_action);
+	}
+	return 0;
+}
+
+/*
+ * Folds runs of intervals alternating between two actions within 32
+ * syscall numbers into one bitmap interval each, when that takes fewer
+ * instructions.  The last interval runs to the top of the range, so it is
+ * never part of a window.
+ */
+static void pack_windows(struct interval *iv, unsigned int *n)
+{
+	unsigned int i = 0, j, k, out = 0;
+
+	while (i < *n) {
+		/* Take iv[j] while iv[j + 1] still bounds the window. */
+		for (j = i + 1; j + 1 < *n; j++) {
+			if (iv[j + 1].lo - iv[i].lo > WINDOW_BITS)
+				break;
+			if (j >= i + 2 && iv[j].action != iv[j - 2].action)
+				break;
+		}
+		/* The window is iv[i] up to iv[j], exclusive. */
+		if (j - i < MIN_WINDOW_INTERVALS) {
+			iv[out++] = iv[i++];
+			continue;
+		}
+		iv[out] = iv[i];
+		iv[out].other = iv[i + 1].action;
+		for (k = i + 1; k < j; k += 2) {
+			__u32 end = iv[k + 1].lo - iv[i].lo;
+			__u32 bit;
+
+			for (bit = iv[k].lo - iv[i].lo; bit < end; bit++)
+				iv[out].bitmap |= 1U << bit;
+		}
+		out++;
+		i = j;
+	}
+	*n = out;
+}
+
+/* Instructions emit_leaf() uses for |iv|. */
+static unsigned int leaf_size(const struct interval *iv)
+{
+	return iv->bitmap ? 7 : 1;
+}
+
+/*
+ * Returns the action for syscall numbers in |iv|.  A bitmap shifts its
+ * word right by nr - lo, as cBPF can't test a variable bit otherwise.
+ */
+static void emit_leaf(struct emitter *e, const struct interval *iv)
+{
+	if (iv->bitmap) {
+		emit(e, BPF_ALU|BPF_SUB|BPF_K, iv->lo, 0, 0);
+		emit(e, BPF_MISC|BPF_TAX, 0, 0, 0);
+		emit(e, BPF_LD|BPF_IMM, iv->bitmap, 0, 0);
+		emit(e, BPF_ALU|BPF_RSH|BPF_X, 0, 0, 0);
+		emit(e, BPF_JMP|BPF_JSET|BPF_K, 1, 1, 0);
+		emit(e, BPF_RET|BPF_K, iv->action, 0, 0);
+		emit(e, BPF_RET|BPF_K, iv->other, 0, 0);
+	} else {
+		emit(e, BPF_RET|BPF_K, iv->action, 0, 0);
+	}
+}
+
+/*
+ * Where to split |n| intervals so the longest path is about as short as it
+ * gets: each is weighted by 2^(instructions to return from it - 1), so a
+ * bitmap leaf sits five levels nearer the root than a RET would.
+ */
+static unsigned int split(const struct interval *iv, unsigned int n)
+{
+	unsigned long long total = 0, prefix = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		total += iv[i].bitmap ? 32 : 1;
+	for (i = 0; i + 1 < n; i++) {
+		prefix += iv[i].bitmap ? 32 : 1;
+		if (2 * prefix > total)
+			break;
+	}
+	return i ? i : 1;
+}
+
+/* Instructions emit_tree() uses for |n| intervals. */
+static unsigned int tree_size(const struct interval *iv, unsigned int n)
+{
+	unsigned int mid = split(iv, n), left;
+
+	if (n == 1)
+		return leaf_size(iv);
+	left = tree_size(iv, mid);
+	return 1 + (left > MAX_COND_JUMP) + left + tree_size(iv + mid, n - mid);
+}
+
+/*
+ * Emits a balanced search of A over |n| intervals: the lower half falls
+ * through and the upper half is jumped to, via a trampoline if the lower
+ * half is too big to jump over directly.
+ */
+static void emit_tree(struct emitter *e, const struct interval *iv,
+		      unsigned int n)
+{
+	unsigned int mid = split(iv, n), left;
+
+	if (n == 1) {
+		emit_leaf(e, iv);
+		return;
+	}
+	left = tree_size(iv, mid);
+	if (left <= MAX_COND_JUMP) {
+		emit(e, BPF_JMP|BPF_JGE|BPF_K, iv[mid].lo, left, 0);
+	} else {
+		emit(e, BPF_JMP|BPF_JGE|BPF_K, iv[mid].lo, 0, 1);
+		emit(e, BPF_JMP|BPF_JA, left, 0, 0);
+	}
+	emit_tree(e, iv, mid);
+	emit_tree(e, iv + mid, n - mid);
+}
+
+int bpf_policy_compile(const struct bpf_policy *policy,
+		       enum bpf_policy_layout layout, struct sock_fprog *prog)
+{
+	struct bpf_policy_rule *sorted = NULL;
+	struct interval *iv = NULL;
+	struct emitter *e;
+	unsigned int i, n;
+	int err = ENOMEM;
+
+	e = malloc(sizeof(*e));
+	sorted = malloc((policy->count + 1) * sizeof(*sorted));
+	iv = malloc((2 * policy->count + 1) * sizeof(*iv));
+	if (!e || !sorted || !iv)
+		goto fail;
+	e->len = 0;
+
+	/* Duplicates are refused in either layout. */
+	memcpy(sorted, policy->rules, policy->count * sizeof(*sorted));
+	qsort(sorted, policy->count, sizeof(*sorted), rule_cmp);
+	err = EINVAL;
+	if (build_intervals(policy, sorted, iv, &n))
+		goto fail;
+	if (layout == BPF_POLICY_BITMAP)
+		pack_windows(iv, &n);
+
+	emit(e, BPF_LD|BPF_W|BPF_ABS, offsetof(struct seccomp_data, arch),
+	     0, 0);
+	emit(e, BPF_JMP|BPF_JEQ|BPF_K, policy->arch, 1, 0);
+	emit(e, BPF_RET|BPF_K, SECCOMP_RET_KILL, 0, 0);
+	emit(e, BPF_LD|BPF_W|BPF_ABS, offsetof(struct seccomp_data, nr),
+	     0, 0);
+	if (layout == BPF_POLICY_LINEAR) {
+		for (i = 0; i < policy->count; i++) {
+			emit(e, BPF_JMP|BPF_JEQ|BPF_K, policy->rules[i].nr,
+			     0, 1);
+			emit(e, BPF_RET|BPF_K, policy->rules[i].action, 0, 0);
+		}
+		emit(e, BPF_RET|BPF_K, policy->default_action, 0, 0);
+	} else {
+		emit_tree(e, iv, n);
+	}
+	err = E2BIG;
+	if (e->len > BPF_MAXINSNS)
+		goto fail;
+
+	err = ENOMEM;
+	prog->filter = malloc(e->len * sizeof(*prog->filter));
+	if (!prog->filter)
+		goto fail;
+	memcpy(prog->filter, e->insns, e->len * sizeof(*prog->filter));
+	prog->len = e->len;
+	free(iv);
+	free(sorted);
+	free(e);
+	return 0;
+
+fail:
+	free(iv);
+	free(sorted);
+	free(e);
+	errno = err;
+	return -1;
+}
+
+static int parse_u32(const char *s, __u32 *value)
+{
+	unsigned long long v;
+	char *end;
+
+	if (!s)
+		return -1;
+	errno = 0;
+	v = strtoull(s, &end, 0);
+	if (errno || *end || end == s || v > 0xffffffffULL)
+		return -1;
+	*value = v;
+	return 0;
+}
+
+/* Parses an action name and its data, if it takes any. */
+static int parse_action(char *name, char *arg, __u32 *action)
+{
+	static const struct {
+		const char *name;
+		__u32 action;
+		int data;	/* 0: none, 1: optional, 2: required */
+	} actions[] = {
+		{ "kill", SECCOMP_RET_KILL, 0 },
+		{ "kill_process", SECCOMP_RET_KILL_PROCESS, 0 },
+		{ "trap", SECCOMP_RET_TRAP, 1 },
+		{ "errno", SECCOMP_RET_ERRNO, 2 },
+		{ "trace", SECCOMP_RET_TRACE, 2 },
+		{ "log", SECCOMP_RET_LOG, 0 },
+		{ "allow", SECCOMP_RET_ALLOW, 0 },
+	};
+	unsigned int i;
+	__u32 data = 0;
+
+	if (!name)
+		return -1;
+	for (i = 0; i < sizeof(actions) / sizeof(actions[0]); i++) {
+		if (strcmp(name, actions[i].name))
+			continue;
+		if (arg && (!actions[i].data || parse_u32(arg, &data) ||
+			    data > SECCOMP_RET_DATA))
+			return -1;
+		if (!arg && actions[i].data == 2)
+			return -1;
+		*action = actions[i].action | data;
+		return 0;
+	}
+	return -1;
+}
+
+int bpf_policy_parse(FILE *f, struct bpf_policy *policy, unsigned int *line)
+{
+	unsigned int cap = 0, lineno = 0, unused;
+	int have_arch = 0;
+	char buf[256];
+
+	if (!line)
+		line = &unused;
+	memset(policy, 0, sizeof(*policy));
+	policy->default_action = SECCOMP_RET_KILL;
+
+	while (fgets(buf, sizeof(buf), f)) {
+		char *word[4], *p;
+		unsigned int words = 0;
+
+		lineno++;
+		p = strchr(buf, '#');
+		if (p)
+			*p = '\0';
+		for (p = strtok(buf, " \t\r\n"); p && words < 4;
+		     p = strtok(NULL, " \t\r\n"))
+			word[words++] = p;
+		if (words == 0)
+			continue;
+		if (words > 3)
+			goto invalid;
+		while (words < 4)
+			word[words++] = NULL;
+
+		if (!strcmp(word[0], "arch")) {
+			if (word[2] || parse_u32(word[1], &policy->arch))
+				goto invalid;
+			have_arch = 1;
+		} else if (!strcmp(word[0], "default")) {
+			if (parse_action(word[1], word[2],
+					 &policy->default_action))
+				goto invalid;
+		} else {
+			struct bpf_policy_rule rule;
+
+			if (parse_u32(word[0], &rule.nr) ||
+			    parse_action(word[1], word[2], &rule.action))
+				goto invalid;
+			if (policy->count == cap) {
+				void *rules;
+
+				cap = cap ? 2 * cap : 64;
+				rules = realloc(policy->rules,
+						cap * sizeof(rule));
+				if (!rules)
+					goto fail;
+				policy->rules = rules;
+			}
+			policy->rules[policy->count++] = rule;
+		}
+	}
+	if (ferror(f))
+		goto fail;
+	if (!have_arch) {
+		lineno = 0;
+		goto invalid;
+	}
+	return 0;
+
+invalid:
+	errno = EINVAL;
+	*line = lineno;
+fail:
+	free(policy->rules);
+	policy->rules = NULL;
+	policy->count = 0;
+	return -1;
+}
@@ -0,0 +1,74 @@
+/* bpf_policy.h
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Compiles a syscall to action table into a seccomp filter.
+ *
+ * Rather than a chain of BPF_JEQ on nr, which costs one comparison per
+ * entry ahead of the one that matches, the table is split into intervals
+ * of syscall numbers sharing an action and searched with a balanced tree
+ * of BPF_JGE, so every syscall is decided in O(log n) instructions.  Jumps
+ * which would exceed the 8-bit jt/jf range go through a BPF_JA trampoline.
+ *
+ * Sparse sets make many short intervals.  The bitmap layout folds those
+ * within a 32-number window into one leaf which shifts a bitmap by nr and
+ * tests the bit with BPF_JSET.  A leaf is 7 instructions against the 15 or
+ * more for the subtree of eight or more intervals it replaces, and the
+ * tree is weighted to keep those leaves nearer the root, so the program
+ * gets smaller while the longest path stays about the same.
+ *
+ * Policies can also be read from text, one rule per line:
+ *
+ *   # x86-64
+ *   arch 0xc000003e
+ *   default errno 1
+ *   0 allow
+ *   39 trap
+ *   231 trace 7
+ *
+ * The actions are kill, kill_process, trap [N], errno N, trace N, log
+ * and allow.  The arch line is required; the default action is kill.
+ */
+#ifndef BPF_POLICY_H
+#define BPF_POLICY_H
+
+#include <stdio.h>
+
+#include "bpf_interp.h"
+
+struct bpf_policy_rule {
+	__u32 nr;
+	__u32 action;
+};
+
+struct bpf_policy {
+	__u32 arch;		/* other architectures are killed */
+	__u32 default_action;	/* for syscalls without a rule */
+	struct bpf_policy_rule *rules;
+	unsigned int count;
+};
+
+enum bpf_policy_layout {
+	BPF_POLICY_BSEARCH,	/* balanced BPF_JGE tree */
+	BPF_POLICY_BITMAP,	/* the tree, with BPF_JSET bitmap leaves */
+	BPF_POLICY_LINEAR,	/* BPF_JEQ chain in rule order, for comparison */
+};
+
+/*
+ * Compiles |policy| into |prog|, whose filter must be released with
+ * free().  Returns 0, or -1 with errno set: EINVAL if a syscall has two
+ * rules, E2BIG if the program would exceed BPF_MAXINSNS, or ENOMEM.
+ */
+int bpf_policy_compile(const struct bpf_policy *policy,
+		       enum bpf_policy_layout layout, struct sock_fprog *prog);
+
+/*
+ * Parses a text policy from |f| into |policy|, whose rules must be released
+ * with free().  Returns 0, or -1 with errno set.  For EINVAL, the offending
+ * line number, or 0 if there was no arch line, is stored in |line| if it is
+ * not NULL.
+ */
+int bpf_policy_parse(FILE *f, struct bpf_policy *policy, unsigned int *line);
+
+#endif  /* BPF_POLICY_H */
@@ -0,0 +1,336 @@
+/* bpf_trace.c
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Recorded syscall traces, and replaying them through filters.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bpf_batch.h"
+#include "bpf_trace.h"
+
+#ifndef SECCOMP_RET_USER_NOTIF
+#define SECCOMP_RET_USER_NOTIF 0x7fc00000U
+#endif
+#ifndef SECCOMP_RET_LOG
+#define SECCOMP_RET_LOG 0x7ffc0000U
+#endif
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+
+	while (len) {
+		ssize_t ret = write(fd, p, len);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+int bpf_trace_create(const char *path)
+{
+	struct bpf_trace_header header = {
+		.magic = BPF_TRACE_MAGIC,
+		.version = BPF_TRACE_VERSION,
+		.record_size = sizeof(struct seccomp_data),
+	};
+	int fd;
+
+	fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_APPEND|O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -1;
+	if (write_all(fd, &header, sizeof(header))) {
+		int saved = errno;
+
+		close(fd);
+		errno = saved;
+		return -1;
+	}
+	return fd;
+}
+
+int bpf_trace_append(int fd, const struct seccomp_data *data)
+{
+	return write_all(fd, data, sizeof(*data));
+}
+
+int bpf_trace_open(const char *path, struct bpf_trace *trace)
+{
+	const struct bpf_trace_header *header;
+	struct stat st;
+	void *map;
+	int fd, saved;
+
+	memset(trace, 0, sizeof(*trace));
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st))
+		goto fail;
+	if ((size_t)st.st_size < sizeof(*header)) {
+		errno = EINVAL;
+		goto fail;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		goto fail;
+	close(fd);
+
+	header = map;
+	if (header->magic != BPF_TRACE_MAGIC ||
+	    header->version != BPF_TRACE_VERSION ||
+	    header->record_size != sizeof(struct seccomp_data)) {
+		munmap(map, st.st_size);
+		errno = EINVAL;
+		return -1;
+	}
+	trace->map = map;
+	trace->map_len = st.st_size;
+	trace->records = (const void *)(header + 1);
+	/* A torn final record from a killed recorder is ignored. */
+	trace->count = (st.st_size - sizeof(*header)) /
+		       sizeof(struct seccomp_data);
+	return 0;
+
+fail:
+	saved = errno;
+	close(fd);
+	errno = saved;
+	return -1;
+}
+
+void bpf_trace_close(struct bpf_trace *trace)
+{
+	if (trace->map)
+		munmap(trace->map, trace->map_len);
+	memset(trace, 0, sizeof(*trace));
+}
+
+int bpf_filter_read(const char *path, struct sock_fprog *prog)
+{
+	struct sock_filter *filter = NULL;
+	struct stat st;
+	size_t len, done = 0;
+	int fd, saved;
+
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st))
+		goto fail;
+	len = st.st_size / sizeof(*filter);
+	if (st.st_size % sizeof(*filter) || len == 0 || len > BPF_MAXINSNS) {
+		errno = EINVAL;
+		goto fail;
+	}
+	filter = malloc(st.st_size);
+	if (!filter)
+		goto fail;
+	while (done < (size_t)st.st_size) {
+		ssize_t ret = read(fd, (char *)filter + done,
+				   st.st_size - done);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			if (ret == 0)
+				errno = EINVAL;
+			goto fail;
+		}
+		done += ret;
+	}
+	close(fd);
+	if (bpf_check(filter, len, NULL)) {
+		free(filter);
+		return -1;
+	}
+	prog->filter = filter;
+	prog->len = len;
+	return 0;
+
+fail:
+	saved = errno;
+	free(filter);
+	close(fd);
+	errno = saved;
+	return -1;
+}
+
+int bpf_filter_write(const char *path, const struct sock_fprog *prog)
+{
+	int fd, ret, saved;
+
+	fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -1;
+	ret = write_all(fd, prog->filter, prog->len * sizeof(*prog->filter));
+	saved = errno;
+	if (close(fd))
+		ret = -1;
+	else
+		errno = saved;
+	return ret;
+}
+
+enum bpf_action_bucket bpf_action_bucket(__u32 ret)
+{
+	switch (SECCOMP_ACTION(ret)) {
+	case SECCOMP_RET_KILL_PROCESS:
+		return BPF_ACTION_KILL_PROCESS;
+	case SECCOMP_RET_KILL:
+		return BPF_ACTION_KILL;
+	case SECCOMP_RET_TRAP:
+		return BPF_ACTION_TRAP;
+	case SECCOMP_RET_ERRNO:
+		return BPF_ACTION_ERRNO;
+	case SECCOMP_RET_USER_NOTIF:
+		return BPF_ACTION_USER_NOTIF;
+	case SECCOMP_RET_TRACE:
+		return BPF_ACTION_TRACE;
+	case SECCOMP_RET_LOG:
+		return BPF_ACTION_LOG;
+	case SECCOMP_RET_ALLOW:
+		return BPF_ACTION_ALLOW;
+	}
+	return BPF_ACTION_UNKNOWN;
+}
+
+const char *bpf_action_name(enum bpf_action_bucket bucket)
+{
+	static const char * const names[BPF_ACTION_BUCKETS] = {
+		[BPF_ACTION_KILL_PROCESS] = "KILL_PROCESS",
+		[BPF_ACTION_KILL] = "KILL",
+		[BPF_ACTION_TRAP] = "TRAP",
+		[BPF_ACTION_ERRNO] = "ERRNO",
+		[BPF_ACTION_USER_NOTIF] = "USER_NOTIF",
+		[BPF_ACTION_TRACE] = "TRACE",
+		[BPF_ACTION_LOG] = "LOG",
+		[BPF_ACTION_ALLOW] = "ALLOW",
+		[BPF_ACTION_UNKNOWN] = "unknown",
+	};
+
+	if (bucket >= BPF_ACTION_BUCKETS)
+		return NULL;
+	return names[bucket];
+}
+
+static unsigned int replay_slot(int nr)
+{
+	if (nr < 0 || nr >= BPF_REPLAY_MAX_NR)
+		return BPF_REPLAY_MAX_NR;
+	return nr;
+}
+
+static __u64 elapsed_ns(const struct timespec *start,
+			const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000000ULL +
+	       end->tv_nsec - start->tv_nsec;
+}
+
+/* Records per bpf_run_batch() call in the counting pass. */
+#define REPLAY_CHUNK 256
+
+/* Defeats dead code elimination of the timed evaluations. */
+static volatile __u32 replay_sink;
+
+int bpf_replay(const struct sock_fprog *prog, const struct bpf_trace *trace,
+	       const struct bpf_jit *jit, unsigned int passes,
+	       struct bpf_replay_stats *stats)
+{
+	size_t first[BPF_REPLAY_MAX_NR + 2];
+	const struct seccomp_data **grouped;
+	enum bpf_batch_isa isa = bpf_batch_best_isa();
+	unsigned int steps[REPLAY_CHUNK];
+	__u32 rets[REPLAY_CHUNK];
+	unsigned int slot, pass;
+	size_t i;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->passes = passes;
+	for (i = 0; i <= BPF_REPLAY_MAX_NR; i++)
+		stats->syscalls[i].min_steps = ~0U;
+
+	/* One pass, batched, for the deterministic numbers. */
+	memset(first, 0, sizeof(first));
+	for (i = 0; i < trace->count; i++) {
+		const struct seccomp_data *data = &trace->records[i];
+		struct bpf_replay_syscall *sc;
+		enum bpf_action_bucket bucket;
+		size_t chunk = i % REPLAY_CHUNK;
+
+		if (chunk == 0)
+			bpf_run_batch(prog->filter, data,
+				      trace->count - i < REPLAY_CHUNK ?
+				      trace->count - i : REPLAY_CHUNK,
+				      rets, steps, isa);
+		bucket = bpf_action_bucket(rets[chunk]);
+		slot = replay_slot(data->nr);
+		sc = &stats->syscalls[slot];
+		sc->evals++;
+		sc->steps += steps[chunk];
+		if (steps[chunk] < sc->min_steps)
+			sc->min_steps = steps[chunk];
+		if (steps[chunk] > sc->max_steps)
+			sc->max_steps = steps[chunk];
+		sc->actions[bucket]++;
+		stats->actions[bucket]++;
+		stats->steps += steps[chunk];
+		first[slot + 1]++;
+	}
+	stats->evals = trace->count;
+	if (!passes || !trace->count)
+		return 0;
+
+	/* Group the records by syscall so each can be timed on its own. */
+	grouped = malloc(trace->count * sizeof(*grouped));
+	if (!grouped)
+		return -1;
+	for (slot = 1; slot <= BPF_REPLAY_MAX_NR + 1; slot++)
+		first[slot] += first[slot - 1];
+	for (i = 0; i < trace->count; i++) {
+		slot = replay_slot(trace->records[i].nr);
+		grouped[first[slot]++] = &trace->records[i];
+	}
+	/* first[slot] now marks the end of each group. */
+	for (slot = 0; slot <= BPF_REPLAY_MAX_NR; slot++) {
+		struct bpf_replay_syscall *sc = &stats->syscalls[slot];
+		size_t end = first[slot], begin = end - sc->evals;
+		struct timespec start, stop;
+
+		if (!sc->evals)
+			continue;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (pass = 0; pass < passes; pass++) {
+			if (jit) {
+				for (i = begin; i < end; i++)
+					replay_sink = jit->func(grouped[i]);
+				continue;
+			}
+			for (i = begin; i < end; i++)
+				replay_sink = bpf_run(prog->filter,
+						      grouped[i], NULL);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &stop);
+		sc->ns = elapsed_ns(&start, &stop);
+		stats->ns += sc->ns;
+	}
+	free(grouped);
+	return 0;
+}
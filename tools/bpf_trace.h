@@ -0,0 +1,120 @@
+/* bpf_trace.h
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Recorded syscall traces, and replaying them through filters.
+ *
+ * A trace file is a struct bpf_trace_header followed by one struct
+ * seccomp_data per syscall, in the order the kernel handed them to seccomp.
+ * Records are fixed size and 8-byte aligned so a trace can be mapped and
+ * walked in place, and a recorder which dies early still leaves a valid
+ * file: the record count is derived from the file size.
+ *
+ * Filter files are the bare array of struct sock_filter, as passed to the
+ * kernel in struct sock_fprog.
+ */
+#ifndef BPF_TRACE_H
+#define BPF_TRACE_H
+
+#include <stddef.h>
+
+#include "bpf_interp.h"
+#include "bpf_jit.h"
+
+#define BPF_TRACE_MAGIC   0x52544353U /* "SCTR" */
+#define BPF_TRACE_VERSION 1
+
+struct bpf_trace_header {
+	__u32 magic;
+	__u32 version;
+	__u32 record_size;	/* sizeof(struct seccomp_data) */
+	__u32 reserved;
+};
+
+/* A mapped trace file. */
+struct bpf_trace {
+	const struct seccomp_data *records;
+	size_t count;
+	void *map;
+	size_t map_len;
+};
+
+/*
+ * Creates (or truncates) |path| and writes the header.  Returns a file
+ * descriptor for bpf_trace_append(), or -1 with errno set.
+ */
+int bpf_trace_create(const char *path);
+
+/* Appends one record.  Returns 0, or -1 with errno set. */
+int bpf_trace_append(int fd, const struct seccomp_data *data);
+
+/*
+ * Maps the trace at |path|.  Returns 0, or -1 with errno set; EINVAL means
+ * the file is not a trace this code understands.
+ */
+int bpf_trace_open(const char *path, struct bpf_trace *trace);
+void bpf_trace_close(struct bpf_trace *trace);
+
+/*
+ * Reads a filter file into |prog|, whose filter must be released with
+ * free().  Returns 0, or -1 with errno set; EINVAL means the size is not a
+ * whole number of instructions or the program fails bpf_check().
+ */
+int bpf_filter_read(const char *path, struct sock_fprog *prog);
+int bpf_filter_write(const char *path, const struct sock_fprog *prog);
+
+/* Buckets for action histograms, in seccomp_action_rank() order. */
+enum bpf_action_bucket {
+	BPF_ACTION_KILL_PROCESS,
+	BPF_ACTION_KILL,
+	BPF_ACTION_TRAP,
+	BPF_ACTION_ERRNO,
+	BPF_ACTION_USER_NOTIF,
+	BPF_ACTION_TRACE,
+	BPF_ACTION_LOG,
+	BPF_ACTION_ALLOW,
+	BPF_ACTION_UNKNOWN,
+	BPF_ACTION_BUCKETS
+};
+
+enum bpf_action_bucket bpf_action_bucket(__u32 ret);
+const char *bpf_action_name(enum bpf_action_bucket bucket);
+
+/* Syscall numbers at or above this share the last per-syscall slot. */
+#define BPF_REPLAY_MAX_NR 1024
+
+struct bpf_replay_syscall {
+	__u64 evals;
+	__u64 steps;
+	__u32 min_steps;
+	__u32 max_steps;
+	__u64 ns;		/* time spent over all passes */
+	__u64 actions[BPF_ACTION_BUCKETS];
+};
+
+struct bpf_replay_stats {
+	__u64 evals;
+	__u64 steps;
+	__u64 ns;
+	unsigned int passes;
+	__u64 actions[BPF_ACTION_BUCKETS];
+	struct bpf_replay_syscall syscalls[BPF_REPLAY_MAX_NR + 1];
+};
+
+/*
+ * Runs every record of |trace| through the checked filter |prog|.  Step
+ * counts and actions are taken from one pass with bpf_run_batch() on the
+ * widest instruction set available, so passes == 0 gives the quickest
+ * what-if answer for a large trace.  The time is measured over |passes|
+ * passes with the records grouped by syscall, so each syscall's cost is
+ * timed on its own rather than inferred from the total.  Timing runs
+ * |jit|, which must be compiled from |prog|, or bpf_run() if it is NULL.
+ * Returns 0, or -1 with errno set if memory for the grouping can't be
+ * allocated.
+ */
+int bpf_replay(const struct sock_fprog *prog, const struct bpf_trace *trace,
+	       const struct bpf_jit *jit, unsigned int passes,
+	       struct bpf_replay_stats *stats);
+
+#endif  /* BPF_TRACE_H */
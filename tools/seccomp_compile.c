@@ -0,0 +1,163 @@
+/* seccomp_compile.c
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Compiles a text policy (see bpf_policy.h) into a filter file and reports
+ * how many instructions each rule's syscall runs through.
+ *
+ *   seccomp_compile [-b | -l] [-v] [-o FILTER] POLICY
+ *
+ * -b uses bitmap leaves in the search tree, and -l emits the linear BPF_JEQ
+ * chain instead, to compare.  -v lists every range of syscall numbers which
+ * shares a path through the filter, with its action and length.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bpf_policy.h"
+#include "bpf_trace.h"
+
+static int u32_cmp(const void *a, const void *b)
+{
+	__u32 x = *(const __u32 *)a, y = *(const __u32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * Paths through the filter only change where a rule starts or ends, so
+ * running the lowest number of each such range covers every path.
+ */
+static void report_paths(const struct bpf_policy *policy,
+			 const struct sock_fprog *prog, int verbose)
+{
+	struct seccomp_data data;
+	unsigned int i, n = 0, unique, steps, max = 0;
+	__u32 *lo;
+
+	lo = malloc((2 * policy->count + 1) * sizeof(*lo));
+	if (!lo)
+		err(1, "malloc");
+	lo[n++] = 0;
+	for (i = 0; i < policy->count; i++) {
+		lo[n++] = policy->rules[i].nr;
+		if (policy->rules[i].nr != 0xffffffff)
+			lo[n++] = policy->rules[i].nr + 1;
+	}
+	qsort(lo, n, sizeof(*lo), u32_cmp);
+	for (i = 1, unique = 1; i < n; i++)
+		if (lo[i] != lo[unique - 1])
+			lo[unique++] = lo[i];
+	n = unique;
+
+	memset(&data, 0, sizeof(data));
+	data.arch = policy->arch;
+	for (i = 0; i < n; i++) {
+		__u32 ret;
+
+		data.nr = lo[i];
+		ret = bpf_run(prog->filter, &data, &steps);
+		if (steps > max)
+			max = steps;
+		if (!verbose)
+			continue;
+		if (i + 1 < n)
+			printf("%10u-%-10u", lo[i], lo[i + 1] - 1);
+		else
+			printf("%10u-%-10u", lo[i], 0xffffffff);
+		printf(" %-12s %#10x %4u\n",
+		       bpf_action_name(bpf_action_bucket(ret)), ret, steps);
+	}
+	printf("longest path: %u instructions\n", max);
+	free(lo);
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s [-b | -l] [-v] [-o FILTER] POLICY\n", argv0);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	enum bpf_policy_layout layout = BPF_POLICY_BSEARCH;
+	const char *out = "seccomp.bpf";
+	unsigned int i, line, min = ~0U, max = 0;
+	unsigned long long total = 0;
+	struct bpf_policy policy;
+	struct sock_fprog prog;
+	FILE *f;
+	int opt, verbose = 0;
+
+	while ((opt = getopt(argc, argv, "blo:v")) != -1) {
+		switch (opt) {
+		case 'b':
+			layout = BPF_POLICY_BITMAP;
+			break;
+		case 'l':
+			layout = BPF_POLICY_LINEAR;
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind != 1)
+		usage(argv[0]);
+
+	f = fopen(argv[optind], "r");
+	if (!f)
+		err(1, "%s", argv[optind]);
+	if (bpf_policy_parse(f, &policy, &line)) {
+		if (errno == EINVAL && line)
+			errx(1, "%s:%u: invalid rule", argv[optind], line);
+		if (errno == EINVAL)
+			errx(1, "%s: no arch line", argv[optind]);
+		err(1, "%s", argv[optind]);
+	}
+	fclose(f);
+	if (bpf_policy_compile(&policy, layout, &prog)) {
+		if (errno == EINVAL)
+			errx(1, "%s: a syscall has more than one rule",
+			     argv[optind]);
+		err(1, "compiling %s", argv[optind]);
+	}
+	if (bpf_filter_write(out, &prog))
+		err(1, "%s", out);
+
+	for (i = 0; i < policy.count; i++) {
+		struct seccomp_data data;
+		unsigned int steps;
+
+		memset(&data, 0, sizeof(data));
+		data.nr = policy.rules[i].nr;
+		data.arch = policy.arch;
+		bpf_run(prog.filter, &data, &steps);
+		total += steps;
+		if (steps < min)
+			min = steps;
+		if (steps > max)
+			max = steps;
+	}
+	printf("%s: %u rules, %u instructions", out, policy.count, prog.len);
+	if (policy.count)
+		printf(", %u/%.1f/%u min/mean/max per rule", min,
+		       (double)total / policy.count, max);
+	printf("\n");
+	report_paths(&policy, &prog, verbose);
+
+	free(prog.filter);
+	free(policy.rules);
+	return 0;
+}
@@ -0,0 +1,102 @@
+/* seccomp_cost.c
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Reports what each syscall number costs a filter, or a chain of them,
+ * with bpf_cost_chain(), as JSON.
+ *
+ *   seccomp_cost [-a ARCH] FILTER...
+ *
+ * FILTERs are given in the order they would be installed.  -a takes arch
+ * to be ARCH rather than anything, so paths for other architectures don't
+ * count.  The output gives the chain's length as the kernel checks it
+ * against MAX_INSNS_PER_PATH, converted to eBPF with the penalties, and
+ * as given, the longest path, and for every range of syscall numbers
+ * sharing a cost the fewest and most instructions run:
+ *
+ *   {
+ *     "filters": 1,
+ *     "insns": 41,
+ *     "classic_insns": 21,
+ *     "max_insns_per_path": 32768,
+ *     "worst": 9,
+ *     "syscalls": [
+ *       { "first": 0, "last": 2, "min": 5, "max": 5 },
+ *       ...
+ *     ]
+ *   }
+ *
+ * Exits 1 if the last filter would be refused for the length of the chain,
+ * unless the JIT is hardened, which lengthens the programs further, or 2
+ * on errors.
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bpf_cost.h"
+#include "bpf_trace.h"
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s [-a ARCH] FILTER...\n", argv0);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct sock_fprog *chain;
+	struct bpf_cost cost;
+	unsigned int i, count;
+	__u32 arch, *parch = NULL;
+	char *end;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "a:")) != -1) {
+		switch (opt) {
+		case 'a':
+			arch = strtoul(optarg, &end, 0);
+			if (!*optarg || *end)
+				usage(argv[0]);
+			parch = &arch;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind == argc)
+		usage(argv[0]);
+
+	count = argc - optind;
+	chain = calloc(count, sizeof(*chain));
+	if (!chain)
+		err(2, "calloc");
+	for (i = 0; i < count; i++)
+		if (bpf_filter_read(argv[optind + i], &chain[i]))
+			err(2, "%s", argv[optind + i]);
+	if (bpf_cost_chain(chain, count, parch, &cost))
+		err(2, "walking the filters");
+
+	printf("{\n");
+	printf("  \"filters\": %u,\n", count);
+	printf("  \"insns\": %u,\n", cost.insns);
+	printf("  \"classic_insns\": %u,\n", cost.classic);
+	printf("  \"max_insns_per_path\": %u,\n", BPF_MAX_INSNS_PER_PATH);
+	printf("  \"worst\": %u,\n", cost.worst);
+	printf("  \"syscalls\": [\n");
+	for (i = 0; i < cost.count; i++)
+		printf("    { \"first\": %u, \"last\": %u, \"min\": %u, "
+		       "\"max\": %u }%s\n", cost.ranges[i].lo,
+		       cost.ranges[i].hi, cost.ranges[i].min,
+		       cost.ranges[i].max, i + 1 < cost.count ? "," : "");
+	printf("  ]\n}\n");
+
+	free(cost.ranges);
+	for (i = 0; i < count; i++)
+		free(chain[i].filter);
+	free(chain);
+	return cost.insns > BPF_MAX_INSNS_PER_PATH;
+}
@@ -0,0 +1,126 @@
+/* seccomp_equiv.c
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Checks that two filters, or chains of them, agree with bpf_equiv().
+ *
+ *   seccomp_equiv [-o TRACE] FILTER... -- FILTER...
+ *
+ * Each side's FILTERs are given in the order they would be installed, as
+ * for seccomp_merge, so a merged or optimized filter can be checked
+ * against what it came from.  Where they differ, the data they differ on
+ * is printed with both verdicts and, with -o, written as a one-record
+ * trace for seccomp_replay.  Exits 0 if they are equivalent, 1 if they
+ * differ, 3 if neither could be shown and 2 on errors.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bpf_equiv.h"
+#include "bpf_trace.h"
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s [-o TRACE] FILTER... -- FILTER...\n",
+		argv0);
+	exit(2);
+}
+
+static struct sock_fprog *read_side(char **paths, unsigned int count)
+{
+	struct sock_fprog *side;
+	unsigned int i;
+
+	side = calloc(count, sizeof(*side));
+	if (!side)
+		err(2, "calloc");
+	for (i = 0; i < count; i++)
+		if (bpf_filter_read(paths[i], &side[i]))
+			err(2, "%s", paths[i]);
+	return side;
+}
+
+static void free_side(struct sock_fprog *side, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		free(side[i].filter);
+	free(side);
+}
+
+static void report(const struct seccomp_data *data, __u32 ret_a, __u32 ret_b)
+{
+	unsigned int i;
+
+	printf("different: nr %d arch 0x%x ip 0x%llx\n", data->nr,
+	       data->arch, (unsigned long long)data->instruction_pointer);
+	for (i = 0; i < 6; i++)
+		printf("  args[%u] 0x%llx\n", i,
+		       (unsigned long long)data->args[i]);
+	printf("  0x%08x vs 0x%08x\n", ret_a, ret_b);
+}
+
+int main(int argc, char **argv)
+{
+	struct sock_fprog *a, *b;
+	struct bpf_equiv_stats stats;
+	struct seccomp_data counter;
+	const char *out = NULL;
+	unsigned int na, nb;
+	int opt, sep, ret, fd;
+
+	while ((opt = getopt(argc, argv, "+o:")) != -1) {
+		switch (opt) {
+		case 'o':
+			out = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	for (sep = optind; sep < argc; sep++)
+		if (!strcmp(argv[sep], "--"))
+			break;
+	if (sep == optind || sep >= argc - 1)
+		usage(argv[0]);
+
+	na = sep - optind;
+	nb = argc - sep - 1;
+	a = read_side(&argv[optind], na);
+	b = read_side(&argv[sep + 1], nb);
+
+	ret = bpf_equiv(a, na, b, nb, &counter, &stats);
+	switch (ret) {
+	case BPF_EQUIV_SAME:
+		printf("equivalent: %lu paths compared, %lu splits\n",
+		       stats.paths, stats.splits);
+		break;
+	case BPF_EQUIV_DIFFERENT:
+		report(&counter, bpf_run_chain(a, na, &counter),
+		       bpf_run_chain(b, nb, &counter));
+		if (!out)
+			break;
+		fd = bpf_trace_create(out);
+		if (fd < 0 || bpf_trace_append(fd, &counter) || close(fd))
+			err(2, "%s", out);
+		break;
+	case BPF_EQUIV_UNKNOWN:
+		printf("unknown: %lu of %lu paths undecided\n",
+		       stats.undecided, stats.paths);
+		ret = 3;
+		break;
+	default:
+		err(2, "comparing");
+	}
+
+	free_side(a, na);
+	free_side(b, nb);
+	return ret;
+}
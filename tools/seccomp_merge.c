@@ -0,0 +1,115 @@
+/* seccomp_merge.c
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Merges filters which would be stacked into one with bpf_chain_merge().
+ *
+ *   seccomp_merge [-o OUT] [-t TRACE] FILTER...
+ *
+ * FILTERs are given in the order they would be installed.  The report
+ * compares what the chain counts against the kernel's MAX_INSNS_PER_PATH,
+ * its programs' lengths converted to eBPF plus 4 for every filter but the
+ * last, as bpf_cost_chain() does, with the merged program's.  Given a
+ * trace from seccomp_record, both are run over every record: any record
+ * they disagree on is an error, and the mean path lengths are reported.
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bpf_cost.h"
+#include "bpf_merge.h"
+#include "bpf_trace.h"
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s [-o OUT] [-t TRACE] FILTER...\n", argv0);
+	exit(2);
+}
+
+static void compare(const struct sock_fprog *chain, unsigned int count,
+		    const struct sock_fprog *merged, const char *path)
+{
+	unsigned long long steps_chain = 0, steps_merged = 0;
+	struct bpf_trace trace;
+	unsigned int i;
+	size_t r;
+
+	if (bpf_trace_open(path, &trace))
+		err(1, "%s", path);
+	for (r = 0; r < trace.count; r++) {
+		const struct seccomp_data *data = &trace.records[r];
+		unsigned int steps;
+
+		for (i = 0; i < count; i++) {
+			bpf_run(chain[i].filter, data, &steps);
+			steps_chain += steps;
+		}
+		if (bpf_run_chain(chain, count, data) !=
+		    bpf_run(merged->filter, data, &steps))
+			errx(1, "%s: record %zu (nr %d) differs", path, r,
+			     data->nr);
+		steps_merged += steps;
+	}
+	if (trace.count)
+		printf("%s: %zu records, %.2f -> %.2f instructions each\n",
+		       path, trace.count, (double)steps_chain / trace.count,
+		       (double)steps_merged / trace.count);
+	bpf_trace_close(&trace);
+}
+
+int main(int argc, char **argv)
+{
+	const char *out = NULL, *trace = NULL;
+	struct bpf_opt_stats stats;
+	struct sock_fprog *chain, merged;
+	unsigned int i, count, total = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "o:t:")) != -1) {
+		switch (opt) {
+		case 'o':
+			out = optarg;
+			break;
+		case 't':
+			trace = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind == argc)
+		usage(argv[0]);
+
+	count = argc - optind;
+	chain = calloc(count, sizeof(*chain));
+	if (!chain)
+		err(1, "calloc");
+	for (i = 0; i < count; i++) {
+		if (bpf_filter_read(argv[optind + i], &chain[i]))
+			err(1, "%s", argv[optind + i]);
+		total += bpf_converted_len(chain[i].filter, chain[i].len) +
+			 (i + 1 < count ? BPF_FILTER_PENALTY : 0);
+	}
+	if (bpf_chain_merge(chain, count, &merged, &stats))
+		err(1, "merging");
+
+	printf("%u filters: %u eBPF instructions per path with the penalty\n",
+	       count, total);
+	printf("merged: %u instructions, %u before optimizing, %u in eBPF\n",
+	       merged.len, stats.before,
+	       bpf_converted_len(merged.filter, merged.len));
+	if (trace)
+		compare(chain, count, &merged, trace);
+	if (out && bpf_filter_write(out, &merged))
+		err(1, "%s", out);
+
+	free(merged.filter);
+	for (i = 0; i < count; i++)
+		free(chain[i].filter);
+	free(chain);
+	return 0;
+}
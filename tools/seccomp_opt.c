@@ -0,0 +1,102 @@
+/* seccomp_opt.c
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Shortens a filter with bpf_optimize() and reports the instruction counts
+ * before and after.
+ *
+ *   seccomp_opt [-o OUT] FILTER [TRACE]
+ *
+ * Given a trace from seccomp_record, both programs are run over every
+ * record: any record they disagree on is an error, and the mean path
+ * lengths are reported.
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bpf_opt.h"
+#include "bpf_trace.h"
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s [-o OUT] FILTER [TRACE]\n", argv0);
+	exit(2);
+}
+
+static void compare(const struct sock_fprog *before,
+		    const struct sock_fprog *after, const char *path)
+{
+	unsigned long long steps_before = 0, steps_after = 0;
+	struct bpf_trace trace;
+	size_t i;
+
+	if (bpf_trace_open(path, &trace))
+		err(1, "%s", path);
+	for (i = 0; i < trace.count; i++) {
+		const struct seccomp_data *data = &trace.records[i];
+		unsigned int steps;
+		__u32 ret;
+
+		ret = bpf_run(before->filter, data, &steps);
+		steps_before += steps;
+		if (ret != bpf_run(after->filter, data, &steps))
+			errx(1, "%s: record %zu (nr %d) differs", path, i,
+			     data->nr);
+		steps_after += steps;
+	}
+	if (trace.count)
+		printf("%s: %zu records, %.2f -> %.2f instructions each\n",
+		       path, trace.count, (double)steps_before / trace.count,
+		       (double)steps_after / trace.count);
+	bpf_trace_close(&trace);
+}
+
+int main(int argc, char **argv)
+{
+	struct sock_fprog before, after;
+	struct bpf_opt_stats stats;
+	const char *out = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "o:")) != -1) {
+		switch (opt) {
+		case 'o':
+			out = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind != 1 && argc - optind != 2)
+		usage(argv[0]);
+
+	if (bpf_filter_read(argv[optind], &before))
+		err(1, "%s", argv[optind]);
+	after.len = before.len;
+	after.filter = malloc(before.len * sizeof(*after.filter));
+	if (!after.filter)
+		err(1, "malloc");
+	memcpy(after.filter, before.filter,
+	       before.len * sizeof(*after.filter));
+	if (bpf_optimize(&after, &stats))
+		err(1, "optimizing %s", argv[optind]);
+
+	printf("%s: %u -> %u instructions\n", argv[optind], before.len,
+	       after.len);
+	printf("  %u loads, %u dead removed; %u jumps threaded, "
+	       "%u merged; %u rounds\n", stats.loads, stats.dead,
+	       stats.threaded, stats.merged, stats.rounds);
+	if (argc - optind == 2)
+		compare(&before, &after, argv[optind + 1]);
+	if (out && bpf_filter_write(out, &after))
+		err(1, "%s", out);
+
+	free(after.filter);
+	free(before.filter);
+	return 0;
+}
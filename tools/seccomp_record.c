@@ -0,0 +1,207 @@
+/* seccomp_record.c
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Records the syscalls a command makes, as seccomp sees them, into a trace
+ * file for seccomp_replay.
+ *
+ *   seccomp_record [-o FILE] COMMAND [ARG...]
+ *
+ * The command runs under a filter which returns SECCOMP_RET_TRACE for
+ * everything, so this is the RET_TRACE tracer from the tests driving
+ * PTRACE_GET_SYSCALL_INFO: each seccomp stop yields the struct seccomp_data
+ * the kernel built, including for the command's children and threads.
+ * Syscalls are recorded, not changed, and the command's exit status is
+ * passed on.
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <linux/ptrace.h>
+
+#include "bpf_trace.h"
+
+#ifndef PR_SET_NO_NEW_PRIVS
+#define PR_SET_NO_NEW_PRIVS 38
+#endif
+
+#ifndef SECCOMP_MODE_FILTER
+#define SECCOMP_MODE_FILTER 2
+#endif
+
+#ifndef PTRACE_EVENT_SECCOMP
+#define PTRACE_EVENT_SECCOMP 7
+#endif
+#ifndef PTRACE_O_TRACESECCOMP
+#define PTRACE_O_TRACESECCOMP (1 << PTRACE_EVENT_SECCOMP)
+#endif
+#ifndef PTRACE_O_EXITKILL
+#define PTRACE_O_EXITKILL (1 << 20)
+#endif
+
+#ifndef PTRACE_GET_SYSCALL_INFO
+#define PTRACE_GET_SYSCALL_INFO 0x420e
+#define PTRACE_SYSCALL_INFO_SECCOMP 3
+
+struct ptrace_syscall_info {
+	__u8 op;
+	__u8 pad[3];
+	__u32 arch;
+	__u64 instruction_pointer;
+	__u64 stack_pointer;
+	union {
+		struct {
+			__u64 nr;
+			__u64 args[6];
+		} entry;
+		struct {
+			__s64 rval;
+			__u8 is_error;
+		} exit;
+		struct {
+			__u64 nr;
+			__u64 args[6];
+			__u32 ret_data;
+		} seccomp;
+	};
+};
+#endif
+
+#define STOP_EVENT(_status) ((_status) >> 16)
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s [-o FILE] COMMAND [ARG...]\n", argv0);
+	exit(2);
+}
+
+/* Runs in the child: stop for the tracer, trace everything, then exec. */
+static void run_tracee(char **argv)
+{
+	struct sock_filter filter[] = {
+		BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_TRACE),
+	};
+	struct sock_fprog prog = {
+		.len = (unsigned short)(sizeof(filter) / sizeof(filter[0])),
+		.filter = filter,
+	};
+
+	if (ptrace(PTRACE_TRACEME, 0, NULL, NULL))
+		err(127, "PTRACE_TRACEME");
+	raise(SIGSTOP);
+	if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0))
+		err(127, "PR_SET_NO_NEW_PRIVS");
+	if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog, 0, 0))
+		err(127, "PR_SET_SECCOMP");
+	execvp(argv[0], argv);
+	err(127, "%s", argv[0]);
+}
+
+static int record_stop(pid_t pid, int fd)
+{
+	struct ptrace_syscall_info info;
+	struct seccomp_data data;
+	long ret;
+
+	ret = ptrace(PTRACE_GET_SYSCALL_INFO, pid, sizeof(info), &info);
+	if (ret < 0)
+		err(1, "PTRACE_GET_SYSCALL_INFO");
+	if (info.op != PTRACE_SYSCALL_INFO_SECCOMP)
+		return 0;
+
+	memset(&data, 0, sizeof(data));
+	data.nr = (int)info.seccomp.nr;
+	data.arch = info.arch;
+	data.instruction_pointer = info.instruction_pointer;
+	memcpy(data.args, info.seccomp.args, sizeof(data.args));
+	if (bpf_trace_append(fd, &data))
+		err(1, "writing trace");
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = "seccomp.trace";
+	unsigned long records = 0;
+	int opt, fd, status, exit_status = 1;
+	pid_t child, pid;
+
+	while ((opt = getopt(argc, argv, "+o:")) != -1) {
+		switch (opt) {
+		case 'o':
+			path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind >= argc)
+		usage(argv[0]);
+
+	fd = bpf_trace_create(path);
+	if (fd < 0)
+		err(1, "%s", path);
+
+	child = fork();
+	if (child < 0)
+		err(1, "fork");
+	if (child == 0) {
+		close(fd);
+		run_tracee(&argv[optind]);
+	}
+
+	if (waitpid(child, &status, 0) != child || !WIFSTOPPED(status))
+		errx(1, "child did not stop for tracing");
+	if (ptrace(PTRACE_SETOPTIONS, child, NULL,
+		   PTRACE_O_TRACESECCOMP | PTRACE_O_EXITKILL |
+		   PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK |
+		   PTRACE_O_TRACECLONE))
+		err(1, "PTRACE_SETOPTIONS");
+	if (ptrace(PTRACE_CONT, child, NULL, NULL))
+		err(1, "PTRACE_CONT");
+
+	/* Run until every traced task is gone. */
+	while ((pid = waitpid(-1, &status, __WALL)) > 0) {
+		int sig = 0;
+
+		if (WIFEXITED(status) || WIFSIGNALED(status)) {
+			if (pid == child)
+				exit_status = WIFEXITED(status) ?
+					WEXITSTATUS(status) :
+					128 + WTERMSIG(status);
+			continue;
+		}
+		if (!WIFSTOPPED(status))
+			continue;
+		switch (STOP_EVENT(status)) {
+		case PTRACE_EVENT_SECCOMP:
+			records += record_stop(pid, fd);
+			break;
+		case 0:
+			/* Signal delivery; new tasks also start with SIGSTOP. */
+			if (WSTOPSIG(status) != SIGSTOP &&
+			    WSTOPSIG(status) != SIGTRAP)
+				sig = WSTOPSIG(status);
+			break;
+		}
+		/* The task may have been killed in the meantime. */
+		ptrace(PTRACE_CONT, pid, NULL, sig);
+	}
+	if (errno != ECHILD)
+		err(1, "waitpid");
+	if (close(fd))
+		err(1, "%s", path);
+	fprintf(stderr, "%s: %lu syscalls recorded to %s\n", argv[0],
+		records, path);
+	return exit_status;
+}
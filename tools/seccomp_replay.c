@@ -0,0 +1,136 @@
+/* seccomp_replay.c
+ * Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Replays a trace from seccomp_record through a filter and reports what it
+ * costs per syscall and which actions it takes, so candidate policies can be
+ * compared on a real syscall mix.
+ *
+ *   seccomp_replay [-j] [-n PASSES] FILTER TRACE
+ *
+ * FILTER is a bare array of struct sock_filter.  Instruction counts are
+ * exact; times are the mean over PASSES replays of each syscall's records,
+ * interpreted or, with -j, compiled to native code.  The compiled filter
+ * is checked against the interpreter over the whole trace first.
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bpf_batch.h"
+#include "bpf_jit.h"
+#include "bpf_trace.h"
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s [-j] [-n PASSES] FILTER TRACE\n", argv0);
+	exit(2);
+}
+
+static void print_actions(const __u64 *actions, __u64 evals)
+{
+	int b;
+
+	for (b = 0; b < BPF_ACTION_BUCKETS; b++) {
+		if (!actions[b])
+			continue;
+		printf(" %s:%.1f%%", bpf_action_name(b),
+		       100.0 * actions[b] / evals);
+	}
+	printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct bpf_replay_stats *stats;
+	struct sock_fprog prog;
+	struct bpf_trace trace;
+	struct bpf_jit jit, *use_jit = NULL;
+	unsigned int passes = 100;
+	int opt, slot, b, compile = 0;
+
+	while ((opt = getopt(argc, argv, "jn:")) != -1) {
+		switch (opt) {
+		case 'j':
+			compile = 1;
+			break;
+		case 'n':
+			passes = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind != 2)
+		usage(argv[0]);
+
+	if (bpf_filter_read(argv[optind], &prog))
+		err(1, "%s", argv[optind]);
+	if (bpf_trace_open(argv[optind + 1], &trace))
+		err(1, "%s", argv[optind + 1]);
+	if (compile) {
+		size_t bad;
+
+		if (bpf_jit_compile(prog.filter, prog.len, &jit))
+			err(1, "compiling %s", argv[optind]);
+		bad = bpf_jit_verify(&jit, prog.filter, trace.records,
+				     trace.count);
+		if (bad != trace.count)
+			errx(1, "compiled filter disagrees with the "
+			     "interpreter on record %zu", bad);
+		use_jit = &jit;
+	}
+	stats = malloc(sizeof(*stats));
+	if (!stats || bpf_replay(&prog, &trace, use_jit, passes, stats))
+		err(1, "replay");
+
+	printf("%zu syscalls through %u instructions, %u %s passes, "
+	       "counted with %s batches\n", trace.count, prog.len, passes,
+	       use_jit ? "compiled" : "interpreted",
+	       bpf_batch_isa_name(bpf_batch_best_isa()));
+	if (!stats->evals)
+		return 0;
+	printf("mean %.2f instructions", (double)stats->steps / stats->evals);
+	if (passes)
+		printf(", %.2f ns per syscall",
+		       (double)stats->ns / stats->evals / passes);
+	printf("\n\n%-8s", "action");
+	for (b = 0; b < BPF_ACTION_BUCKETS; b++)
+		if (stats->actions[b])
+			printf(" %12s", bpf_action_name(b));
+	printf("\n%-8s", "count");
+	for (b = 0; b < BPF_ACTION_BUCKETS; b++)
+		if (stats->actions[b])
+			printf(" %12llu", (unsigned long long)stats->actions[b]);
+
+	printf("\n\n%6s %10s %7s %7s %7s %9s  %s\n", "nr", "count",
+	       "min", "mean", "max", "ns", "actions");
+	for (slot = 0; slot <= BPF_REPLAY_MAX_NR; slot++) {
+		const struct bpf_replay_syscall *sc = &stats->syscalls[slot];
+
+		if (!sc->evals)
+			continue;
+		if (slot == BPF_REPLAY_MAX_NR)
+			printf("%6s", "other");
+		else
+			printf("%6d", slot);
+		printf(" %10llu %7u %7.2f %7u", (unsigned long long)sc->evals,
+		       sc->min_steps, (double)sc->steps / sc->evals,
+		       sc->max_steps);
+		if (passes)
+			printf(" %9.2f", (double)sc->ns / sc->evals / passes);
+		else
+			printf(" %9s", "-");
+		print_actions(sc->actions, sc->evals);
+	}
+
+	free(stats);
+	if (use_jit)
+		bpf_jit_free(use_jit);
+	bpf_trace_close(&trace);
+	free(prog.filter);
+	return 0;
+}